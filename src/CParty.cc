@@ -6,6 +6,7 @@
 #include "fixed_structure_energy_internal.hh"
 #include "h_globals.hh"
 #include "hotspot.hh"
+#include "parallel.hh"
 #include "part_func.hh"
 // a simple driver for the HFold
 #include <algorithm>
@@ -13,6 +14,7 @@
 #include <fstream>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
 #include <stdio.h>
 #include <string>
 #include <sys/stat.h>
@@ -22,25 +24,46 @@ bool exists(const std::string path) {
     return (stat(path.c_str(), &buffer) == 0);
 }
 
-void get_input(std::string file, std::string &sequence, std::string &structure) {
-    if (!exists(file)) {
-        std::cout << "Input file does not exist" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    std::ifstream in(file.c_str());
-    std::string str;
-    int i = 0;
-    while (getline(in, str)) {
-        if (str[0] == '>') continue;
-        if (i == 0) sequence = str;
-        if (i == 1) structure = str;
-        ++i;
+struct FastaRecord {
+    std::string name;
+    std::string sequence;
+    std::string structure;
+};
+
+bool is_structure_line(const std::string &line) {
+    return !line.empty() && line.find_first_not_of(".()[]{}<>x") == std::string::npos;
+}
+
+// Reads the next record of a (multi-)FASTA stream: an optional >name line, the sequence (over several lines only when
+// the record has a header) and an optional constraint line. Returns false once the stream holds no further sequence.
+bool read_fasta_record(std::istream &in, FastaRecord &record) {
+    record = FastaRecord();
+    std::string line;
+    while (in.peek() != EOF) {
+        if (in.peek() == '>' && !record.sequence.empty()) break;
+        // without a header every sequence line starts a record of its own
+        if (record.name.empty() && !record.sequence.empty() && std::string(".()[]{}<>x").find((char)in.peek()) == std::string::npos) break;
+        std::getline(in, line);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) {
+            if (record.sequence.empty()) continue;
+            break;
+        }
+        if (line[0] == '>') {
+            record.name = line;
+            continue;
+        }
+        if (!record.sequence.empty() && is_structure_line(line)) {
+            record.structure = line;
+            break;
+        }
+        record.sequence += line;
     }
-    in.close();
+    return !record.sequence.empty();
 }
 
 // check length and if any characters other than ._()
-void validateStructure(std::string &seq, std::string &structure) {
+bool validateStructure(std::string &seq, std::string &structure) {
     int n = structure.length();
     std::vector<int> pairs;
     for (int j = 0; j < n; ++j) {
@@ -48,7 +71,7 @@ void validateStructure(std::string &seq, std::string &structure) {
         if (structure[j] == ')') {
             if (pairs.empty()) {
                 std::cout << "Incorrect input: More left parentheses than right" << std::endl;
-                exit(0);
+                return false;
             } else {
                 int i = pairs.back();
                 pairs.pop_back();
@@ -58,36 +81,57 @@ void validateStructure(std::string &seq, std::string &structure) {
                 } else if ((seq[i] == 'U' && seq[j] == 'G') || (seq[i] == 'U' && seq[j] == 'A')) {
                 } else {
                     std::cout << "Incorrect input: " << seq[i] << " does not pair with " << seq[j] << std::endl;
-                    exit(0);
+                    return false;
                 }
             }
         }
     }
     if (!pairs.empty()) {
         std::cout << "Incorrect input: More left parentheses than right" << std::endl;
-        exit(0);
+        return false;
     }
+    return true;
+}
+
+// a local fold (max_span > 0) cannot keep a restricted pair that spans more than max_span
+bool validateSpan(const std::string &structure, cand_pos_t max_span) {
+    if (max_span <= 0) return true;
+    std::vector<int> pairs;
+    for (int j = 0; j < (int)structure.length(); ++j) {
+        if (structure[j] == '(') pairs.push_back(j);
+        if (structure[j] == ')') {
+            int i = pairs.back();
+            pairs.pop_back();
+            if (j - i > max_span) {
+                std::cout << "Incorrect input: the pair " << i + 1 << "." << j + 1 << " spans more than " << max_span << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
 // check if sequence is valid with regular expression
 // check length and if any characters other than GCAUT
-void validateSequence(std::string sequence) {
+bool validateSequence(std::string sequence) {
 
     if (sequence.length() == 0) {
         std::cout << "sequence is missing" << std::endl;
-        exit(EXIT_FAILURE);
+        return false;
     }
     // return false if any characters other than GCAUT -- future implement check based on type
     for (char c : sequence) {
         if (!(c == 'G' || c == 'C' || c == 'A' || c == 'U' || c == 'T' || c == 'N')) {
             std::cout << "Sequence contains character " << c << " that is not N,G,C,A,U, or T." << std::endl;
-            exit(EXIT_FAILURE);
+            return false;
         }
     }
+    return true;
 }
 
-std::string hfold(std::string seq, std::string res, double &energy, sparse_tree &tree, bool pk_free, bool pk_only, int dangles) {
-    W_final min_fold(seq, res, pk_free, pk_only, dangles);
+std::string hfold(std::shared_ptr<const cparty::SequenceContext> context, std::string res, double &energy, sparse_tree &tree, bool pk_free, bool pk_only, int threads,
+                  cand_pos_t max_span) {
+    W_final min_fold(context, res, pk_free, pk_only, threads, max_span);
     energy = min_fold.hfold(tree);
     std::string structure = min_fold.structure;
     return structure;
@@ -116,9 +160,9 @@ double evaluate_shared_fixed_energy_or_fallback(const std::string &seq,
     return fallback_energy;
 }
 
-std::string hfold_pf(std::string &seq, std::string &final_structure, double &energy, std::string &MEA_structure, pf_t &MEA, std::string &centroid_structure,pf_t &distance, pf_t &frequency, pf_t &diversity, sparse_tree &tree, bool pk_free,bool pk_only,bool fatgraph, int dangles, double min_en,
-                     int num_samples, bool PSplot) {
-    W_final_pf min_fold(seq, final_structure, pk_free,pk_only,fatgraph, dangles, min_en, num_samples, PSplot);
+std::string hfold_pf(std::shared_ptr<const cparty::SequenceContext> context, std::string &final_structure, double &energy, std::string &MEA_structure, pf_t &MEA, std::string &centroid_structure,pf_t &distance, pf_t &frequency, pf_t &diversity, sparse_tree &tree, bool pk_free,bool pk_only,bool fatgraph, double min_en,
+                     int num_samples, bool PSplot, int threads, uint64_t seed, cand_pos_t max_span) {
+    W_final_pf min_fold(context, final_structure, pk_free,pk_only,fatgraph, min_en, num_samples, PSplot, threads, seed, max_span);
     energy = min_fold.hfold_pf(tree);
     std::string structure = min_fold.structure;
     MEA = min_fold.hfold_MEA(tree);
@@ -136,67 +180,56 @@ void seqtoRNA(std::string &sequence) {
     }
 }
 
-int main(int argc, char *argv[]) {
-    args_info args_info;
-
-    // get options (call getopt command line parser)
-    if (cmdline_parser(argc, argv, &args_info) != 0) {
-        exit(1);
-    }
-
-    std::string seq;
-    if (args_info.inputs_num > 0) {
-        seq = args_info.inputs[0];
-    } else {
-        if (!args_info.input_file_given) std::getline(std::cin, seq);
-    }
-
-    std::string restricted;
-    args_info.input_structure_given ? restricted = input_struct : restricted = "";
-    std::string fileI;
-    args_info.input_file_given ? fileI = input_file : fileI = "";
-
-    std::string fileO;
-    args_info.output_file_given ? fileO = output_file : fileO = "";
-
-    int number_of_suboptimal_structure = args_info.subopt_given ? subopt : 1;
-
-    bool pk_free = args_info.pk_free_given;
-    bool pk_only = args_info.pk_only_given;
-    bool fatgraph = args_info.fatgraph_given;
-
-    int dangles = args_info.dangles_given ? dangle_model : 2;
-    const cparty::EnergyEvalOptions energy_options = to_energy_eval_options(pk_free, pk_only, dangles);
-
-    int num_samples = args_info.samples_given ? samples : 1000;
-
-    bool PSplot = !args_info.noPS_given;
-
-    if (fileI != "") {
+struct FoldOptions {
+    int number_of_suboptimal_structure;
+    bool pk_free;
+    bool pk_only;
+    bool fatgraph;
+    int dangles;
+    int num_samples;
+    int threads;
+    uint64_t seed;
+    cand_pos_t max_span; // 0 folds globally
+    cand_pos_t window_size; // > 0 scans windows of this size instead of folding
+    bool PSplot;
+    bool convert_to_RNA;
+    bool to_file;
+    bool input_structure_given;
+};
+
+// Writes the averaged pair probabilities of the sliding window scan of one sequence, one "i j p" line per pair.
+// The restricted structure, if any, is the only input structure; no hotspots are searched.
+int scan_record(const std::string &seq, std::string restricted, const FoldOptions &options, std::ostream &out) {
+    cand_pos_t n = seq.length();
+    if (restricted == "") restricted = std::string(n, '.');
+    // no loop factors are tabulated, as the tables would grow with the sequence
+    std::shared_ptr<const cparty::SequenceContext> context = std::make_shared<const cparty::SequenceContext>(seq, options.dangles, -1);
+    sparse_tree tree(restricted, n);
+    std::string no_structure;
+    W_final_pf scan(context, no_structure, options.pk_free, options.pk_only, false, guess_mfe(n), 0, false, 1, options.seed, options.max_span,
+                    options.window_size);
+    out << seq << std::endl;
+    scan.scan_windows(tree, 0.01, out);
+    return 0;
+}
 
-        if (exists(fileI)) {
-            get_input(fileI, seq, restricted);
-        }
-        if (seq == "") {
-            std::cout << "sequence is missing from file" << std::endl;
-        }
-    }
+// Folds one sequence and writes its result block; the energy parameters are loaded once by main for every record.
+// Returns the exit status a run on this sequence alone would end with.
+int fold_record(std::string seq, std::string restricted, const FoldOptions &options, std::ostream &out) {
     cand_pos_t n = seq.length();
     std::transform(seq.begin(), seq.end(), seq.begin(), ::toupper);
-    if (!args_info.noConv_given) seqtoRNA(seq);
-    validateSequence(seq);
+    if (options.convert_to_RNA) seqtoRNA(seq);
+    if (!validateSequence(seq)) return EXIT_FAILURE;
 
-    if (restricted != "") validateStructure(seq, restricted);
-    if (pk_free) if (restricted == "") restricted = std::string(n,'.');
+    // an invalid input structure has always ended the run with status 0
+    if (restricted != "" && !validateStructure(seq, restricted)) return 0;
+    if (restricted != "" && !validateSpan(restricted, options.max_span)) return 0;
+    if (options.pk_free) if (restricted == "") restricted = std::string(n,'.');
 
-    std::string file = args_info.paramFile_given ? parameter_file : "params/rna_DirksPierce09.par";
-    if (exists(file)) {
-        vrna_params_load(file.c_str(), VRNA_PARAMETER_FORMAT_DEFAULT);
-    } else if (seq.find('T') != std::string::npos) {
-        vrna_params_load_DNA_Mathews2004();
-    }
+    if (options.window_size > 0) return scan_record(seq, restricted, options, out);
 
-    cmdline_parser_free(&args_info);
+    const cparty::EnergyEvalOptions energy_options = to_energy_eval_options(options.pk_free, options.pk_only, options.dangles);
+    int number_of_suboptimal_structure = options.number_of_suboptimal_structure;
 
     std::vector<Hotspot> hotspot_list;
 
@@ -210,36 +243,47 @@ int main(int argc, char *argv[]) {
         hotspot_list.push_back(hotspot);
     }
     if ((number_of_suboptimal_structure - hotspot_list.size()) > 0) {
-        get_hotspots(seq, hotspot_list, number_of_suboptimal_structure, params);
+        get_hotspots(seq, hotspot_list, number_of_suboptimal_structure, params, options.max_span);
     }
     free(params);
     // Data structure for holding the output
     std::vector<Result> result_list;
     //  Iterate through all hotspots or the single given input structure
     cand_pos_t size = hotspot_list.size();
-    
-    pf_t energy,energy_pf,MEA,distance,frequency,diversity;
-    std::string MEA_structure,centroid_structure;
-    for (cand_pos_t i = 0; i < size; ++i) {
+
+    // The hotspots are folded independently: with several of them the -t workers take one hotspot each instead of sharing
+    // the wavefront of one fold. Results are kept by hotspot, so the output does not depend on the schedule. Fatgraphs are
+    // printed while folding and keep the serial order.
+    const bool per_hotspot = size > 1 && !options.fatgraph;
+    const int fold_threads = per_hotspot ? 1 : options.threads;
+    std::vector<std::unique_ptr<Result>> results(size);
+    // built once and shared by the folds of every hotspot
+    std::shared_ptr<const cparty::SequenceContext> context = std::make_shared<const cparty::SequenceContext>(seq, options.dangles, options.max_span);
+    cparty::parallel::parallel_for(size, per_hotspot ? options.threads : 1, [&](size_t i, int) {
+        pf_t energy,energy_pf,MEA,distance,frequency,diversity;
+        std::string MEA_structure,centroid_structure;
         std::string structure = hotspot_list[i].get_structure();
         sparse_tree tree(structure, n);
-        std::string final_structure = hfold(seq, structure, energy, tree, pk_free, pk_only, dangles);
+        std::string final_structure = hfold(context, structure, energy, tree, options.pk_free, options.pk_only, fold_threads, options.max_span);
         double reported_energy = energy;
-        if (args_info.input_structure_given) {
+        if (options.input_structure_given) {
             reported_energy = evaluate_shared_fixed_energy_or_fallback(seq, final_structure, energy_options, energy);
         }
-        std::string final_structure_pf = hfold_pf(seq, final_structure, energy_pf,MEA_structure,MEA,centroid_structure,distance,frequency, diversity, tree, pk_free,pk_only,fatgraph, dangles, energy, num_samples, PSplot);
+        // every fold used to overwrite Dot.ps, so only the plot of the last hotspot is drawn
+        const bool PSplot = options.PSplot && i + 1 == (size_t)size;
+        std::string final_structure_pf = hfold_pf(context, final_structure, energy_pf,MEA_structure,MEA,centroid_structure,distance,frequency, diversity, tree, options.pk_free,options.pk_only,options.fatgraph, energy, options.num_samples, PSplot, fold_threads, options.seed, options.max_span);
 
-        if (!args_info.input_structure_given && energy > 0.0) {
+        if (!options.input_structure_given && energy > 0.0) {
             energy = 0.0;
             energy_pf = 0.0;
             reported_energy = 0.0;
             final_structure = std::string(n, '.');
         }
 
-        Result result(seq, hotspot_list[i].get_structure(), hotspot_list[i].get_energy(), final_structure, reported_energy, final_structure_pf, energy_pf,MEA_structure,MEA,centroid_structure,distance,frequency,diversity);
-        result_list.push_back(result);
-    }
+        results[i].reset(new Result(seq, hotspot_list[i].get_structure(), hotspot_list[i].get_energy(), final_structure, reported_energy, final_structure_pf, energy_pf,MEA_structure,MEA,centroid_structure,distance,frequency,diversity));
+    });
+    for (const std::unique_ptr<Result> &result : results)
+        result_list.push_back(*result);
 
     Result::Result_comp result_comp;
     std::sort(result_list.begin(), result_list.end(), result_comp);
@@ -250,8 +294,7 @@ int main(int argc, char *argv[]) {
         number_of_output = std::min((int)result_list.size(), number_of_suboptimal_structure);
     }
     // output to file
-    if (fileO != "") {
-        std::ofstream out(fileO);
+    if (options.to_file) {
         out << seq << std::endl;
         for (cand_pos_t i = 0; i < number_of_output; i++) {
             if (i>0 && result_list[i].get_final_structure() == result_list[i - 1].get_final_structure()) continue;
@@ -271,31 +314,121 @@ int main(int argc, char *argv[]) {
         // kevin: june 22 2017
         // Mateo: Sept 13 2023
         // changed format for ouptut to stdout
-        std::cout << seq << std::endl;
+        out << seq << std::endl;
         if (result_list.size() == 1) {
-            std::cout << result_list[0].get_restricted() << std::endl;
-            std::cout << result_list[0].get_final_structure() << " (" << result_list[0].get_final_energy() << ")" << std::endl;
-            std::cout << result_list[0].get_final_structure_pf() << " (" << result_list[0].get_pf_energy() << ")" << std::endl;
-            std::cout << result_list[0].get_centroid_structure() << " (" << result_list[0].get_distance() << ")" << std::endl;
-            std::cout << result_list[0].get_MEA_structure() << " (" << result_list[0].get_MEA() << ")" << std::endl;
-            std::cout << "frequency of MFE structure in ensemble: " << result_list[0].get_frequency() << "; ensemble diversity " << result_list[0].get_diversity() << std::endl;
+            out << result_list[0].get_restricted() << std::endl;
+            out << result_list[0].get_final_structure() << " (" << result_list[0].get_final_energy() << ")" << std::endl;
+            out << result_list[0].get_final_structure_pf() << " (" << result_list[0].get_pf_energy() << ")" << std::endl;
+            out << result_list[0].get_centroid_structure() << " (" << result_list[0].get_distance() << ")" << std::endl;
+            out << result_list[0].get_MEA_structure() << " (" << result_list[0].get_MEA() << ")" << std::endl;
+            out << "frequency of MFE structure in ensemble: " << result_list[0].get_frequency() << "; ensemble diversity " << result_list[0].get_diversity() << std::endl;
         } else {
             for (cand_pos_t i = 0; i < number_of_output; i++) {
                 if (i>0 && result_list[i].get_final_structure() == result_list[i - 1].get_final_structure()) continue;
-                std::cout << "Restricted_" << i << ": " << result_list[i].get_restricted() << " (" << result_list[i].get_restricted_energy() << ")"
-                          << std::endl;
-                std::cout << "Result_" << i << ":     " << result_list[i].get_final_structure() << " (" << result_list[i].get_final_energy() << ")"
-                          << std::endl;
-                std::cout << "Result_" << i << ":     " << result_list[i].get_final_structure_pf() << " (" << result_list[i].get_pf_energy() << ")"
-                          << std::endl;
-                std::cout << "Result_" << i << ":     " << result_list[i].get_centroid_structure() << " (" << result_list[i].get_distance() << ")"
-                          << std::endl;
-                std::cout << "Result_" << i << ":     " << result_list[i].get_MEA_structure() << " (" << result_list[i].get_MEA() << ")"
-                          << std::endl;
-                std::cout << "frequency of MFE structure in ensemble: " << result_list[i].get_frequency() << "; ensemble diversity " << result_list[i].get_diversity() << std::endl;
+                out << "Restricted_" << i << ": " << result_list[i].get_restricted() << " (" << result_list[i].get_restricted_energy() << ")"
+                    << std::endl;
+                out << "Result_" << i << ":     " << result_list[i].get_final_structure() << " (" << result_list[i].get_final_energy() << ")"
+                    << std::endl;
+                out << "Result_" << i << ":     " << result_list[i].get_final_structure_pf() << " (" << result_list[i].get_pf_energy() << ")"
+                    << std::endl;
+                out << "Result_" << i << ":     " << result_list[i].get_centroid_structure() << " (" << result_list[i].get_distance() << ")"
+                    << std::endl;
+                out << "Result_" << i << ":     " << result_list[i].get_MEA_structure() << " (" << result_list[i].get_MEA() << ")"
+                    << std::endl;
+                out << "frequency of MFE structure in ensemble: " << result_list[i].get_frequency() << "; ensemble diversity " << result_list[i].get_diversity() << std::endl;
             }
         }
     }
-
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    args_info args_info;
+
+    // get options (call getopt command line parser)
+    if (cmdline_parser(argc, argv, &args_info) != 0) {
+        exit(1);
+    }
+
+    std::string seq;
+    if (args_info.inputs_num > 0) seq = args_info.inputs[0];
+
+    std::string restricted;
+    args_info.input_structure_given ? restricted = input_struct : restricted = "";
+    std::string fileI;
+    args_info.input_file_given ? fileI = input_file : fileI = "";
+
+    std::string fileO;
+    args_info.output_file_given ? fileO = output_file : fileO = "";
+
+    FoldOptions options;
+    options.number_of_suboptimal_structure = args_info.subopt_given ? subopt : 1;
+    options.pk_free = args_info.pk_free_given;
+    options.pk_only = args_info.pk_only_given;
+    options.fatgraph = args_info.fatgraph_given;
+    options.dangles = args_info.dangles_given ? dangle_model : 2;
+    options.num_samples = args_info.samples_given ? samples : 1000;
+    options.threads = args_info.threads_given ? num_threads : 1;
+    options.seed = args_info.seed_given ? sample_seed : 0;
+    options.max_span = args_info.maxBPspan_given ? max_span_arg : 0;
+    options.window_size = args_info.winsize_given ? window_size_arg : 0;
+    if (options.window_size > 0) {
+        // as in RNAplfold the span of a scan defaults to the window, and no pair is longer than the window holding it
+        const cand_pos_t longest = options.window_size - 1;
+        options.max_span = args_info.maxBPspan_given ? std::min<cand_pos_t>(max_span_arg, longest) : longest;
+    }
+    options.PSplot = !args_info.noPS_given;
+    options.convert_to_RNA = !args_info.noConv_given;
+    options.to_file = fileO != "";
+
+    // Without a sequence on the command line, the records are streamed from the input file or stdin
+    std::ifstream in_file;
+    std::istream *in = nullptr;
+    if (fileI != "") {
+        if (!exists(fileI)) {
+            std::cout << "Input file does not exist" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        in_file.open(fileI.c_str());
+        in = &in_file;
+    } else if (seq == "") {
+        in = &std::cin;
+    }
+
+    FastaRecord record;
+    if (in != nullptr && !read_fasta_record(*in, record)) {
+        std::cout << "sequence is missing from file" << std::endl;
+    }
+    if (in != nullptr) seq = record.sequence;
+
+    // the parameters are chosen by the first sequence and loaded once for the whole batch
+    std::string probe = seq;
+    std::transform(probe.begin(), probe.end(), probe.begin(), ::toupper);
+    if (options.convert_to_RNA) seqtoRNA(probe);
+    std::string file = args_info.paramFile_given ? parameter_file : "params/rna_DirksPierce09.par";
+    if (exists(file)) {
+        vrna_params_load(file.c_str(), VRNA_PARAMETER_FORMAT_DEFAULT);
+    } else if (probe.find('T') != std::string::npos) {
+        vrna_params_load_DNA_Mathews2004();
+    }
+
+    cmdline_parser_free(&args_info);
+    // read after the release, as the fold loop always has, so folded energies are reported unchanged
+    options.input_structure_given = args_info.input_structure_given;
+
+    std::ofstream out_file;
+    if (options.to_file) out_file.open(fileO);
+    std::ostream &out = options.to_file ? out_file : std::cout;
+
+    if (in == nullptr) return fold_record(seq, restricted, options, out);
+
+    // one result block per record, in input order; a record without its own constraint uses -r.
+    // A rejected record is reported and skipped so the rest of the batch is still folded.
+    int status = 0;
+    do {
+        if (record.name != "") out << record.name << std::endl;
+        if (fold_record(record.sequence, record.structure != "" ? record.structure : restricted, options, out) != 0) status = EXIT_FAILURE;
+    } while (read_fasta_record(*in, record));
+
+    return status;
+}
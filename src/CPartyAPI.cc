@@ -3,8 +3,10 @@
 #include "W_final.hh"
 #include "can_pair_policy.hh"
 #include "fixed_structure_energy_internal.hh"
+#include "parallel.hh"
 #include "part_func.hh"
 #include "sparse_tree.hh"
+#include "vienna_state.hh"
 
 #include <algorithm>
 #include <cctype>
@@ -12,6 +14,8 @@
 #include <filesystem>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -262,26 +266,28 @@ PkTopology classify_pk_topology(const std::string &db_full) {
     return PkTopology::kHType;
 }
 
-bool load_turner_params_once() {
-    static bool loaded = false;
-    static bool success = false;
-    if (loaded) return success;
-    loaded = true;
-
+std::string default_parameter_file() {
     std::filesystem::path param_path = std::filesystem::path(__FILE__).parent_path() / "../params/rna_Turner04.par";
     std::error_code ec;
     std::filesystem::path normalized = std::filesystem::weakly_canonical(param_path, ec);
-    const std::string param_str = (ec ? param_path.string() : normalized.string());
+    return ec ? param_path.string() : normalized.string();
+}
 
+// Makes the file ViennaRNA's global parameter set; the caller holds the ViennaRNA state mutex
+bool load_parameter_file(const std::string &param_str) {
     if (std::filesystem::exists(param_str)) {
-        success = (vrna_params_load(param_str.c_str(), VRNA_PARAMETER_FORMAT_DEFAULT) != 0);
+        const bool success = (vrna_params_load(param_str.c_str(), VRNA_PARAMETER_FORMAT_DEFAULT) != 0);
         if (!success) {
             std::cerr << "Error: failed to load energy parameters from " << param_str << std::endl;
         }
         return success;
     }
+    if (param_str != default_parameter_file()) {
+        std::cerr << "Error: energy parameter file " << param_str << " does not exist" << std::endl;
+        return false;
+    }
 
-    success = (vrna_params_load_RNA_Turner2004() != 0);
+    const bool success = (vrna_params_load_RNA_Turner2004() != 0);
     if (!success) {
         std::cerr << "Error: failed to load Turner 2004 parameters" << std::endl;
     }
@@ -290,8 +296,39 @@ bool load_turner_params_once() {
 
 } // namespace
 
-double get_cond_log_prob(const std::string &seq, const std::string &db_base) {
-    if (!load_turner_params_once()) {
+namespace cparty {
+
+Engine::Engine() : Engine(default_parameter_file()) {}
+
+Engine::Engine(const std::string &parameter_file) {
+    std::lock_guard<std::mutex> lock(vienna::state_mutex());
+    if (!load_parameter_file(parameter_file)) {
+        return;
+    }
+    params_ = scale_parameters();
+    exp_params_ = scale_pf_parameters();
+    // Folds that are not given an engine keep reading the default set from ViennaRNA
+    if (parameter_file != default_parameter_file()) {
+        load_parameter_file(default_parameter_file());
+    }
+}
+
+Engine::~Engine() {
+    free(params_);
+    free(exp_params_);
+}
+
+const Engine &Engine::shared() {
+    static const Engine engine;
+    return engine;
+}
+
+std::shared_ptr<const SequenceContext> Engine::sequence_context(const std::string &seq, int dangles) const {
+    return std::make_shared<const SequenceContext>(seq, dangles, params_, exp_params_);
+}
+
+double Engine::cond_log_prob(const std::string &seq, const std::string &db_base) const {
+    if (!ok()) {
         return std::numeric_limits<double>::quiet_NaN();
     }
 
@@ -314,47 +351,65 @@ double get_cond_log_prob(const std::string &seq, const std::string &db_base) {
     constexpr bool pk_only = false;
     constexpr bool fatgraph = false;
     constexpr int dangles = 2;
-    constexpr int num_samples = 1000;
+    constexpr int num_samples = 0;
     constexpr bool psplot = false;
 
-    W_final min_fold(sequence, structure, pk_free, pk_only, dangles);
-    double mfe_energy = min_fold.hfold(tree);
-    std::string mfe_structure = min_fold.structure;
-
-    W_final_pf partition(sequence, mfe_structure, pk_free, pk_only, fatgraph, dangles, mfe_energy, num_samples, psplot);
-    const double ensemble_energy = partition.hfold_pf(tree);
+    // Only the ensemble energy is needed, so no MFE fold picks the scale and none of the other outputs are computed
+    const std::shared_ptr<const SequenceContext> context = sequence_context(sequence, dangles);
+    W_final_pf partition(context, structure, pk_free, pk_only, fatgraph, guess_mfe(context->length()), num_samples, psplot);
+    const double ensemble_energy = partition.hfold_pf_energy(tree);
 
     return -ensemble_energy / kRT;
 }
 
-double get_structure_energy(const std::string &seq,
-                            const std::string &db_full,
-                            const cparty::EnergyEvalOptions &options) {
+double Engine::structure_energy(const std::string &seq, const std::string &db_full, const EnergyEvalOptions &options) const {
+    const std::vector<double> energies = structure_energies(seq, {db_full}, options, 1);
+    return energies.front();
+}
+
+std::vector<double> Engine::structure_energies(const std::string &seq,
+                                               const std::vector<std::string> &db_fulls,
+                                               const EnergyEvalOptions &options,
+                                               int threads) const {
+    std::vector<double> energies(db_fulls.size(), std::numeric_limits<double>::quiet_NaN());
+    if (db_fulls.empty() || !ok() || options.dangles < 0 || options.dangles > 2) {
+        return energies;
+    }
     const std::string normalized_seq = normalize_api_sequence(seq);
-    if (normalized_seq.empty()) {
-        return std::numeric_limits<double>::quiet_NaN();
+    if (normalized_seq.empty() || !std::all_of(normalized_seq.begin(), normalized_seq.end(), is_valid_api_symbol)) {
+        return energies;
     }
-    for (char c : normalized_seq) {
-        if (!is_valid_api_symbol(c)) {
-            return std::numeric_limits<double>::quiet_NaN();
+    const std::shared_ptr<const SequenceContext> context = sequence_context(normalized_seq, options.dangles);
+
+    parallel::parallel_for(db_fulls.size(), threads, [&](std::size_t k, int) {
+        const std::string &db_full = db_fulls[k];
+        if (!validate_api_structure(normalized_seq, db_full) || classify_pk_topology(db_full) == PkTopology::kUnsupported) {
+            return;
         }
-    }
-    if (!validate_api_structure(normalized_seq, db_full)) {
-        return std::numeric_limits<double>::quiet_NaN();
-    }
+        energies[k] = internal::score_fixed_structure_energy_kcal(context, db_full, options);
+    });
+    return energies;
+}
 
-    const PkTopology topology = classify_pk_topology(db_full);
-    if (topology == PkTopology::kUnsupported) {
-        return std::numeric_limits<double>::quiet_NaN();
-    }
+} // namespace cparty
 
-    cparty::EnergyEvalContext context;
-    if (!cparty::internal::build_energy_eval_context(normalized_seq, db_full, options, context)) {
-        return std::numeric_limits<double>::quiet_NaN();
-    }
-    return cparty::internal::score_fixed_structure_energy_kcal(context);
+double get_cond_log_prob(const std::string &seq, const std::string &db_base) {
+    return cparty::Engine::shared().cond_log_prob(seq, db_base);
+}
+
+double get_structure_energy(const std::string &seq,
+                            const std::string &db_full,
+                            const cparty::EnergyEvalOptions &options) {
+    return cparty::Engine::shared().structure_energy(seq, db_full, options);
 }
 
 double get_structure_energy(const std::string &seq, const std::string &db_full) {
     return get_structure_energy(seq, db_full, cparty::EnergyEvalOptions{});
 }
+
+std::vector<double> get_structure_energies(const std::string &seq,
+                                           const std::vector<std::string> &db_fulls,
+                                           const cparty::EnergyEvalOptions &options,
+                                           int threads) {
+    return cparty::Engine::shared().structure_energies(seq, db_fulls, options, threads);
+}
@@ -2,8 +2,48 @@
 #define CPARTY_API_HH
 
 #include "energy_eval_context.hh"
+#include "sequence_context.hh"
 
+#include <memory>
 #include <string>
+#include <vector>
+
+namespace cparty {
+
+// One energy parameter set and the calls below on it. The engine copies the parameters when it is built, and every
+// call works on sequence contexts and fold objects of its own, so any number of threads can use one engine, or
+// engines with different parameter sets, at the same time without locking. The free functions use Engine::shared().
+class Engine {
+  public:
+    // Turner 2004 from params/rna_Turner04.par, or ViennaRNA's built-in copy when the file is missing
+    Engine();
+    // a parameter file in ViennaRNA's format; ok() is false when it cannot be loaded
+    explicit Engine(const std::string &parameter_file);
+    ~Engine();
+
+    Engine(const Engine &) = delete;
+    Engine &operator=(const Engine &) = delete;
+
+    bool ok() const { return params_ != nullptr; }
+
+    double cond_log_prob(const std::string &seq, const std::string &db_base) const;
+    double structure_energy(const std::string &seq, const std::string &db_full, const EnergyEvalOptions &options = EnergyEvalOptions{}) const;
+    std::vector<double> structure_energies(const std::string &seq,
+                                           const std::vector<std::string> &db_fulls,
+                                           const EnergyEvalOptions &options,
+                                           int threads = 0) const;
+
+    // The default engine, built on first use
+    static const Engine &shared();
+
+  private:
+    vrna_param_t *params_ = nullptr;
+    vrna_exp_param_t *exp_params_ = nullptr;
+
+    std::shared_ptr<const SequenceContext> sequence_context(const std::string &seq, int dangles) const;
+};
+
+} // namespace cparty
 
 // Return the conditional log probability ln P(G' | G, S) based on CParty's
 // ensemble free energy for the structure G (db_base) on sequence S.
@@ -17,4 +57,11 @@ double get_structure_energy(const std::string &seq,
                             const std::string &db_full,
                             const cparty::EnergyEvalOptions &options);
 
+// get_structure_energy for many structures of one sequence: the sequence is checked and encoded once and the
+// structures are scored on `threads` workers (0 = all cores). Entry k is the energy of db_fulls[k], NaN when it fails.
+std::vector<double> get_structure_energies(const std::string &seq,
+                                           const std::vector<std::string> &db_fulls,
+                                           const cparty::EnergyEvalOptions &options,
+                                           int threads = 0);
+
 #endif
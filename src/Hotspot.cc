@@ -15,6 +15,7 @@ std::string Hotspot::get_structure() const { return this->structure; }
 void Hotspot::set_energy(double energy) { this->energy = energy; }
 
 void Hotspot::set_structure() {
+    structure = std::string(n + 1, '.');
     for (int i = 1; i <= n; ++i) {
         if (i >= left_outer_index && i <= left_inner_index) {
             structure[i] = '(';
@@ -30,10 +31,7 @@ void Hotspot::set_structure() {
 void Hotspot::set_structure(std::string structure) { this->structure = structure; }
 
 void Hotspot::set_default_structure() {
-    // memset(this->structure,'\0',this->length);
-    for (int i = 1; i <= this->n; i++) {
-        this->structure[i] = '.';
-    }
+    this->structure = std::string(this->n + 1, '.');
 }
 
 void Hotspot::move_left_outer_index() { this->left_outer_index -= 1; }
@@ -1,6 +1,9 @@
 #include "W_final.hh"
 #include "h_externs.hh"
 #include "h_struct.hh"
+#include "matrix_index.hh"
+#include "parallel.hh"
+#include "vienna_state.hh"
 
 #include <iostream>
 #include <math.h>
@@ -13,16 +16,22 @@
 // to create all the matrixes required for simfold
 // and then calls allocate_space in here to allocate
 // space for WMB and V_final
-W_final::W_final(std::string seq, std::string res, bool pk_free, bool pk_only, int dangle) : params_(scale_parameters()) {
-    seq_ = seq;
+W_final::W_final(std::string seq, std::string res, bool pk_free, bool pk_only, int dangle, int threads, cand_pos_t max_span)
+    : W_final(std::make_shared<const cparty::SequenceContext>(seq, dangle), res, pk_free, pk_only, threads, max_span) {}
+
+W_final::W_final(std::shared_ptr<const cparty::SequenceContext> context, std::string res, bool pk_free, bool pk_only, int threads,
+                 cand_pos_t max_span)
+    : params_(context->params()), context_(context) {
+    seq_ = context->sequence();
     this->res = res;
-    this->n = seq.length();
-    make_pair_matrix();
-    params_->model_details.dangles = dangle;
-    S_ = encode_sequence(seq.c_str(), 0);
-    S1_ = encode_sequence(seq.c_str(), 1);
+    this->n = seq_.length();
+    cparty::vienna::make_pair_matrix_once();
+    S_ = context->S();
+    S1_ = context->S1();
     this->pk_free = pk_free;
     this->pk_only = pk_only;
+    this->threads = cparty::parallel::resolve_thread_count(threads);
+    this->max_span = cparty::span_limit(n, max_span);
     W.resize(n + 1, 0);
     space_allocation();
 }
@@ -31,43 +40,78 @@ W_final::~W_final() {
     delete WMB;
     delete V;
     delete[] f;
-    free(params_);
-    free(S_);
-    free(S1_);
 }
 
 // Hosna June 20th, 2007
 // allocates space for WMB object and V_final
 void W_final::space_allocation() {
 
+    // the matrices of V and of the pseudoknots with their column copies, checked up front so a sequence too long for the
+    // machine is reported
+    std::vector<cand_idx_t> index;
+    cparty::require_memory(n, cparty::make_matrix_index(n, max_span, index), 15 * sizeof(energy_t) + sizeof(free_energy_node));
+
     // From simfold
     f = new minimum_fold[n + 1];
 
-    V = new s_energy_matrix(seq_, n, S_, S1_, params_);
+    V = new s_energy_matrix(seq_, n, S_, S1_, params_, context_->interior_loops(), max_span);
     structure = std::string(n + 1, '.');
 
     // Hosna: June 20th 2007
-    WMB = new pseudo_loop(seq_, res, V, S_, S1_, params_);
+    WMB = new pseudo_loop(seq_, res, V, S_, S1_, params_, context_->interior_loops(), max_span);
 }
 
-double W_final::hfold(sparse_tree &tree) {
+/**
+ * @brief Fills V, WM, WMv, WMp and the pseudoknotted matrices for the cell (i,j).
+ * Every value read here belongs to a shorter span or to the cell itself, so cells on one anti-diagonal are independent,
+ * apart from BE which the wavefront fill moves to the closing pair of the band.
+ */
+template <int Dangles> void W_final::fill_cell(cand_pos_t i, cand_pos_t j, sparse_tree &tree, bool wavefront) {
+    const bool evaluate = tree.weakly_closed(i, j);
+    const pair_type ptype_closing = pair[S_[i]][S_[j]];
+    const bool restricted = tree.tree[i].pair == -1 || tree.tree[j].pair == -1;
+    const bool paired = (tree.tree[i].pair == j && tree.tree[j].pair == i);
 
-    for (int i = n; i >= 1; --i) {
-        for (int j = i; j <= n; ++j) // for (i=0; i<=j; i++)
-        {
-            const bool evaluate = tree.weakly_closed(i, j);
-            const pair_type ptype_closing = pair[S_[i]][S_[j]];
-            const bool restricted = tree.tree[i].pair == -1 || tree.tree[j].pair == -1;
-            const bool paired = (tree.tree[i].pair == j && tree.tree[j].pair == i);
+    const bool pkonly = (!pk_only || paired);
 
-            const bool pkonly = (!pk_only || paired);
+    if (ptype_closing > 0 && evaluate && !restricted && pkonly) V->compute_energy_restricted<Dangles>(i, j, tree);
 
-            if (ptype_closing > 0 && evaluate && !restricted && pkonly) V->compute_energy_restricted(i, j, tree);
+    if (!pk_free) {
+        if (wavefront) {
+            WMB->compute_cell_energies(i, j, tree);
+            if (tree.tree[i].pair == j) WMB->compute_band_energies(i, tree);
+        } else {
+            WMB->compute_energies(i, j, tree);
+        }
+    }
 
-            if (!pk_free) WMB->compute_energies(i, j, tree);
+    V->compute_WMv_WMp<Dangles>(i, j, WMB->get_WMB(i, j), tree.tree);
+    V->compute_energy_WM_restricted<Dangles>(i, j, tree, WMB->WMB);
+}
+
+double W_final::hfold(sparse_tree &tree) {
+    cparty::require_pairs_within_span(tree.tree, n, max_span);
+
+    // the folds without dangles also take the dangle models other than 1 and 2 that the command line lets through
+    switch (params_->model_details.dangles) {
+    case 1:
+        return fold<1>(tree);
+    case 2:
+        return fold<2>(tree);
+    default:
+        return fold<0>(tree);
+    }
+}
 
-            V->compute_WMv_WMp(i, j, WMB->get_WMB(i, j), tree.tree);
-            V->compute_energy_WM_restricted(i, j, tree, WMB->WMB);
+template <int Dangles> double W_final::fold(sparse_tree &tree) {
+    if (threads > 1) {
+        cparty::parallel::for_each_antidiagonal(n, threads, [&](cand_pos_t i, cand_pos_t j) { fill_cell<Dangles>(i, j, tree, true); }, max_span);
+    } else {
+        for (int i = n; i >= 1; --i) {
+            for (int j = i; j <= std::min<cand_pos_t>(n, i + max_span); ++j) // for (i=0; i<=j; i++)
+            {
+                fill_cell<Dangles>(i, j, tree, false);
+            }
         }
     }
     for (cand_pos_t j = TURN + 1; j <= n; j++) {
@@ -76,11 +120,12 @@ double W_final::hfold(sparse_tree &tree) {
         energy_t m3 = INF;
         if (tree.tree[j].pair < 0) m1 = W[j - 1];
 
-        for (cand_pos_t k = 1; k <= j - TURN - 1; ++k) {
+        // no branch of the exterior loop spans more than max_span, or up to two further with the dangles of dangles=1
+        for (cand_pos_t k = std::max<cand_pos_t>(1, j - max_span - 2); k <= j - TURN - 1; ++k) {
             if (tree.weakly_closed(1, k - 1)) {
                 energy_t acc = (k > 1) ? W[k - 1] : 0;
                 m2 = std::min(m2, acc
-                                      + E_ext_Stem(V->get_energy(k, j), V->get_energy(k + 1, j), V->get_energy(k, j - 1), V->get_energy(k + 1, j - 1),
+                                      + E_ext_Stem<Dangles>(V->get_energy(k, j), V->get_energy(k + 1, j), V->get_energy(k, j - 1), V->get_energy(k + 1, j - 1),
                                                    S_, params_, k, j, n, tree.tree));
                 if (k == 1 || tree.weakly_closed(k, j)) m3 = std::min(m3, acc + WMB->get_WMB(k, j) + PS_penalty);
             }
@@ -102,7 +147,7 @@ double W_final::hfold(sparse_tree &tree) {
 
     while (cur_interval != NULL) {
         stack_interval = stack_interval->next;
-        backtrack_restricted(cur_interval, tree);
+        backtrack_restricted<Dangles>(cur_interval, tree);
         delete cur_interval; // this should make up for the new in the insert_node
         cur_interval = stack_interval;
     }
@@ -121,6 +166,7 @@ double W_final::hfold(sparse_tree &tree) {
  * @param vij1 The V(i,j-1) energy
  * @param vi1j1 The V(i+1,j-1) energy
  */
+template <int Dangles>
 energy_t W_final::E_ext_Stem(const energy_t &vij, const energy_t &vi1j, const energy_t &vij1, const energy_t &vi1j1, const short *S, paramT *params,
                              const cand_pos_t i, const cand_pos_t j, cand_pos_t n, std::vector<Node> &tree) {
 
@@ -131,7 +177,7 @@ energy_t W_final::E_ext_Stem(const energy_t &vij, const energy_t &vi1j, const en
         en = vij; // i j
 
         if (en != INF) {
-            if (params->model_details.dangles == 2) {
+            if constexpr (Dangles == 2) {
                 base_type si1 = i > 1 ? S[i - 1] : -1;
                 base_type sj1 = j < n ? S[j + 1] : -1;
                 en += vrna_E_ext_stem(tt, si1, sj1, params);
@@ -143,7 +189,7 @@ energy_t W_final::E_ext_Stem(const energy_t &vij, const energy_t &vi1j, const en
         }
     }
 
-    if (params->model_details.dangles == 1) {
+    if constexpr (Dangles == 1) {
         tt = pair[S[i + 1]][S[j]];
         if (((tree[i + 1].pair < -1 && tree[j].pair < -1) || (tree[i + 1].pair == j)) && tree[i].pair < 0) {
             en = (j - i - 1 > TURN) ? vi1j : INF; // i+1 j
@@ -184,7 +230,7 @@ energy_t W_final::E_ext_Stem(const energy_t &vij, const energy_t &vi1j, const en
     return e;
 }
 
-void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree) {
+template <int Dangles> void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree) {
     char type;
 
     switch (cur_interval->type) {
@@ -224,7 +270,7 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
 
                         if (tree.up[j - 1] >= (j - l - 1)) {
 
-                            energy_t tmp = V->compute_int(i, j, k, l, params_);
+                            energy_t tmp = V->compute_int(i, j, k, l);
                             if (tmp < min) {
                                 min = tmp;
                                 best_ip = k;
@@ -253,7 +299,7 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
 
                     // Mateo Fix Jul 2025 Dangle 2 was not implemented in traceback here.
                     tmp = V->get_energy_WM(i + 1, k - 1) + std::min(V->get_energy_WMv(k, j - 1), V->get_energy_WMp(k, j - 1)) + params_->MLclosing;
-                    if (params_->model_details.dangles == 2)
+                    if constexpr (Dangles == 2)
                         tmp += E_MLstem(pair[S_[j]][S_[i]], S_[j - 1], S_[i + 1], params_);
                     else
                         tmp += E_MLstem(pair[S_[j]][S_[i]], -1, -1, params_);
@@ -264,7 +310,7 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
                         best_row = 1;
                     }
 
-                    if (params_->model_details.dangles == 1) { // Mateo 2025 July -- Don't need to go through these unless in dangle 1
+                    if constexpr (Dangles == 1) { // Mateo 2025 July -- Don't need to go through these unless in dangle 1
                         if (tree.tree[i + 1].pair <= -1) {
                             tmp = V->get_energy_WM(i + 2, k - 1) + std::min(V->get_energy_WMv(k, j - 1), V->get_energy_WMp(k, j - 1))
                                   + E_MLstem(pair[S_[j]][S_[i]], -1, S_[i + 1], params_) + params_->MLclosing + params_->MLbase;
@@ -305,7 +351,7 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
                         best_row = 5;
                     }
 
-                    if (params_->model_details.dangles == 1) { // Mateo 2025 July -- Don't need to go through these unless in dangle 1
+                    if constexpr (Dangles == 1) { // Mateo 2025 July -- Don't need to go through these unless in dangle 1
                         if (tree.tree[i + 1].pair <= -1) {
                             if ((k - (i + 1) - 1) >= 0)
                                 tmp = static_cast<energy_t>((k - (i + 1) - 1) * params_->MLbase) + V->get_energy_WMp(k, j - 1)
@@ -389,7 +435,8 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
                 best_row = 0;
             }
         }
-        for (cand_pos_t i = 1; i <= j - 1; i++) // no TURN
+        // a stem ending at j starts at most max_span before it, or up to two further with the dangles of dangles=1
+        for (cand_pos_t i = std::max<cand_pos_t>(1, j - max_span - 2); i <= j - 1; i++) // no TURN
         {
 
             // Don't need to make sure i and j don't have to pair with something else
@@ -398,7 +445,7 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
             energy_ij = V->get_energy(i, j);
 
             if (energy_ij < INF) {
-                if (params_->model_details.dangles == 2) {
+                if constexpr (Dangles == 2) {
                     base_type si1 = i > 1 ? S_[i - 1] : -1;
                     base_type sj1 = j < n ? S_[j + 1] : -1;
                     tmp = energy_ij + E_ExtLoop(pair[S_[i]][S_[j]], si1, sj1, params_) + acc;
@@ -410,7 +457,7 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
                     best_row = 1;
                 }
             }
-            if (params_->model_details.dangles == 1) {
+            if constexpr (Dangles == 1) {
                 if (tree.tree[i].pair <= -1) {
                     energy_ij = V->get_energy(i + 1, j);
                     if (energy_ij < INF) {
@@ -450,7 +497,7 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
         // Hosna June 30, 2007
         // The following would not take care of when
         // we have some unpaired bases before the start of the WMB
-        for (cand_pos_t i = 1; i <= j - 1; i++) {
+        for (cand_pos_t i = std::max<cand_pos_t>(1, j - max_span); i <= j - 1; i++) {
             // Hosna: July 9, 2007
             // We only chop W to W + WMB when the bases before WMB are free
             if (i == 1 || (tree.weakly_closed(1, i - 1) && tree.weakly_closed(i, j))) {
@@ -632,9 +679,9 @@ void W_final::backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree
         cand_pos_t si1 = (i > 1) ? S_[i - 1] : -1;
         cand_pos_t sj1 = (j < n) ? S_[j + 1] : -1;
         pair_type tt = pair[S_[i]][S_[j]];
-        min = V->get_energy(i, j) + ((params_->model_details.dangles == 2) ? E_MLstem(tt, si1, sj1, params_) : E_MLstem(tt, -1, -1, params_));
+        min = V->get_energy(i, j) + ((Dangles == 2) ? E_MLstem(tt, si1, sj1, params_) : E_MLstem(tt, -1, -1, params_));
         best_row = 1;
-        if (params_->model_details.dangles == 1) {
+        if constexpr (Dangles == 1) {
             if (tree.tree[i].pair < 0) {
                 tt = pair[S_[i + 1]][S_[j]];
                 energy_t tmp = V->get_energy(i + 1, j) + E_MLstem(tt, si, -1, params_) + params_->MLbase;
@@ -747,85 +794,80 @@ int distance(int left, int right) { return (right - left - 1); }
 
 // Mateo 13 Sept 2023
 // given a initial hotspot which is a hairpin loop, keep trying to add a arc to form a larger stack
-void expand_hotspot(s_energy_matrix *V, Hotspot &hotspot, int n) {
-    // printf("\nexpanding hotspot: i: %d j: %d\n",hotspot->get_left_inner_index(),hotspot->get_right_inner_index());
-    // calculation for the hairpin that is already in there
-    V->compute_hotspot_energy(hotspot.get_left_outer_index(), hotspot.get_right_outer_index(), 0);
+// The stack energy is summed while the helix grows, so no energy matrix is needed
+void expand_hotspot(const short *S, const short *S1, vrna_param_s *params, Hotspot &hotspot, int n) {
+    // the hairpin that is already in there is not counted
+    energy_t energy = 0;
 
     // try to expand by adding a arc right beside the current out most arc
     while (hotspot.get_left_outer_index() - 1 >= 1 && hotspot.get_right_outer_index() + 1 <= n) {
-        base_type sim1 = V->S_[hotspot.get_left_outer_index() - 1];
-        base_type sjp1 = V->S_[hotspot.get_right_outer_index() + 1];
+        base_type sim1 = S[hotspot.get_left_outer_index() - 1];
+        base_type sjp1 = S[hotspot.get_right_outer_index() + 1];
         pair_type ptype_closing = pair[sim1][sjp1];
         if (ptype_closing > 0) {
+            cand_pos_t k = hotspot.get_left_outer_index();
+            cand_pos_t l = hotspot.get_right_outer_index();
             hotspot.move_left_outer_index();
             hotspot.move_right_outer_index();
             hotspot.increment_size();
-            V->compute_hotspot_energy(hotspot.get_left_outer_index(), hotspot.get_right_outer_index(), 1);
+            energy += E_IntLoop(0, 0, ptype_closing, rtype[pair[S[k]][S[l]]], S1[k], S1[l], S1[k - 1], S1[l + 1], params);
         } else {
             break;
         }
     }
-    base_type i = hotspot.get_left_outer_index();
-    base_type j = hotspot.get_right_outer_index();
-    pair_type tt = pair[V->S_[i]][V->S_[j]];
-    base_type si1 = i > 1 ? V->S_[i - 1] : -1;
-    base_type sj1 = j <= n ? V->S_[j + 1] : -1;
-    energy_t dangle_penalty = vrna_E_ext_stem(tt, si1, sj1, V->params_);
-
-    double energy = V->get_energy(hotspot.get_left_outer_index(), hotspot.get_right_outer_index());
-
-    // printf("here and %d\n",energy);
-    // printf("energy: %lf, AU_total: %d, dangle_top_total: %d, dangle_bot_total: %d\n",energy,non_gc_penalty,dangle_top_penalty,dangle_bot_penalty);
-
-    energy = (energy + dangle_penalty) / 100;
+    cand_pos_t i = hotspot.get_left_outer_index();
+    cand_pos_t j = hotspot.get_right_outer_index();
+    pair_type tt = pair[S[i]][S[j]];
+    base_type si1 = i > 1 ? S[i - 1] : -1;
+    base_type sj1 = j <= n ? S[j + 1] : -1;
+    energy_t dangle_penalty = vrna_E_ext_stem(tt, si1, sj1, params);
 
-    hotspot.set_energy(energy);
-    // printf("done: %d %d %d
-    // %d\n",hotspot->get_left_outer_index(),hotspot->get_left_inner_index(),hotspot->get_right_inner_index(),hotspot->get_right_outer_index());
+    hotspot.set_energy((double)(energy + dangle_penalty) / 100);
     return;
 }
 
 // Mateo 13 Sept 2023
 // look for every possible hairpin loop, and try to add a arc to form a larger stack with at least min_stack_size bases
-void get_hotspots(std::string seq, std::vector<Hotspot> &hotspot_list, int max_hotspot, vrna_param_s *params) {
+// Only the max_hotspot best stacks are kept, in a bounded heap, and only those get a structure string
+void get_hotspots(std::string seq, std::vector<Hotspot> &hotspot_list, int max_hotspot, vrna_param_s *params, int max_span) {
 
     int n = seq.length();
-    s_energy_matrix *V;
-    make_pair_matrix();
+    cparty::vienna::make_pair_matrix_once();
     short *S_ = encode_sequence(seq.c_str(), 0);
     short *S1_ = encode_sequence(seq.c_str(), 1);
-    V = new s_energy_matrix(seq, n, S_, S1_, params);
     int min_bp_distance = 3;
     int min_stack_size = 3; // the hotspot must be a stack of size >= 3
-    // Hotspot current_hotspot;
+    // the heap top is the worst hotspot kept so far
+    std::vector<Hotspot> heap;
     // start at min_stack_size-1 and go outward to try to add more arcs to form bigger stack because we cannot expand more than min_stack_size from
     // there anyway
     for (int i = min_stack_size; i <= n; i++) {
-        for (int j = i; j <= n; j++) {
-            int ptype_closing = pair[V->S_[i]][V->S_[j]];
+        for (int j = i; j <= (max_span > 0 ? std::min(n, i + max_span) : n); j++) {
+            int ptype_closing = pair[S_[i]][S_[j]];
             if (ptype_closing > 0 && distance(i, j) >= min_bp_distance) {
-                // current_hotspot = new Hotspot(i,j,nb_nucleotides);
-
                 Hotspot current_hotspot(i, j, n);
 
-                expand_hotspot(V, current_hotspot, n);
-
-                if (current_hotspot.get_size() < min_stack_size || current_hotspot.is_invalid_energy()) {
+                expand_hotspot(S_, S1_, params, current_hotspot, n);
 
-                } else {
-
-                    current_hotspot.set_structure();
-                    hotspot_list.push_back(current_hotspot);
+                if (current_hotspot.get_size() < min_stack_size || current_hotspot.is_invalid_energy()) continue;
+                // a local fold cannot keep a stack whose outer pair spans more than max_span
+                if (max_span > 0 && current_hotspot.get_right_outer_index() - current_hotspot.get_left_outer_index() > max_span) continue;
+                if ((int)heap.size() == max_hotspot) {
+                    if (!compare_hotspot_ptr(current_hotspot, heap.front())) continue;
+                    std::pop_heap(heap.begin(), heap.end(), compare_hotspot_ptr);
+                    heap.pop_back();
                 }
+                heap.push_back(current_hotspot);
+                std::push_heap(heap.begin(), heap.end(), compare_hotspot_ptr);
             }
         }
     }
 
     // make sure we only keep top 20 hotspot with lowest energy
-    std::sort(hotspot_list.begin(), hotspot_list.end(), compare_hotspot_ptr);
-    while ((int)hotspot_list.size() > max_hotspot) {
-        hotspot_list.pop_back();
+    std::sort_heap(heap.begin(), heap.end(), compare_hotspot_ptr);
+    for (Hotspot &hotspot : heap) {
+        hotspot.set_structure();
+        hotspot_list.push_back(hotspot);
     }
 
     // if no hotspot found, add all _ as restricted
@@ -834,11 +876,15 @@ void get_hotspots(std::string seq, std::vector<Hotspot> &hotspot_list, int max_h
         hotspot.set_default_structure();
         hotspot_list.push_back(hotspot);
     }
-    delete V;
     free(S_);
     free(S1_);
 
     return;
 }
 
-bool compare_hotspot_ptr(Hotspot &a, Hotspot &b) { return (a.get_energy() < b.get_energy()); }
\ No newline at end of file
+bool compare_hotspot_ptr(const Hotspot &a, const Hotspot &b) {
+    // ties go to the stack found first, so the kept hotspots do not depend on the heap order
+    if (a.get_energy() != b.get_energy()) return a.get_energy() < b.get_energy();
+    if (a.get_left_inner_index() != b.get_left_inner_index()) return a.get_left_inner_index() < b.get_left_inner_index();
+    return a.get_right_inner_index() < b.get_right_inner_index();
+}
\ No newline at end of file
@@ -6,8 +6,10 @@
 #include "hotspot.hh"
 #include "pseudo_loop.hh"
 #include "s_energy_matrix.hh"
+#include "sequence_context.hh"
 #include "sparse_tree.hh"
 #include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -17,17 +19,24 @@ extern "C" {
 #include "ViennaRNA/params/io.h"
 }
 
-void get_hotspots(std::string seq, std::vector<Hotspot> &hotspot_list, int max_hotspot, vrna_param_s *params);
+// max_span > 0 keeps only the stacks whose outer pair spans at most max_span
+void get_hotspots(std::string seq, std::vector<Hotspot> &hotspot_list, int max_hotspot, vrna_param_s *params, int max_span = 0);
 int distance(int left, int right);
-void expand_hotspot(s_energy_matrix *V, Hotspot &hotspot, int n);
+void expand_hotspot(const short *S, const short *S1, vrna_param_s *params, Hotspot &hotspot, int n);
 // Mateo 2024
 // comparison function for hotspot so we can use it when sorting
-bool compare_hotspot_ptr(Hotspot &a, Hotspot &b);
+bool compare_hotspot_ptr(const Hotspot &a, const Hotspot &b);
 
 class W_final {
   public:
-    W_final(std::string seq, std::string res, bool pk_free, bool pk_only, int dangle);
-    // constructor for the restricted mfe case
+    W_final(std::string seq, std::string res, bool pk_free, bool pk_only, int dangle, int threads = 1, cand_pos_t max_span = 0);
+    // constructor for the restricted mfe case; threads > 1 fills the matrices as a parallel wavefront (0 = all cores).
+    // max_span > 0 folds locally: only base pairs and pseudoknots with j-i <= max_span are formed, and the matrices hold
+    // n x (max_span+1) cells. Every pair of res must then span at most max_span.
+
+    W_final(std::shared_ptr<const cparty::SequenceContext> context, std::string res, bool pk_free, bool pk_only, int threads = 1,
+            cand_pos_t max_span = 0);
+    // the same, reusing the encoded sequence and parameters that context holds for all folds of its sequence
 
     ~W_final();
     // The destructor
@@ -58,10 +67,18 @@ class W_final {
     minimum_fold *f;              // the minimum folding, see structs.h
     std::string seq_;
     std::string res;
+    std::shared_ptr<const cparty::SequenceContext> context_;
     short *S_;
     short *S1_;
     bool pk_free = false;
     bool pk_only = false;
+    int threads = 1;
+    cand_pos_t max_span; // the longest base pair span considered, n for a global fold
+
+    // The fill and backtrack are specialized on the dangle model (0, 1 or 2), which hfold picks once per fold
+    template <int Dangles> double fold(sparse_tree &tree);
+
+    template <int Dangles> void fill_cell(cand_pos_t i, cand_pos_t j, sparse_tree &tree, bool wavefront);
 
     void insert_node(cand_pos_t i, cand_pos_t j, char type);
 
@@ -70,9 +87,10 @@ class W_final {
     // allocate the necessary memory
     double fold_sequence_restricted();
 
-    void backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree);
+    template <int Dangles> void backtrack_restricted(seq_interval *cur_interval, sparse_tree &tree);
     // backtrack, the restricted case
 
+    template <int Dangles>
     energy_t E_ext_Stem(const energy_t &vij, const energy_t &vi1j, const energy_t &vij1, const energy_t &vi1j1, const short *S, paramT *params,
                         const cand_pos_t i, const cand_pos_t j, cand_pos_t n, std::vector<Node> &tree);
 };
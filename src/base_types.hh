@@ -7,6 +7,8 @@ typedef int_least32_t energy_t;
 //! type of position
 typedef int_least32_t cand_pos_t;
 typedef uint_least32_t cand_pos_tu;
+//! type of a cell offset in a matrix, as the (n+1)(n+2)/2 cells of a long sequence outgrow 32 bits
+typedef int_least64_t cand_idx_t;
 
 typedef int_least16_t pair_type;
 typedef int_least16_t base_type;
@@ -1,6 +1,7 @@
 #include "base_types.hh"
 #include "part_func.hh"
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <vector>
@@ -19,9 +20,8 @@ std::string W_final_pf::compute_centroid(sparse_tree &tree, pf_t &dist, pf_t &di
     std::string centroid = std::string(n, '.');
 
     for (cand_pos_t i = 1; i <= n; i++){
-        for (cand_pos_t j = i + 1; j <= n; j++) {
-            std::pair<cand_pos_tu, cand_pos_tu> base_pair(i, j);
-            p = (pf_t)samples[base_pair] / num_samples;
+        for (cand_pos_t j = i + 1; j <= std::min(n, i + max_span); j++) {
+            p = get_probability(i, j);
             diversity += p*(1.0-p);
             if (p > 0.5) {
                 /* regular base pair */
@@ -57,7 +57,8 @@ std::string W_final_pf::compute_centroid_PK_only(sparse_tree &tree, pf_t &dist,
     std::string centroid = std::string(n, '.');
 
     // I have to recalculate sample frequencies using only structures that contain pseudoknots
-    std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> samples_PK;
+    // pair counts addressed like the energy matrices, index[i]+j-i
+    std::vector<cand_pos_t> samples_PK(index[n] + 1, 0);
     int num_samples_PK = 0;
     for(auto &it: structures){
         std::string structure = it.first;
@@ -80,14 +81,12 @@ std::string W_final_pf::compute_centroid_PK_only(sparse_tree &tree, pf_t &dist,
                 if (structure[j] == ')'){
                     int x = paren[paren.size()-1];
                     paren.pop_back();
-                    std::pair<cand_pos_tu, cand_pos_tu> base_pair(x+1,j+1);
-                    samples_PK[base_pair]+=frequency;
+                    samples_PK[index[x+1]+j-x]+=frequency;
                 }
                 if (structure[j] == ']'){
                     int x = sb[sb.size()-1];
                     sb.pop_back();
-                    std::pair<cand_pos_tu, cand_pos_tu> base_pair(x+1,j+1);
-                    samples_PK[base_pair]+=frequency;
+                    samples_PK[index[x+1]+j-x]+=frequency;
                 }
             }
         }
@@ -95,9 +94,8 @@ std::string W_final_pf::compute_centroid_PK_only(sparse_tree &tree, pf_t &dist,
 
     //Calculate centroid based on PK samples
     for (cand_pos_t i = 1; i <= n; i++){
-        for (cand_pos_t j = i + 1; j <= n; j++) {
-            std::pair<cand_pos_tu, cand_pos_tu> base_pair(i, j);
-            p = (pf_t)samples_PK[base_pair] / num_samples_PK;
+        for (cand_pos_t j = i + 1; j <= std::min(n, i + max_span); j++) {
+            p = num_samples_PK > 0 ? (pf_t)samples_PK[index[i]+j-i] / num_samples_PK : 0;
             diversity += p*(1.0-p);
             if (p > 0.5) {
                 /* regular base pair */
@@ -17,6 +17,10 @@ std::string shape_file;
 int dangle_model;
 int subopt;
 int samples;
+int num_threads;
+unsigned long long sample_seed;
+int max_span_arg;
+int window_size_arg;
 
 static char *package_name = 0;
 
@@ -43,6 +47,10 @@ const char *args_info_help[] = {
     "  -P, --paramFile        Read energy parameters from paramfile, instead of using the default parameter set.",
     "  -s, --samples          Give the number of samples foe the stochastic backtracking (default 1000)",
     "  -f, --fatgraph         Give the fatgraphs relating to the samples with the relating number of times it occured",
+    "  -t, --threads          Specify the number of threads used to fill the energy matrices and draw the samples (default 1, 0 uses all cores)",
+    "      --seed             Give the seed of the random streams used by the stochastic backtracking (default 0)",
+    "  -L, --maxBPspan        Fold locally: only consider base pairs and pseudoknots spanning at most this many nucleotides (j-i, default: no limit)",
+    "  -W, --winsize          Scan windows of this many nucleotides and print the pair probabilities averaged over the windows (i j p, p >= 0.01) instead of folding; -L defaults to the window size minus 1",
     // "  -S  --shape            Give a path to a shape file corresponding to the sequence given",
     "      --noConv           Do not convert DNA into RNA. This will use the Matthews 2004 parameters for DNA",
     "      --noPS             Don't create a Postscript drawing of the base pair probabilities",
@@ -73,9 +81,13 @@ static void init_args_info(struct args_info *args_info) {
     args_info->paramFile_help = args_info_help[9];
     args_info->samples_help = args_info_help[10];
     args_info->fatgraph_help = args_info_help[11];
+    args_info->threads_help = args_info_help[12];
+    args_info->seed_help = args_info_help[13];
+    args_info->maxBPspan_help = args_info_help[14];
+    args_info->winsize_help = args_info_help[15];
     // args_info->shape_help = args_info_help[10] ;
-    args_info->noConv_help = args_info_help[12];
-    args_info->noPS_help = args_info_help[13];
+    args_info->noConv_help = args_info_help[16];
+    args_info->noPS_help = args_info_help[17];
 }
 void cmdline_parser_print_version(void) {
 
@@ -125,6 +137,10 @@ static void clear_given(struct args_info *args_info) {
     args_info->paramFile_given = 0;
     args_info->samples_given = 0;
     args_info->fatgraph_given = 0;
+    args_info->threads_given = 0;
+    args_info->seed_given = 0;
+    args_info->maxBPspan_given = 0;
+    args_info->winsize_given = 0;
     // args_info->shape_given = 0 ;
     args_info->noConv_given = 0;
     args_info->noPS_given = 0;
@@ -282,12 +298,16 @@ int cmdline_parser_internal(int argc, char **argv, struct args_info *args_info,
                                                {"paramFile", required_argument, NULL, 'P'},
                                                {"samples", required_argument, NULL, 's'},
                                                {"fatgraph", 0, NULL, 'f'},
+                                               {"threads", required_argument, NULL, 't'},
+                                               {"maxBPspan", required_argument, NULL, 'L'},
+                                               {"winsize", required_argument, NULL, 'W'},
                                                // { "shape",	required_argument, NULL, 'S' },
                                                {"noConv", 0, NULL, 0},
                                                {"noPS", 0, NULL, 0},
+                                               {"seed", required_argument, NULL, 0},
                                                {0, 0, 0, 0}};
 
-        c = getopt_long(argc, argv, "hVr:i:o:n:pkd:P:s:f", long_options, &option_index);
+        c = getopt_long(argc, argv, "hVr:i:o:n:pkd:P:s:ft:L:W:", long_options, &option_index);
 
         if (c == -1) break; /* Exit from `while (1)' loop.  */
 
@@ -333,6 +353,36 @@ int cmdline_parser_internal(int argc, char **argv, struct args_info *args_info,
             samples = strtol(optarg, NULL, 10);
             break;
 
+        case 't': /* Specify the number of threads.  */
+
+            if (update_arg(0, 0, &(args_info->threads_given), &(local_args_info.threads_given), optarg, 0, 0, ARG_NO, 0, 0, "threads", 't',
+                           additional_error)) {
+                goto failure;
+            }
+
+            num_threads = strtol(optarg, NULL, 10);
+            break;
+
+        case 'L': /* Specify the maximum base pair span.  */
+
+            if (update_arg(0, 0, &(args_info->maxBPspan_given), &(local_args_info.maxBPspan_given), optarg, 0, 0, ARG_NO, 0, 0, "maxBPspan", 'L',
+                           additional_error)) {
+                goto failure;
+            }
+
+            max_span_arg = strtol(optarg, NULL, 10);
+            break;
+
+        case 'W': /* Specify the window size of the scan.  */
+
+            if (update_arg(0, 0, &(args_info->winsize_given), &(local_args_info.winsize_given), optarg, 0, 0, ARG_NO, 0, 0, "winsize", 'W',
+                           additional_error)) {
+                goto failure;
+            }
+
+            window_size_arg = strtol(optarg, NULL, 10);
+            break;
+
             // case 'S':	/* Take in a shape File.  */
 
             //   if (update_arg( 0 ,
@@ -430,6 +480,16 @@ int cmdline_parser_internal(int argc, char **argv, struct args_info *args_info,
                 }
             }
 
+            if (strcmp(long_options[option_index].name, "seed") == 0) {
+
+                if (update_arg(0, 0, &(args_info->seed_given), &(local_args_info.seed_given), optarg, 0, 0, ARG_NO, 0, 0, "seed", '-',
+                               additional_error)) {
+                    goto failure;
+                }
+
+                sample_seed = strtoull(optarg, NULL, 10);
+            }
+
             break;
         case '?': /* Invalid option.  */
             /* `getopt_long' already printed an error message.  */
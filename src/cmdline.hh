@@ -26,6 +26,18 @@ extern std::string parameter_file;
 
 // Number of Suboptimal structures to print
 extern int samples;
+
+// Number of worker threads for the dynamic programming fill
+extern int num_threads;
+
+// Seed of the random streams used by the stochastic backtracking
+extern unsigned long long sample_seed;
+
+// Longest base pair span of a local fold (0 folds globally)
+extern int max_span_arg;
+
+// Window size of the sliding window pair probability scan (0 folds the whole sequence)
+extern int window_size_arg;
 // The shape file
 // extern std::string shape_file;
 
@@ -43,6 +55,10 @@ struct args_info {
     const char *paramFile_help;       /**< @brief Use a separate parameter list */
     const char *samples_help;         /**< @brief Specify the number of samples for the stochastic backtracking (default 1000).  */
     const char *fatgraph_help;         /**< @brief Specify if the user wants the fatgraphs relating to the samples.  */
+    const char *threads_help;          /**< @brief Specify the number of threads used by the fill (default 1).  */
+    const char *seed_help;             /**< @brief Specify the seed of the stochastic backtracking (default 0).  */
+    const char *maxBPspan_help;        /**< @brief Specify the maximum base pair span of a local fold.  */
+    const char *winsize_help;          /**< @brief Specify the window size of the pair probability scan.  */
     // const char *shape_help; /**< @brief Give shape file as additional input help description.  */
     const char *noConv_help; /**< @brief Turn off automated conversion to RNA help description.  */
     const char *noPS_help;   /**< @brief Turn off automated Postscript file generation.  */
@@ -59,6 +75,10 @@ struct args_info {
     unsigned int paramFile_given;       /** <@brief whether a parameter file was given */
     unsigned int samples_given;         /**< @brief Whether samples was given.  */
     unsigned int fatgraph_given;         /**< @brief Whether fatgraph was given.  */
+    unsigned int threads_given;          /**< @brief Whether threads was given.  */
+    unsigned int seed_given;             /**< @brief Whether seed was given.  */
+    unsigned int maxBPspan_given;        /**< @brief Whether maxBPspan was given.  */
+    unsigned int winsize_given;          /**< @brief Whether winsize was given.  */
     // unsigned int shape_given ; /**< @brief Whether shape was given.  */
     unsigned int noConv_given; /**< @brief Whether noConv was given.  */
     unsigned int noPS_given;   /**< @brief Whether noPS was given.  */
@@ -0,0 +1,37 @@
+#ifndef COUNTER_RNG_HH_
+#define COUNTER_RNG_HH_
+
+#include <cstdint>
+
+namespace cparty {
+
+/**
+ * @brief Counter-based uniform generator: the n-th draw of a stream is a pure function of (seed, stream, n).
+ * Streams never share state, so parallel workers can draw from their own streams without locking and a run
+ * is reproduced exactly from the seed, whichever worker handles which stream.
+ */
+class CounterRng {
+  public:
+    CounterRng() : key_(mix(0)), counter_(0) {}
+    CounterRng(uint64_t seed, uint64_t stream) : key_(mix(seed) ^ mix(stream + 0x632BE59BD9B4E019ULL)), counter_(0) {}
+
+    // uniform double in [0,1), drop-in for vrna_urn()
+    double uniform() { return (next() >> 11) * 0x1.0p-53; }
+
+  private:
+    uint64_t key_;
+    uint64_t counter_;
+
+    uint64_t next() { return mix(key_ + 0x9E3779B97F4A7C15ULL * ++counter_); }
+
+    // SplitMix64 finalizer
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+} // namespace cparty
+
+#endif
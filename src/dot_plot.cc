@@ -1,4 +1,5 @@
 #include "dot_plot.hh"
+#include <algorithm>
 #include <iostream>
 #include <time.h>
 
@@ -49,14 +50,13 @@ void create_PS_footer(std::ofstream &out) {
     out << "%%%%EOF" << std::endl;
 }
 
-void create_PS_data(std::ofstream &out, std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples,
-                    std::vector<Node> tree, std::string MFE_structure, int num_samples, cand_pos_t n) {
-    int min_samples = .1 * num_samples;
+void create_PS_data(std::ofstream &out, const std::vector<pf_t> &probs, const std::vector<cand_idx_t> &index, std::vector<Node> tree,
+                    std::string MFE_structure, cand_pos_t n, cand_pos_t max_span) {
     for (cand_pos_t i = 1; i <= n; ++i) {
-        for (cand_pos_t j = i; j <= n; ++j) {
-            std::pair<cand_pos_tu, cand_pos_tu> base_pair(i, j);
-            if (samples[base_pair] > min_samples) {
-                pf_t prob = (pf_t)sqrt((pf_t)samples[base_pair] / num_samples);
+        for (cand_pos_t j = i + 1; j <= std::min(n, i + max_span); ++j) {
+            pf_t p = probs[index[i] + j - i];
+            if (p > .1) {
+                pf_t prob = (pf_t)sqrt(p);
                 if (tree[i].pair == j) {
                     out << ".7 1 0 hsb " << i << " " << j << " " << prob << " ubox" << std::endl;
                 } else {
@@ -111,8 +111,8 @@ void create_PS_data(std::ofstream &out, std::unordered_map<std::pair<cand_pos_t,
     }
 }
 
-void create_dot_plot(std::string &seq, std::vector<Node> tree, std::string &MFE_structure,
-                     std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, int num_samples) {
+void create_dot_plot(std::string &seq, std::vector<Node> tree, std::string &MFE_structure, const std::vector<pf_t> &probs,
+                     const std::vector<cand_idx_t> &index, cand_pos_t max_span) {
 
     std::ofstream out("Dot.ps");
     cand_pos_t n = seq.length();
@@ -136,7 +136,7 @@ void create_dot_plot(std::string &seq, std::vector<Node> tree, std::string &MFE_
     out << std::endl;
     out << "%%start of base pair probability data" << std::endl;
 
-    create_PS_data(out, samples, tree, MFE_structure, num_samples, n);
+    create_PS_data(out, probs, index, tree, MFE_structure, n, max_span);
     create_PS_footer(out);
     out.close();
 }
\ No newline at end of file
@@ -35,10 +35,11 @@ void create_PS_sequence(std::ofstream &out, std::string &seq);
 
 void create_PS_footer(std::ofstream &out);
 
-void create_PS_data(std::ofstream &out, std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples,
-                    std::vector<Node> tree, std::string MFE_structure, int num_samples, cand_pos_t n);
+void create_PS_data(std::ofstream &out, const std::vector<pf_t> &probs, const std::vector<cand_idx_t> &index, std::vector<Node> tree,
+                    std::string MFE_structure, cand_pos_t n, cand_pos_t max_span);
 
-void create_dot_plot(std::string &seq, std::vector<Node> tree, std::string &MFE_structure,
-                     std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, int num_samples);
+// probs holds the base pair probabilities in the layout of index, which covers the pairs spanning at most max_span
+void create_dot_plot(std::string &seq, std::vector<Node> tree, std::string &MFE_structure, const std::vector<pf_t> &probs,
+                     const std::vector<cand_idx_t> &index, cand_pos_t max_span);
 
 #endif
\ No newline at end of file
@@ -3,12 +3,15 @@
 #include "W_final.hh"
 #include "can_pair_policy.hh"
 #include "sparse_tree.hh"
+#include "vienna_state.hh"
 
 #include <algorithm>
 #include <cctype>
 #include <cmath>
 #include <filesystem>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -37,6 +40,12 @@ struct InternalEvalContext {
 
 double quiet_nan() { return std::numeric_limits<double>::quiet_NaN(); }
 
+EnergyBreakdown unavailable_breakdown() {
+    EnergyBreakdown breakdown;
+    breakdown.pk_free_core_kcal = breakdown.pk_penalties_kcal = breakdown.band_scaled_terms_kcal = breakdown.total_kcal = quiet_nan();
+    return breakdown;
+}
+
 std::string normalize_sequence(std::string seq) {
     std::transform(seq.begin(), seq.end(), seq.begin(), [](unsigned char c) {
         return static_cast<char>(std::toupper(c));
@@ -51,25 +60,27 @@ std::string normalize_sequence(std::string seq) {
 
 bool is_valid_seq_symbol(char c) { return c == 'A' || c == 'C' || c == 'G' || c == 'U'; }
 
-bool load_turner_params_once() {
-    static bool loaded = false;
-    static bool success = false;
-    if (loaded) {
-        return success;
-    }
-    loaded = true;
-
+bool load_turner_params() {
     std::filesystem::path param_path = std::filesystem::path(__FILE__).parent_path() / "../params/rna_Turner04.par";
     std::error_code ec;
     std::filesystem::path normalized = std::filesystem::weakly_canonical(param_path, ec);
     const std::string param_str = (ec ? param_path.string() : normalized.string());
 
     if (std::filesystem::exists(param_str)) {
-        success = (vrna_params_load(param_str.c_str(), VRNA_PARAMETER_FORMAT_DEFAULT) != 0);
-        return success;
+        return vrna_params_load(param_str.c_str(), VRNA_PARAMETER_FORMAT_DEFAULT) != 0;
     }
 
-    success = (vrna_params_load_RNA_Turner2004() != 0);
+    return vrna_params_load_RNA_Turner2004() != 0;
+}
+
+// Other threads may be building sequence contexts from ViennaRNA's global parameter set meanwhile
+bool load_turner_params_once() {
+    static std::once_flag loaded;
+    static bool success = false;
+    std::call_once(loaded, [] {
+        std::lock_guard<std::mutex> lock(cparty::vienna::state_mutex());
+        success = load_turner_params();
+    });
     return success;
 }
 
@@ -201,14 +212,31 @@ bool parse_context_for_scoring(const cparty::EnergyEvalContext &context, Interna
     return parse_structure(internal_context.api_context.normalized_seq, internal_context.api_context.db_full, internal_context.parsed);
 }
 
-double evaluate_from_parsed(const InternalEvalContext &context, const std::string &db_full, const ParsedStructure &parsed) {
-    const std::string &sequence = context.api_context.normalized_seq;
-    sparse_tree tree(parsed.tree_structure, static_cast<int>(sequence.size()));
-    const cparty::EnergyEvalOptions &options = context.api_context.options;
-    W_final fold(sequence, db_full, options.pk_free, options.pk_only, options.dangles);
+// The restricted fold, for the structures decompose_fixed_structure leaves to it
+double fold_from_parsed(const std::shared_ptr<const SequenceContext> &sequence_context,
+                        const cparty::EnergyEvalOptions &options,
+                        const std::string &db_full,
+                        const ParsedStructure &parsed) {
+    sparse_tree tree(parsed.tree_structure, sequence_context->length());
+    W_final fold(sequence_context, db_full, options.pk_free, options.pk_only);
     return fold.hfold(tree);
 }
 
+double evaluate_from_parsed(const std::shared_ptr<const SequenceContext> &sequence_context,
+                            const cparty::EnergyEvalOptions &options,
+                            const std::string &db_full,
+                            const ParsedStructure &parsed) {
+    LoopDecomposition loops;
+    if (decompose_fixed_structure(*sequence_context, db_full, options, loops)) {
+        return loops.total() / 100.0;
+    }
+    return fold_from_parsed(sequence_context, options, db_full, parsed);
+}
+
+std::shared_ptr<const SequenceContext> make_sequence_context(const InternalEvalContext &context) {
+    return std::make_shared<const SequenceContext>(context.api_context.normalized_seq, context.api_context.options.dangles);
+}
+
 } // namespace
 
 bool build_energy_eval_context(const std::string &seq,
@@ -234,7 +262,18 @@ double score_fixed_structure_energy_kcal(const cparty::EnergyEvalContext &contex
     if (!parse_context_for_scoring(context, internal_context)) {
         return quiet_nan();
     }
-    return evaluate_from_parsed(internal_context, internal_context.api_context.db_full, internal_context.parsed);
+    return evaluate_from_parsed(make_sequence_context(internal_context), internal_context.api_context.options,
+                                internal_context.api_context.db_full, internal_context.parsed);
+}
+
+double score_fixed_structure_energy_kcal(const std::shared_ptr<const SequenceContext> &sequence_context,
+                                         const std::string &db_full,
+                                         const cparty::EnergyEvalOptions &options) noexcept {
+    ParsedStructure parsed;
+    if (!parse_structure(sequence_context->sequence(), db_full, parsed)) {
+        return quiet_nan();
+    }
+    return evaluate_from_parsed(sequence_context, options, db_full, parsed);
 }
 
 double evaluate_fixed_structure_energy_kcal(const cparty::EnergyEvalContext &context) noexcept {
@@ -251,7 +290,7 @@ double evaluate_fixed_structure_energy_kcal(const std::string &seq, const std::s
 }
 
 EnergyBreakdown evaluate_fixed_structure_energy_breakdown_kcal(const std::string &seq, const std::string &db_full) noexcept {
-    EnergyBreakdown breakdown = {quiet_nan(), quiet_nan(), quiet_nan(), quiet_nan()};
+    EnergyBreakdown breakdown = unavailable_breakdown();
     cparty::EnergyEvalContext api_context;
     if (!build_energy_eval_context(seq, db_full, cparty::EnergyEvalOptions{}, api_context)) {
         return breakdown;
@@ -261,7 +300,20 @@ EnergyBreakdown evaluate_fixed_structure_energy_breakdown_kcal(const std::string
         return breakdown;
     }
 
-    const double total = evaluate_from_parsed(context, context.api_context.db_full, context.parsed);
+    const std::shared_ptr<const SequenceContext> sequence_context = make_sequence_context(context);
+    const cparty::EnergyEvalOptions &options = context.api_context.options;
+    LoopDecomposition loops;
+    if (decompose_fixed_structure(*sequence_context, context.api_context.db_full, options, loops)) {
+        breakdown.pk_free_core_kcal = loops.pk_free_core / 100.0;
+        breakdown.band_scaled_terms_kcal = loops.band_scaled_terms / 100.0;
+        breakdown.pk_penalties_kcal = loops.pk_penalties / 100.0;
+        breakdown.total_kcal = loops.total() / 100.0;
+        breakdown.loops = std::move(loops.loops);
+        return breakdown;
+    }
+
+    // Outside what the decomposition covers: the total and the core of the tree alone, each from the restricted fold
+    const double total = fold_from_parsed(sequence_context, options, context.api_context.db_full, context.parsed);
     if (!std::isfinite(total)) {
         return breakdown;
     }
@@ -275,9 +327,9 @@ EnergyBreakdown evaluate_fixed_structure_energy_breakdown_kcal(const std::string
     }
 
     const ParsedStructure pk_free_parsed = {context.parsed.tree_structure, false, context.parsed.pairs};
-    const double pk_free_core = evaluate_from_parsed(context, context.parsed.tree_structure, pk_free_parsed);
+    const double pk_free_core = fold_from_parsed(sequence_context, options, context.parsed.tree_structure, pk_free_parsed);
     if (!std::isfinite(pk_free_core)) {
-        return {quiet_nan(), quiet_nan(), quiet_nan(), quiet_nan()};
+        return unavailable_breakdown();
     }
 
     breakdown.pk_free_core_kcal = pk_free_core;
@@ -2,8 +2,12 @@
 #define FIXED_STRUCTURE_ENERGY_INTERNAL_HH
 
 #include "energy_eval_context.hh"
+#include "fixed_structure_loops.hh"
+#include "sequence_context.hh"
 
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace cparty {
 namespace internal {
@@ -13,6 +17,7 @@ struct EnergyBreakdown {
     double pk_penalties_kcal;
     double band_scaled_terms_kcal;
     double total_kcal;
+    std::vector<LoopEnergy> loops; // in dcal/mol; empty when the structure was scored by the restricted fold
 };
 
 bool build_energy_eval_context(const std::string &seq,
@@ -22,6 +27,11 @@ bool build_energy_eval_context(const std::string &seq,
 
 double score_fixed_structure_energy_kcal(const cparty::EnergyEvalContext &context) noexcept;
 double evaluate_fixed_structure_energy_kcal(const cparty::EnergyEvalContext &context) noexcept;
+
+// Scores db_full on a sequence context that many structures, possibly on several threads, share
+double score_fixed_structure_energy_kcal(const std::shared_ptr<const SequenceContext> &sequence_context,
+                                         const std::string &db_full,
+                                         const cparty::EnergyEvalOptions &options) noexcept;
 double evaluate_fixed_structure_energy_kcal(const std::string &seq, const std::string &db_full) noexcept;
 EnergyBreakdown evaluate_fixed_structure_energy_breakdown_kcal(const std::string &seq, const std::string &db_full) noexcept;
 
@@ -0,0 +1,562 @@
+#include "fixed_structure_loops.hh"
+
+#include "constants.hh"
+#include "h_externs.hh"
+#include "pseudo_loop_can_pair.hh"
+#include "sequence_context.hh"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "vienna_state.hh"
+
+extern "C" {
+#include "ViennaRNA/loops/all.h"
+}
+
+namespace cparty {
+namespace internal {
+namespace {
+
+// What lies between two consecutive pairs of a band: nothing, unpaired bases only, or closed branches
+enum class Region { empty, unpaired, branches };
+
+/**
+ * Walks the loops of one structure the way W_final::hfold derives it. The '(' pairs form the tree the fold is
+ * restricted to and the '[' pairs crossing them the bands it adds; the tree helpers below follow sparse_tree so that
+ * every guard of the recurrences can be checked on the single decomposition the structure admits.
+ */
+class LoopScorer {
+  public:
+    LoopScorer(const SequenceContext &context, const cparty::EnergyEvalOptions &options, LoopDecomposition &result)
+        : seq_(context.sequence()), n_(context.length()), S_(context.S()), S1_(context.S1()), params_(context.params()),
+          dangles_(options.dangles), pk_free_(options.pk_free), pk_only_(options.pk_only), result_(result) {}
+
+    bool parse(const std::string &db_full);
+    bool exterior();
+
+  private:
+    const std::string &seq_;
+    cand_pos_t n_;
+    const short *S_;
+    const short *S1_;
+    vrna_param_t *params_;
+    int dangles_;
+    bool pk_free_;
+    bool pk_only_;
+    LoopDecomposition &result_;
+
+    std::vector<cand_pos_t> pt_;     // partner of each base, 0 when unpaired
+    std::vector<char> pk_;           // base belongs to a '[' pair
+    std::vector<char> crossing_;     // base belongs to a pair crossing a pair of the other kind
+    std::vector<cand_pos_t> ppar_;   // innermost '[' pair around each base
+    std::vector<cand_pos_t> tp_;     // pair of each base in the tree of '(' pairs, -2 when unpaired there
+    std::vector<cand_pos_t> parent_; // innermost '(' pair around each base, 0 for the root
+    std::vector<cand_pos_t> depth_;
+    std::vector<int> up_;
+
+    cand_pos_t lca_u_ = -1, lca_v_ = -1, lca_ = 0;
+
+    pair_type ptype(cand_pos_t i, cand_pos_t j) const { return pair[S_[i]][S_[j]]; }
+    void add(cand_pos_t i, cand_pos_t j, char type, energy_t core, energy_t band, energy_t penalty);
+
+    cand_pos_t lca(cand_pos_t u, cand_pos_t v);
+    cand_pos_t child_towards(cand_pos_t lca, cand_pos_t l) const;
+    bool weakly_closed(cand_pos_t i, cand_pos_t j) const;
+    cand_pos_t bp(cand_pos_t i, cand_pos_t l) const;
+    cand_pos_t Bp(cand_pos_t l, cand_pos_t j) const;
+    cand_pos_t B(cand_pos_t l, cand_pos_t j);
+    cand_pos_t b(cand_pos_t i, cand_pos_t l);
+
+    energy_t compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l) const;
+    energy_t e_stP(cand_pos_t i, cand_pos_t j) const;
+    energy_t e_intP(cand_pos_t i, cand_pos_t k, cand_pos_t l, cand_pos_t j) const;
+
+    Region classify(cand_pos_t x, cand_pos_t y) const;
+    cand_pos_t block_end(cand_pos_t p, cand_pos_t y) const;
+    template <typename OnPair, typename OnBlock> bool for_each_branch(cand_pos_t x, cand_pos_t y, cand_pos_t &unpaired, OnPair on_pair, OnBlock on_block);
+
+    bool loop(cand_pos_t i, cand_pos_t j);
+    bool block(cand_pos_t a, cand_pos_t e, energy_t context_penalty);
+    bool band(cand_pos_t i, cand_pos_t ip);
+    bool pk_band(cand_pos_t i, cand_pos_t j);
+    bool wi(cand_pos_t x, cand_pos_t y);
+    bool wip(cand_pos_t x, cand_pos_t y);
+};
+
+bool LoopScorer::parse(const std::string &db_full) {
+    if (static_cast<cand_pos_t>(db_full.size()) != n_) return false;
+    pt_.assign(n_ + 1, 0);
+    pk_.assign(n_ + 1, 0);
+    crossing_.assign(n_ + 1, 0);
+    ppar_.assign(n_ + 1, 0);
+    tp_.assign(n_ + 1, -2);
+    parent_.assign(n_ + 1, 0);
+    depth_.assign(n_ + 1, 0);
+    up_.assign(n_ + 1, 0);
+
+    std::vector<cand_pos_t> round = {0}, square = {0};
+    int count = 0;
+    for (cand_pos_t x = 1; x <= n_; ++x) {
+        const char c = db_full[x - 1];
+        if (c == ')' || c == ']') {
+            std::vector<cand_pos_t> &open = c == ')' ? round : square;
+            if (open.size() < 2) return false;
+            const cand_pos_t k = open.back();
+            open.pop_back();
+            pt_[k] = x;
+            pt_[x] = k;
+            if (c == ')') {
+                tp_[k] = x;
+                tp_[x] = k;
+                count = 0;
+            } else {
+                pk_[k] = pk_[x] = 1;
+            }
+        } else if (c != '(' && c != '[' && c != '.') {
+            return false;
+        }
+        parent_[x] = round.back();
+        ppar_[x] = square.back();
+        depth_[x] = depth_[parent_[x]] + 1;
+        if (c == '(') {
+            round.push_back(x);
+            count = 0;
+        }
+        if (c == '[') square.push_back(x);
+        up_[x] = count;
+        ++count;
+    }
+    if (round.size() != 1 || square.size() != 1) return false;
+
+    // A '[' pair crosses a '(' pair exactly when its ends lie under different '(' pairs, and the other way round
+    bool pseudoknotted = false;
+    for (cand_pos_t i = 1; i <= n_; ++i) {
+        const cand_pos_t j = pt_[i];
+        if (j <= i) continue;
+        const bool crosses = pk_[i] ? parent_[i] != parent_[j] : ppar_[i] != ppar_[j];
+        crossing_[i] = crossing_[j] = crosses;
+        pseudoknotted |= crosses;
+    }
+    return !(pseudoknotted && pk_free_);
+}
+
+void LoopScorer::add(cand_pos_t i, cand_pos_t j, char type, energy_t core, energy_t band, energy_t penalty) {
+    result_.pk_free_core += core;
+    result_.band_scaled_terms += band;
+    result_.pk_penalties += penalty;
+    result_.loops.push_back({i, j, type, core + band + penalty});
+}
+
+// Lowest common ancestor in the tree of sparse_tree; a base that opens no pair has no descendants, so it is replaced by
+// its parent, which lets the bases of a band share one cached answer
+cand_pos_t LoopScorer::lca(cand_pos_t u, cand_pos_t v) {
+    if (u == v) return u;
+    if (tp_[u] <= u) u = parent_[u];
+    if (tp_[v] <= v) v = parent_[v];
+    if (u == lca_u_ && v == lca_v_) return lca_;
+    lca_u_ = u;
+    lca_v_ = v;
+    while (depth_[u] > depth_[v])
+        u = parent_[u];
+    while (depth_[v] > depth_[u])
+        v = parent_[v];
+    while (u != v) {
+        u = parent_[u];
+        v = parent_[v];
+    }
+    lca_ = u;
+    return lca_;
+}
+
+// The child of lca whose pair encloses l, or -1 when l sits directly under lca
+cand_pos_t LoopScorer::child_towards(cand_pos_t lca, cand_pos_t l) const {
+    cand_pos_t x = parent_[l];
+    if (x == lca) return -1;
+    while (parent_[x] != lca)
+        x = parent_[x];
+    return x;
+}
+
+bool LoopScorer::weakly_closed(cand_pos_t i, cand_pos_t j) const {
+    if (i == 1 && j == 0) return true;
+    if ((i > tp_[i] && tp_[i] > 0) || tp_[j] > j) return false;
+    return parent_[i] == parent_[j];
+}
+
+cand_pos_t LoopScorer::bp(cand_pos_t i, cand_pos_t l) const {
+    if (parent_[l] == 0 || tp_[l] > -1) return -2;
+    if (parent_[l] < i) return -1;
+    return parent_[l];
+}
+
+cand_pos_t LoopScorer::Bp(cand_pos_t l, cand_pos_t j) const {
+    if (parent_[l] == 0 || tp_[l] > -1) return -2;
+    if (tp_[parent_[l]] > j) return -1;
+    return tp_[parent_[l]];
+}
+
+cand_pos_t LoopScorer::B(cand_pos_t l, cand_pos_t j) {
+    if (parent_[l] == 0 || tp_[l] > -1) return -2;
+    if (tp_[parent_[l]] > j) return -1;
+    const cand_pos_t common = lca(l, j);
+    if (j == common) return j;
+    const cand_pos_t child = child_towards(common, l);
+    if (child > 0) return tp_[child];
+    // l sits directly under the common ancestor: the first child of it between l and j
+    for (cand_pos_t x = l + 1; x < j; ++x) {
+        if (tp_[x] > x) return tp_[x];
+    }
+    return -100;
+}
+
+cand_pos_t LoopScorer::b(cand_pos_t i, cand_pos_t l) {
+    if (parent_[l] == 0 || tp_[l] > -1) return -2;
+    if (parent_[l] < i) return -1;
+    const cand_pos_t common = lca(i, l);
+    if (i == common) return i;
+    const cand_pos_t child = child_towards(common, l);
+    return child > 0 ? child : -100;
+}
+
+energy_t LoopScorer::compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l) const {
+    if (!cparty::pseudo_loop_can_pair::can_form_allowed_pair(seq_, i, j) || !cparty::pseudo_loop_can_pair::can_form_allowed_pair(seq_, k, l))
+        return INF;
+    return E_IntLoop(k - i - 1, j - l - 1, ptype(i, j), rtype[ptype(k, l)], S1_[i + 1], S1_[j - 1], S1_[k - 1], S1_[l + 1], params_);
+}
+
+energy_t LoopScorer::e_stP(cand_pos_t i, cand_pos_t j) const {
+    if (i + 1 == j - 1) return INF;
+    const energy_t ss = compute_int(i, j, i + 1, j - 1);
+    return ss >= INF ? INF : lrint(e_stP_penalty * ss);
+}
+
+energy_t LoopScorer::e_intP(cand_pos_t i, cand_pos_t k, cand_pos_t l, cand_pos_t j) const {
+    const energy_t e_int = compute_int(i, j, k, l);
+    return e_int >= INF ? INF : lrint(e_intP_penalty * e_int);
+}
+
+Region LoopScorer::classify(cand_pos_t x, cand_pos_t y) const {
+    if (x > y) return Region::empty;
+    for (cand_pos_t p = x; p <= y; ++p) {
+        if (pt_[p] != 0) return Region::branches;
+    }
+    return Region::unpaired;
+}
+
+// Last base of the pseudoknot starting at p, or -1 when one of its pairs leaves [p,y]
+cand_pos_t LoopScorer::block_end(cand_pos_t p, cand_pos_t y) const {
+    cand_pos_t e = pt_[p];
+    for (cand_pos_t q = p + 1; q < e; ++q) {
+        if (pt_[q] == 0) continue;
+        if (pt_[q] < p || pt_[q] > y) return -1;
+        e = std::max(e, pt_[q]);
+    }
+    return e;
+}
+
+// Visits the branches of [x,y] in order: nested pairs and whole pseudoknots. Fails when a pair leaves the region.
+template <typename OnPair, typename OnBlock>
+bool LoopScorer::for_each_branch(cand_pos_t x, cand_pos_t y, cand_pos_t &unpaired, OnPair on_pair, OnBlock on_block) {
+    unpaired = 0;
+    for (cand_pos_t p = x; p <= y;) {
+        if (pt_[p] == 0) {
+            ++unpaired;
+            ++p;
+            continue;
+        }
+        if (pt_[p] < p || pt_[p] > y) return false;
+        if (crossing_[p]) {
+            const cand_pos_t e = block_end(p, y);
+            if (e < 0 || !on_block(p, e)) return false;
+            p = e + 1;
+        } else {
+            if (!on_pair(p, pt_[p])) return false;
+            p = pt_[p] + 1;
+        }
+    }
+    return true;
+}
+
+bool LoopScorer::exterior() {
+    energy_t energy = 0;
+    cand_pos_t unpaired = 0;
+    const bool ok = for_each_branch(
+        1, n_, unpaired,
+        [&](cand_pos_t i, cand_pos_t j) {
+            if (!loop(i, j)) return false;
+            const base_type si1 = (dangles_ == 2 && i > 1) ? S_[i - 1] : -1;
+            const base_type sj1 = (dangles_ == 2 && j < n_) ? S_[j + 1] : -1;
+            energy += vrna_E_ext_stem(ptype(i, j), si1, sj1, params_);
+            return true;
+        },
+        [&](cand_pos_t a, cand_pos_t e) { return (a == 1 || weakly_closed(a, e)) && block(a, e, PS_penalty); });
+    if (!ok) return false;
+    add(0, 0, FREE, energy, 0, 0);
+    return true;
+}
+
+// V(i,j) of a pair no pair of the other kind crosses
+bool LoopScorer::loop(cand_pos_t i, cand_pos_t j) {
+    const pair_type ptype_closing = ptype(i, j);
+    if (ptype_closing <= 0 || (pk_only_ && tp_[i] != j)) return false;
+
+    cand_pos_t branches = 0, pseudoknots = 0, k = 0, l = 0, unpaired = 0;
+    for (cand_pos_t p = i + 1; p < j; ++p) {
+        if (pt_[p] == 0) continue;
+        if (pt_[p] < p || pt_[p] >= j) return false;
+        if (crossing_[p]) {
+            const cand_pos_t e = block_end(p, j - 1);
+            if (e < 0) return false;
+            ++pseudoknots;
+            p = e;
+        } else {
+            if (branches++ == 0) {
+                k = p;
+                l = pt_[p];
+            }
+            p = pt_[p];
+        }
+    }
+
+    if (branches + pseudoknots == 0) {
+        if (up_[j - 1] < j - i - 1) return false;
+        const energy_t energy = E_Hairpin(j - i - 1, ptype_closing, S1_[i + 1], S1_[j - 1], &seq_.c_str()[i - 1], params_);
+        if (energy >= INF) return false;
+        add(i, j, HAIRP, energy, 0, 0);
+        return true;
+    }
+
+    if (branches == 1 && pseudoknots == 0) {
+        // the bounds of s_energy_matrix::compute_internal_restricted
+        if (k > std::min(j - TURN - 2, i + MAXLOOP + 1) || l < std::max(k + TURN + 1, k + j - i - MAXLOOP - 2)) return false;
+        if (up_[k - 1] < k - i - 1 || up_[j - 1] < j - l - 1) return false;
+        const energy_t energy = E_IntLoop(k - i - 1, j - l - 1, ptype_closing, rtype[ptype(k, l)], S1_[i + 1], S1_[j - 1], S1_[k - 1], S1_[l + 1], params_);
+        if (energy >= INF || !loop(k, l)) return false;
+        add(i, j, INTER, energy, 0, 0);
+        return true;
+    }
+
+    const pair_type tt = ptype(j, i);
+    energy_t energy = params_->MLclosing + (dangles_ == 2 ? E_MLstem(tt, S_[j - 1], S_[i + 1], params_) : E_MLstem(tt, -1, -1, params_));
+    const bool ok = for_each_branch(
+        i + 1, j - 1, unpaired,
+        [&](cand_pos_t p, cand_pos_t q) {
+            if (!loop(p, q)) return false;
+            energy += dangles_ == 2 ? E_MLstem(ptype(p, q), S_[p - 1], S_[q + 1], params_) : E_MLstem(ptype(p, q), -1, -1, params_);
+            return true;
+        },
+        [&](cand_pos_t a, cand_pos_t e) { return block(a, e, PSM_penalty + b_penalty); });
+    if (!ok) return false;
+    add(i, j, MULTI, energy + unpaired * params_->MLbase, 0, 0);
+    return true;
+}
+
+/**
+ * WMB(a,e) of a pseudoknot whose '[' pairs form one band crossing the band of one '(' pair (H-type, either order) or
+ * the bands of two consecutive '(' pairs (K-type). Anything denser needs the WMBP splits and is left to the fold.
+ */
+bool LoopScorer::block(cand_pos_t a, cand_pos_t e, energy_t context_penalty) {
+    cand_pos_t arcs[2] = {0, 0}, p1 = 0;
+    int num_arcs = 0, num_pk = 0;
+    for (cand_pos_t q = a; q <= e; ++q) {
+        if (pt_[q] <= q || !crossing_[q]) continue;
+        if (pk_[q] && ppar_[q] < a) {
+            if (num_pk++ == 1) return false;
+            p1 = q;
+        } else if (!pk_[q] && parent_[q] < a) {
+            if (num_arcs == 2) return false;
+            arcs[num_arcs++] = q;
+        }
+    }
+    if (num_pk != 1) return false;
+    const cand_pos_t p2 = pt_[p1];
+    const cand_pos_t a1 = arcs[0], a2 = pt_[a1];
+
+    int bands = 0;
+    if (num_arcs == 1 && a1 == a && p2 == e && a1 < p1 && p1 < a2 && a2 < p2) {
+        // WMBP(a,e): 2*PB + BE(a1,a2,bp(a1,p1),.) + WI(bp(a1,p1)+1,p1-1) + VP(p1,p2)
+        const cand_pos_t bp_il = bp(a1, p1);
+        if (!(bp_il >= 0 && bp_il < n_ && p1 + TURN <= p2)) return false;
+        if (!band(a1, bp_il) || !wi(bp_il + 1, p1 - 1) || !pk_band(p1, p2)) return false;
+        bands = 2;
+    } else if (num_arcs == 1 && p1 == a && a2 == e && p1 < a1 && a1 < p2 && p2 < a2) {
+        // WMB(a,e): PB + BE(a1,a2,.,Bp(p2,a2)) + WMBP(p1,p2) + WI(p2+1,Bp(p2,a2)-1), where WMBP(p1,p2) = VP(p1,p2) + PB
+        const cand_pos_t Bp_lj = Bp(p2, a2);
+        if (!(Bp_lj >= 0 && Bp_lj < n_)) return false;
+        if (!band(a1, tp_[Bp_lj]) || !pk_band(p1, p2) || !wi(p2 + 1, Bp_lj - 1)) return false;
+        bands = 2;
+    } else if (num_arcs == 2 && a1 == a && pt_[arcs[1]] == e && a1 < p1 && p1 < a2 && a2 < arcs[1] && arcs[1] < p2 && p2 < e) {
+        // WMB(a,e): PB + BE of the right band + WMBP(a1,p2) as in the first case + WI(p2+1,Bp(p2,e)-1)
+        const cand_pos_t Bp_lj = Bp(p2, e);
+        const cand_pos_t bp_il = bp(a1, p1);
+        if (!(Bp_lj >= 0 && Bp_lj < n_ && bp_il >= 0 && bp_il < n_ && p1 + TURN <= p2)) return false;
+        if (!band(arcs[1], tp_[Bp_lj]) || !band(a1, bp_il) || !wi(bp_il + 1, p1 - 1) || !pk_band(p1, p2) || !wi(p2 + 1, Bp_lj - 1))
+            return false;
+        bands = 3;
+    } else {
+        return false;
+    }
+    add(a, e, P_WMB, 0, 0, context_penalty + bands * PB_penalty);
+    return true;
+}
+
+// BE from the outer pair (i,bp(i)) of a band down to its inner pair (ip,bp(ip))
+bool LoopScorer::band(cand_pos_t i, cand_pos_t ip) {
+    // the pairs of the band from the inner one outwards; the regions between them may hold bands of their own
+    std::vector<cand_pos_t> chain;
+    for (cand_pos_t x = ip; x != i; x = parent_[x]) {
+        if (x < i) return false;
+        chain.push_back(x);
+    }
+    for (cand_pos_t j = tp_[i]; !chain.empty(); i = chain.back(), j = tp_[i], chain.pop_back()) {
+        if (j - i < TURN) return false;
+        const cand_pos_t l = chain.back(), lp = tp_[l];
+        const Region left = classify(i + 1, l - 1), right = classify(lp + 1, j - 1);
+        const bool left_open = left != Region::branches, right_open = right != Region::branches;
+        const energy_t ap_bp = ap_penalty + 2 * bp_penalty;
+        if (left_open && right_open) {
+            energy_t energy = e_intP(i, l, lp, j);
+            if (l == i + 1 && lp == j - 1) energy = std::min(energy, e_stP(i, j));
+            if (energy >= INF) return false;
+            add(i, j, P_BE, 0, energy, 0);
+        } else if (!left_open && !right_open) {
+            if (!weakly_closed(i + 1, l - 1) || !weakly_closed(lp + 1, j - 1) || !wip(i + 1, l - 1) || !wip(lp + 1, j - 1)) return false;
+            add(i, j, P_BE, 0, 0, ap_bp);
+        } else if (!left_open) {
+            if (!weakly_closed(i + 1, l - 1) || !wip(i + 1, l - 1)) return false;
+            add(i, j, P_BE, 0, 0, ap_bp + cp_penalty * (j - lp - 1));
+        } else {
+            if (!weakly_closed(lp + 1, j - 1) || !wip(lp + 1, j - 1)) return false;
+            add(i, j, P_BE, 0, 0, ap_bp + cp_penalty * (l - i - 1));
+        }
+    }
+    return true;
+}
+
+// VP(i,j) of the outer '[' pair of a band, down to the innermost pair that closes the band with WI regions
+bool LoopScorer::pk_band(cand_pos_t i, cand_pos_t j) {
+    while (true) {
+        if (j - i < 4 || weakly_closed(i, j) || ptype(i, j) <= 0 || !cparty::pseudo_loop_can_pair::can_form_allowed_pair(seq_, i, j))
+            return false;
+        const cand_pos_t Bp_ij = Bp(i, j), B_ij = B(i, j), b_ij = b(i, j), bp_ij = bp(i, j);
+
+        // the next pair of the band is the first crossing pair to the right of i
+        cand_pos_t k = i + 1;
+        while (k < j && (pt_[k] == 0 || (!crossing_[k] && pt_[k] > k && pt_[k] < j)))
+            k = pt_[k] == 0 ? k + 1 : pt_[k] + 1;
+        const bool inner = k < j && pk_[k] && crossing_[k] && pt_[k] > k && pt_[k] < j;
+
+        if (!inner) {
+            const cand_pos_t pi = parent_[i], pj = parent_[j];
+            if (pi > 0 && pj < pi && Bp_ij >= 0 && B_ij >= 0 && bp_ij < 0) return wi(i + 1, Bp_ij - 1) && wi(B_ij + 1, j - 1);
+            if (pi < pj && pj > 0 && b_ij >= 0 && bp_ij >= 0 && Bp_ij < 0) return wi(i + 1, b_ij - 1) && wi(bp_ij + 1, j - 1);
+            if (pi > 0 && pj > 0 && Bp_ij >= 0 && B_ij >= 0 && b_ij >= 0 && bp_ij >= 0)
+                return wi(i + 1, Bp_ij - 1) && wi(B_ij + 1, b_ij - 1) && wi(bp_ij + 1, j - 1);
+            return false;
+        }
+
+        const cand_pos_t l = pt_[k];
+        const Region left = classify(i + 1, k - 1), right = classify(l + 1, j - 1);
+        const cand_pos_t min_Bp_j = std::min((cand_pos_tu)b_ij, (cand_pos_tu)Bp_ij);
+        const cand_pos_t max_i_bp = std::max(B_ij, bp_ij);
+        const energy_t ap_bp = ap_penalty + 2 * bp_penalty;
+
+        if (left != Region::branches && right != Region::branches) {
+            energy_t energy = INF;
+            if (k == i + 1 && l == j - 1) energy = e_stP(i, j);
+            // the bounds of pseudo_loop::compute_VP_internal_branches
+            const cand_pos_t min_borders = std::min({min_Bp_j, std::min(i + MAXLOOP + 1, j - TURN - 1)});
+            const cand_pos_t max_borders = std::max({max_i_bp + 1, k + j - i - MAXLOOP - 2});
+            if (k < min_borders && l > max_borders) energy = std::min(energy, e_intP(i, k, l, j));
+            if (energy >= INF) return false;
+            add(i, j, P_VP, 0, energy, 0);
+        } else if (left == Region::branches && right == Region::empty) {
+            if (!(k < min_Bp_j) || !wip(i + 1, k - 1)) return false;
+            add(i, j, P_VP, 0, 0, ap_bp);
+        } else if (left == Region::empty && right == Region::branches) {
+            if (!(l > max_i_bp) || !wip(l + 1, j - 1)) return false;
+            add(i, j, P_VP, 0, 0, ap_bp);
+        } else if (left == Region::branches) {
+            // VPR(k,j-1) closes the right side with branches or unpaired bases
+            if (!(k < min_Bp_j) || j - 1 - k < 4 || weakly_closed(k, j - 1) || !(l > std::max(B(k, j - 1), bp(k, j - 1))))
+                return false;
+            if (!wip(i + 1, k - 1)) return false;
+            if (right == Region::branches) {
+                if (!wip(l + 1, j - 1)) return false;
+                add(i, j, P_VP, 0, 0, ap_bp);
+            } else {
+                add(i, j, P_VP, 0, 0, ap_bp + cparty::pseudo_loop_can_pair::cp_branch_penalty(j - 1 - l));
+            }
+        } else {
+            // VPL(i+1,l) opens the left side with unpaired bases
+            const cand_pos_t min_Bp_l = std::min((cand_pos_tu)b(i + 1, l), (cand_pos_tu)Bp(i + 1, l));
+            if (!(l > max_i_bp) || l - (i + 1) < 4 || weakly_closed(i + 1, l) || !(k < min_Bp_l) || !wip(l + 1, j - 1)) return false;
+            add(i, j, P_VP, 0, 0, ap_bp + cparty::pseudo_loop_can_pair::cp_branch_penalty(k - i - 1));
+        }
+        i = k;
+        j = l;
+    }
+}
+
+// WI: a region inside a pseudoloop or a band, with PPS per branch and PUP per unpaired base
+bool LoopScorer::wi(cand_pos_t x, cand_pos_t y) {
+    if (x > y) return true;
+    if (!weakly_closed(x, y)) return false;
+    cand_pos_t unpaired = 0, branches = 0;
+    const bool ok = for_each_branch(
+        x, y, unpaired,
+        [&](cand_pos_t p, cand_pos_t q) {
+            ++branches;
+            return loop(p, q);
+        },
+        [&](cand_pos_t a, cand_pos_t e) { return block(a, e, PSP_penalty + PPS_penalty); });
+    if (!ok) return false;
+    add(x, y, P_WI, 0, 0, unpaired * PUP_penalty + branches * PPS_penalty);
+    return true;
+}
+
+// WIP: a region of a multiloop that spans a band, with bp per branch and cp per unpaired base; it needs a branch
+bool LoopScorer::wip(cand_pos_t x, cand_pos_t y) {
+    if (x >= y || !weakly_closed(x, y)) return false;
+    cand_pos_t unpaired = 0, branches = 0, pseudoknots = 0;
+    const bool ok = for_each_branch(
+        x, y, unpaired,
+        [&](cand_pos_t p, cand_pos_t q) {
+            ++branches;
+            return loop(p, q);
+        },
+        [&](cand_pos_t a, cand_pos_t e) {
+            ++pseudoknots;
+            return block(a, e, PSM_penalty + bp_penalty);
+        });
+    if (!ok || branches + pseudoknots == 0) return false;
+    add(x, y, P_WIP, 0, 0, unpaired * cp_penalty + branches * bp_penalty);
+    return true;
+}
+
+} // namespace
+
+bool decompose_fixed_structure(const std::string &seq,
+                               const std::string &db_full,
+                               const cparty::EnergyEvalOptions &options,
+                               LoopDecomposition &result) {
+    if (options.dangles != 0 && options.dangles != 2) return false;
+    const SequenceContext context(seq, options.dangles);
+    return decompose_fixed_structure(context, db_full, options, result);
+}
+
+bool decompose_fixed_structure(const SequenceContext &context,
+                               const std::string &db_full,
+                               const cparty::EnergyEvalOptions &options,
+                               LoopDecomposition &result) {
+    if (options.dangles != 0 && options.dangles != 2) return false;
+    cparty::vienna::make_pair_matrix_once();
+    result = LoopDecomposition();
+    LoopScorer scorer(context, options, result);
+    return scorer.parse(db_full) && scorer.exterior();
+}
+
+} // namespace internal
+} // namespace cparty
@@ -0,0 +1,52 @@
+#ifndef FIXED_STRUCTURE_LOOPS_HH
+#define FIXED_STRUCTURE_LOOPS_HH
+
+#include "base_types.hh"
+#include "energy_eval_context.hh"
+
+#include <string>
+#include <vector>
+
+namespace cparty {
+
+class SequenceContext;
+
+namespace internal {
+
+// One loop of a scored structure: the pair closing it ((0,0) for the exterior loop, the outer ends for a pseudoknot),
+// its kind as one of the type characters of constants.hh and its energy in dcal/mol
+struct LoopEnergy {
+    cand_pos_t i;
+    cand_pos_t j;
+    char type;
+    energy_t energy;
+};
+
+struct LoopDecomposition {
+    energy_t pk_free_core = 0;      // hairpin, interior, multi and exterior loop terms
+    energy_t band_scaled_terms = 0; // e_stP and e_intP scaled stacks and interior loops inside bands
+    energy_t pk_penalties = 0;      // pseudoknot, band, pseudoloop and band-spanning multiloop penalties
+    std::vector<LoopEnergy> loops;
+
+    energy_t total() const { return pk_free_core + band_scaled_terms + pk_penalties; }
+};
+
+// Scores db_full on seq loop by loop with the terms W_final::hfold uses for it, in time and memory linear in the length.
+// Returns false when the structure is outside what this covers: pseudoknots other than H-type and K-type (density-2)
+// bands, dangles=1, whose stems take the best of several dangle choices, or a structure the restricted fold cannot
+// produce at all (e.g. an interior loop longer than MAXLOOP). Callers fall back to the fold for those.
+bool decompose_fixed_structure(const std::string &seq,
+                               const std::string &db_full,
+                               const cparty::EnergyEvalOptions &options,
+                               LoopDecomposition &result);
+
+// The same on a sequence already encoded for options.dangles, so the structures of one sequence share it
+bool decompose_fixed_structure(const SequenceContext &context,
+                               const std::string &db_full,
+                               const cparty::EnergyEvalOptions &options,
+                               LoopDecomposition &result);
+
+} // namespace internal
+} // namespace cparty
+
+#endif
@@ -6,7 +6,7 @@
 
 // the data structure stored in the V array
 typedef struct minimum_fold {
-    short int pair;
+    int pair;
     char type; // type can be 'H', 'S', 'I', 'M'
     minimum_fold() {
         pair = -1;
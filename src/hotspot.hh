@@ -20,7 +20,7 @@ class Hotspot {
         this->n = n;
         this->energy = 0.0;
         this->size = 1;
-        this->structure = std::string(n + 1, '.');
+        // the structure string is only built for the hotspots that are kept
     }
     // Copy Constuctor
     Hotspot(const Hotspot &hotspot) {
@@ -0,0 +1,120 @@
+#include "interior_loops.hh"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace cparty {
+
+namespace {
+
+// The case E_IntLoop takes for u1 and u2 unpaired bases, both at most MAXLOOP
+LoopKind classify(int u1, int u2) {
+    const int nl = std::max(u1, u2);
+    const int ns = std::min(u1, u2);
+    if (nl == 0) return LoopKind::stack;
+    if (ns == 0) return nl == 1 ? LoopKind::bulge_one : LoopKind::bulge;
+    if (ns == 1) {
+        if (nl == 1) return LoopKind::int11;
+        if (nl == 2) return u1 == 1 ? LoopKind::int21 : LoopKind::int12;
+        return LoopKind::int1n;
+    }
+    if (ns == 2 && nl == 2) return LoopKind::int22;
+    if (ns == 2 && nl == 3) return LoopKind::int23;
+    return LoopKind::generic;
+}
+
+// internal_loop[u] of E_IntLoop, extrapolated beyond MAXLOOP
+energy_t internal_loop(const vrna_param_t *P, int u) {
+    return u <= MAXLOOP ? P->internal_loop[u] : P->internal_loop[30] + (int)(P->lxc * log(u / 30.));
+}
+
+// Raises every factor of the table to the power exponent
+template <typename Table> void raise(Table &table, double exponent) {
+    double *factors = reinterpret_cast<double *>(&table);
+    for (std::size_t t = 0; t < sizeof(Table) / sizeof(double); ++t)
+        factors[t] = pow(factors[t], exponent);
+}
+
+vrna_exp_param_t *raised_copy(const vrna_exp_param_t *exp_params, double exponent) {
+    vrna_exp_param_t *P = vrna_exp_params_copy(const_cast<vrna_exp_param_t *>(exp_params));
+    raise(P->expstack, exponent);
+    raise(P->expbulge, exponent);
+    raise(P->expinternal, exponent);
+    raise(P->expninio, exponent);
+    raise(P->expmismatchI, exponent);
+    raise(P->expmismatch1nI, exponent);
+    raise(P->expmismatch23I, exponent);
+    raise(P->expint11, exponent);
+    raise(P->expint21, exponent);
+    raise(P->expint22, exponent);
+    P->expTermAU = pow(P->expTermAU, exponent);
+    return P;
+}
+
+} // namespace
+
+InteriorLoops::InteriorLoops(const vrna_param_t *params) : P_(params) {
+    for (int u1 = 0; u1 <= MAXLOOP; ++u1) {
+        for (int u2 = 0; u2 <= MAXLOOP; ++u2) {
+            const int nl = std::max(u1, u2);
+            const int ns = std::min(u1, u2);
+            const LoopKind kind = classify(u1, u2);
+            const energy_t asymmetry = std::min(MAX_NINIO, (nl - ns) * P_->ninio[2]);
+            energy_t size = 0;
+            switch (kind) {
+            case LoopKind::bulge_one:
+            case LoopKind::bulge: size = P_->bulge[nl]; break;
+            case LoopKind::int1n: size = internal_loop(P_, nl + 1) + asymmetry; break;
+            case LoopKind::int23: size = P_->internal_loop[5] + P_->ninio[2]; break;
+            case LoopKind::generic: size = internal_loop(P_, nl + ns) + asymmetry; break;
+            default: break;
+            }
+            kind_[u1][u2] = kind;
+            size_[u1][u2] = size;
+        }
+    }
+}
+
+ClosingPair InteriorLoops::closing(int type, int si1, int sj1) const {
+    ClosingPair c;
+    c.type = type;
+    c.si1 = si1;
+    c.sj1 = sj1;
+    c.mismatch = P_->mismatchI[type][si1][sj1];
+    c.mismatch1n = P_->mismatch1nI[type][si1][sj1];
+    c.mismatch23 = P_->mismatch23I[type][si1][sj1];
+    c.terminal = type > 2 ? P_->TerminalAU : 0;
+    return c;
+}
+
+ExpInteriorLoops::ExpInteriorLoops(const vrna_exp_param_t *exp_params)
+    : P_(exp_params), no_GU_closure_(exp_params->model_details.noGUclosure != 0) {
+    for (int u1 = 0; u1 <= MAXLOOP; ++u1) {
+        for (int u2 = 0; u2 <= MAXLOOP; ++u2) {
+            kind_[u1][u2] = classify(u1, u2);
+            ninio_[u1][u2] = P_->expninio[2][std::abs(u1 - u2)];
+        }
+    }
+}
+
+ExpInteriorLoops::ExpInteriorLoops(const vrna_exp_param_t *exp_params, double exponent)
+    : ExpInteriorLoops(raised_copy(exp_params, exponent)) {
+    owned_ = const_cast<vrna_exp_param_t *>(P_);
+}
+
+ExpInteriorLoops::~ExpInteriorLoops() { free(owned_); }
+
+ExpClosingPair ExpInteriorLoops::closing(int type, int si1, int sj1) const {
+    ExpClosingPair c;
+    c.type = type;
+    c.si1 = si1;
+    c.sj1 = sj1;
+    c.no_close = no_GU_closure_ && (type == 3 || type == 4);
+    c.mismatch = P_->expmismatchI[type][si1][sj1];
+    c.mismatch1n = P_->expmismatch1nI[type][si1][sj1];
+    c.mismatch23 = P_->expmismatch23I[type][si1][sj1];
+    c.terminal = type > 2 ? P_->expTermAU : 1;
+    return c;
+}
+
+} // namespace cparty
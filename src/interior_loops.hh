@@ -0,0 +1,145 @@
+#ifndef INTERIOR_LOOPS_HH_
+#define INTERIOR_LOOPS_HH_
+
+#include "base_types.hh"
+#include <math.h>
+
+extern "C" {
+#include "ViennaRNA/loops/internal.h"
+#include "ViennaRNA/params/basic.h"
+}
+
+namespace cparty {
+
+/*
+ * The interior loops of one parameter set, in the form the loops over the inner pairs (k,l) of a closing pair (i,j) read
+ * them. E_IntLoop and exp_E_IntLoop work out the case of the loop from its sizes on every call and add up the size and
+ * asymmetry terms each time; here every (u1,u2) up to MAXLOOP has its case and its size terms in a table, and the terms
+ * of the closing pair are looked up once per closing pair. The results equal those of ViennaRNA, bit for bit.
+ */
+
+// The kinds of interior loops E_IntLoop tells apart, by the unpaired bases u1 and u2 on either side
+enum class LoopKind : unsigned char { stack, bulge_one, bulge, int11, int21, int12, int1n, int22, int23, generic, beyond_maxloop };
+
+// The terms of the closing pair (i,j) of the loops: its type and the bases i+1 and j-1
+struct ClosingPair {
+    int type;
+    int si1;
+    int sj1;
+    energy_t mismatch;   // mismatchI of the closing pair
+    energy_t mismatch1n; // mismatch1nI
+    energy_t mismatch23; // mismatch23I
+    energy_t terminal;   // the terminal AU penalty of a bulge
+};
+
+class InteriorLoops {
+  public:
+    // params must outlive the tables
+    explicit InteriorLoops(const vrna_param_t *params);
+
+    ClosingPair closing(int type, int si1, int sj1) const;
+
+    // E_IntLoop(u1, u2, c.type, type_2, c.si1, c.sj1, sp1, sq1, params)
+    energy_t energy(const ClosingPair &c, int u1, int u2, int type_2, int sp1, int sq1) const {
+        const LoopKind kind = (u1 <= MAXLOOP && u2 <= MAXLOOP) ? kind_[u1][u2] : LoopKind::beyond_maxloop;
+        switch (kind) {
+        case LoopKind::generic:
+            return size_[u1][u2] + c.mismatch + P_->mismatchI[type_2][sq1][sp1];
+        case LoopKind::stack:
+            return P_->stack[c.type][type_2];
+        case LoopKind::bulge_one:
+            return size_[u1][u2] + P_->stack[c.type][type_2];
+        case LoopKind::bulge:
+            return size_[u1][u2] + c.terminal + (type_2 > 2 ? P_->TerminalAU : 0);
+        case LoopKind::int11:
+            return P_->int11[c.type][type_2][c.si1][c.sj1];
+        case LoopKind::int21:
+            return P_->int21[c.type][type_2][c.si1][sq1][c.sj1];
+        case LoopKind::int12:
+            return P_->int21[type_2][c.type][sq1][c.si1][sp1];
+        case LoopKind::int1n:
+            return size_[u1][u2] + c.mismatch1n + P_->mismatch1nI[type_2][sq1][sp1];
+        case LoopKind::int22:
+            return P_->int22[c.type][type_2][c.si1][sp1][sq1][c.sj1];
+        case LoopKind::int23:
+            return size_[u1][u2] + c.mismatch23 + P_->mismatch23I[type_2][sq1][sp1];
+        default:
+            return E_IntLoop(u1, u2, c.type, type_2, c.si1, c.sj1, sp1, sq1, const_cast<vrna_param_t *>(P_));
+        }
+    }
+
+  private:
+    const vrna_param_t *P_;
+    LoopKind kind_[MAXLOOP + 1][MAXLOOP + 1];
+    energy_t size_[MAXLOOP + 1][MAXLOOP + 1]; // the terms of E_IntLoop that only depend on u1 and u2
+};
+
+// The terms of the closing pair (i,j) of the loops as Boltzmann factors
+struct ExpClosingPair {
+    int type;
+    int si1;
+    int sj1;
+    bool no_close; // a GU closing pair under noGUclosure, which only closes stacks
+    pf_t mismatch;
+    pf_t mismatch1n;
+    pf_t mismatch23;
+    pf_t terminal;
+};
+
+class ExpInteriorLoops {
+  public:
+    // exp_params must outlive the tables
+    explicit ExpInteriorLoops(const vrna_exp_param_t *exp_params);
+    // The tables of a copy of exp_params whose interior loop factors are raised to the power exponent, as those of the
+    // interior loops that span a band are; each factor is raised once here rather than once per loop
+    ExpInteriorLoops(const vrna_exp_param_t *exp_params, double exponent);
+    ~ExpInteriorLoops();
+
+    ExpInteriorLoops(const ExpInteriorLoops &) = delete;
+    ExpInteriorLoops &operator=(const ExpInteriorLoops &) = delete;
+
+    ExpClosingPair closing(int type, int si1, int sj1) const;
+
+    // exp_E_IntLoop(u1, u2, c.type, type_2, c.si1, c.sj1, sp1, sq1, exp_params), with its products in the same order
+    pf_t factor(const ExpClosingPair &c, int u1, int u2, int type_2, int sp1, int sq1) const {
+        const LoopKind kind = (u1 <= MAXLOOP && u2 <= MAXLOOP) ? kind_[u1][u2] : LoopKind::beyond_maxloop;
+        if (kind == LoopKind::stack) return P_->expstack[c.type][type_2];
+        if (c.no_close || (no_GU_closure_ && (type_2 == 3 || type_2 == 4))) return 0;
+        switch (kind) {
+        case LoopKind::generic:
+            return P_->expinternal[u1 + u2] * c.mismatch * P_->expmismatchI[type_2][sq1][sp1] * ninio_[u1][u2];
+        case LoopKind::bulge_one:
+            return P_->expbulge[1] * P_->expstack[c.type][type_2];
+        case LoopKind::bulge: {
+            pf_t z = P_->expbulge[u1 + u2] * c.terminal;
+            if (type_2 > 2) z *= P_->expTermAU;
+            return z;
+        }
+        case LoopKind::int11:
+            return P_->expint11[c.type][type_2][c.si1][c.sj1];
+        case LoopKind::int21:
+            return P_->expint21[c.type][type_2][c.si1][sq1][c.sj1];
+        case LoopKind::int12:
+            return P_->expint21[type_2][c.type][sq1][c.si1][sp1];
+        case LoopKind::int1n:
+            return P_->expinternal[u1 + u2] * c.mismatch1n * P_->expmismatch1nI[type_2][sq1][sp1] * ninio_[u1][u2];
+        case LoopKind::int22:
+            return P_->expint22[c.type][type_2][c.si1][sp1][sq1][c.sj1];
+        case LoopKind::int23:
+            return P_->expinternal[5] * c.mismatch23 * P_->expmismatch23I[type_2][sq1][sp1] * ninio_[u1][u2];
+        default:
+            return exp_E_IntLoop(u1, u2, c.type, type_2, c.si1, c.sj1, sp1, sq1, const_cast<vrna_exp_param_t *>(P_));
+        }
+    }
+
+  private:
+    const vrna_exp_param_t *P_;
+    vrna_exp_param_t *owned_ = nullptr; // the raised copy, if any
+    bool no_GU_closure_;
+    LoopKind kind_[MAXLOOP + 1][MAXLOOP + 1];
+    pf_t ninio_[MAXLOOP + 1][MAXLOOP + 1]; // expninio[2][|u1-u2|]
+};
+
+} // namespace cparty
+
+#endif
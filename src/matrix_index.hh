@@ -0,0 +1,63 @@
+#ifndef MATRIX_INDEX_HH_
+#define MATRIX_INDEX_HH_
+
+#include "base_types.hh"
+#include "sparse_tree.hh"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <vector>
+
+namespace cparty {
+
+// The longest base pair span a fold of n nucleotides considers: max_span itself, or n when it is not positive or not below n
+inline cand_pos_t span_limit(cand_pos_t n, cand_pos_t max_span) { return (max_span <= 0 || max_span > n) ? n : max_span; }
+
+// Fills index so that the cell (i,j), i <= j <= i+span, of a matrix stored row by row is at index[i] + j - i, and returns the
+// number of cells to allocate. For span = n this is the usual triangle of (n+1)(n+2)/2 cells; a shorter span keeps each row
+// to span+1 cells, so local folds store n x (span+1) cells instead.
+inline cand_idx_t make_matrix_index(cand_pos_t n, cand_pos_t span, std::vector<cand_idx_t> &index) {
+    index.assign(n + 1, 0);
+    for (cand_pos_t i = 2; i <= n; i++)
+        index[i] = index[i - 1] + std::min(span, n - (i - 1)) + 1;
+    if (span >= n) return ((cand_idx_t)(n + 1) * (n + 2)) / 2;
+    return index[n] + span + 2;
+}
+
+// The same for a ring of rows rows: row i takes the cells of row i-rows, so a scan that has left the rows behind it
+// keeps rows x (span+1) cells for any n. span must be below rows.
+inline cand_idx_t make_ring_index(cand_pos_t n, cand_pos_t span, cand_pos_t rows, std::vector<cand_idx_t> &index) {
+    index.assign(n + 1, 0);
+    for (cand_pos_t i = 1; i <= n; i++)
+        index[i] = (cand_idx_t)((i - 1) % rows) * (span + 1);
+    return (cand_idx_t)rows * (span + 1);
+}
+
+// Ends the run when matrices of cells cells, bytes_per_cell bytes for all of them together, would not fit in the memory
+// of the machine, rather than leaving a fold of a long sequence to a failed allocation or to the kernel
+inline void require_memory(cand_pos_t n, cand_idx_t cells, cand_idx_t bytes_per_cell) {
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page_size <= 0) return;
+    const double needed = (double)cells * bytes_per_cell;
+    const double available = (double)pages * page_size;
+    if (needed <= available) return;
+    fprintf(stderr, "Folding %d nucleotides needs %.1f GB for its matrices but the machine has %.1f GB; -L or -W bound the matrices\n", n,
+            needed / 1e9, available / 1e9);
+    exit(EXIT_FAILURE);
+}
+
+// A local fold has no cell for a restricted pair longer than its span, so such an input ends the run
+inline void require_pairs_within_span(const std::vector<Node> &tree, cand_pos_t n, cand_pos_t max_span) {
+    for (cand_pos_t i = 1; i <= n; ++i) {
+        if (tree[i].pair > i + max_span) {
+            fprintf(stderr, "The restricted pair %d.%d spans more than the maximum base pair span %d\n", i, tree[i].pair, max_span);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+} // namespace cparty
+
+#endif
@@ -1,5 +1,8 @@
 #include "mea.hh"
+#include "matrix_index.hh"
 
+#include <algorithm>
+#include <queue>
 #include <string>
 #include <iostream>
 #include <vector>
@@ -23,11 +26,11 @@ int compute_exterior_cases(cand_pos_t l, cand_pos_t j, sparse_tree &tree) {
  * @brief Given the probabilities found prior, fill the vector p of all entries whose value is greater than the cutoff
  * 
  */
-void plist_from_probs(std::vector<elem_prob_s> &p,std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> samples, int num_samples, cand_pos_t n, double cutoff){
+void plist_from_probs(std::vector<elem_prob_s> &p, const std::vector<pf_t> &probs, const std::vector<cand_idx_t> &index, cand_pos_t n, cand_pos_t max_span,
+                      double cutoff){
     for (cand_pos_t i = n; i >= 1; --i) {
-        for (cand_pos_t j = i; j <= n; ++j) {
-            std::pair<cand_pos_tu, cand_pos_tu> base_pair(i, j);
-            pf_t prob = (pf_t)samples[base_pair] / num_samples;
+        for (cand_pos_t j = i + 1; j <= std::min(n, i + max_span); ++j) {
+            pf_t prob = probs[index[i] + j - i];
             if(prob < cutoff) continue;
 
             elem_prob_s s(i,j,prob);
@@ -95,7 +98,7 @@ struct BlossomMatching {
     }
 
     cand_pos_t lca(cand_pos_t a, cand_pos_t b) {
-        static std::vector<bool> used;
+        thread_local std::vector<bool> used;
         used.resize(n, false);
         while (true) {
             a = base[a];
@@ -266,11 +269,11 @@ void register_candidate(std::vector<cand_list_t> &CL, cand_pos_t const &i, cand_
     CL[j].emplace_back(cand_entry_t(i, e));
 }
 
-cand_pos_t get_index(std::vector<cand_pos_t> &index, cand_pos_t i, cand_pos_t j) {
+cand_idx_t get_index(std::vector<cand_idx_t> &index, cand_pos_t i, cand_pos_t j) {
     if(j<i) return 0; // index 0 will be 0
     return index[i] + j - i;
 }
-pf_t get_value(std::vector<pf_t> array, cand_pos_t ij, cand_pos_t i, cand_pos_t j){
+pf_t get_value(std::vector<pf_t> array, cand_idx_t ij, cand_pos_t i, cand_pos_t j){
     if(j<i) return 0;
     return array[ij];
 }
@@ -285,20 +288,15 @@ pf_t W_final_pf::compute_MEA(sparse_tree &tree,double gamma){
     pu.resize(n+1,1.0);
     
     // Fill p with all pairs/probs > cutoff
-    plist_from_probs(p,samples,num_samples,n,1e-4 / (1 + gamma));
+    plist_from_probs(p,probs,index,n,max_span,1e-4 / (1 + gamma));
 
     // // Prune list to only those ...
     prune_plist(p,pu,pp,plpk,tree,gamma);
     
     pf_t MEA = 0.0;
 
-    std::vector<cand_pos_t> index;
-    cand_pos_t total_length = ((n + 1) * (n + 2)) / 2;
-    index.resize(n + 1);
-    index[1] = 0;
-    for (cand_pos_t i = 2; i <= n; i++) {
-        index[i] = index[i - 1] + (n + 1) - i + 1;
-    }
+    std::vector<cand_idx_t> index;
+    cand_idx_t total_length = cparty::make_matrix_index(n, n, index);
     std::vector<pf_t> W;
     std::vector<pf_t> M;
     std::vector<pf_t> BE;
@@ -330,12 +328,12 @@ pf_t W_final_pf::compute_MEA(sparse_tree &tree,double gamma){
     for(cand_pos_t i = n; i>0;--i){
         cand_pos_t ii = get_index(index,i,i);
         M[ii] = pu[i];
-        if (pp[index_BE].i == i){
+        if (!pp.empty() && pp[index_BE].i == i){
             BE_linear[i] = 2 * gamma * pp[index_BE].p;
             BE[ii] = 2 * gamma * pp[index_BE].p;
             index_BE++;
         }
-        if ((pp[index2].i == i) && (pp[index2].i > pp[index2].j)) ++index2;
+        if (!pp.empty() && (pp[index2].i == i) && (pp[index2].i > pp[index2].j)) ++index2;
         for(cand_pos_t j = i;j<=n;++j){
             cand_pos_t ij = get_index(index,i,j);
             cand_pos_t ijm1 = get_index(index,i,j-1);
@@ -491,7 +489,7 @@ pf_t W_final_pf::compute_MEA(sparse_tree &tree,double gamma){
                     BE[ij] = BE_linear[i];
                 }
                 else if(i+1 == j && ip-1 == jp){
-                    cand_pos_t ip1jm1 = index[i+1] + j-1 - (i+1);
+                    cand_idx_t ip1jm1 = index[i+1] + j-1 - (i+1);
                     BE[ij] = BE[ip1jm1] + BE_linear[i];
                 } else{
                     pf_t m2 = 0;
@@ -25,7 +25,7 @@ struct elem_prob_s{
 };
 
 struct MEAdat {
-    std::vector<cand_pos_t> index;
+    std::vector<cand_idx_t> index;
     std::vector<elem_prob_s> pp;
     std::vector<elem_prob_s> plpk;
     std::vector<pf_t> pu;
@@ -36,7 +36,7 @@ struct MEAdat {
     std::vector<cand_list_t> CL;
     std::vector<cand_list_t> CLPK;
     std::string structure;
-    MEAdat(std::vector<cand_pos_t> &index,std::vector<elem_prob_s> &pp,std::vector<elem_prob_s> &plpk,std::vector<pf_t> &pu,std::vector<pf_t> &M,std::vector<pf_t> &BE,std::vector<pf_t> &WMBP,double &gamma,std::vector<cand_list_t> &CL,std::vector<cand_list_t> &CLPK, std::string &structure){
+    MEAdat(std::vector<cand_idx_t> &index,std::vector<elem_prob_s> &pp,std::vector<elem_prob_s> &plpk,std::vector<pf_t> &pu,std::vector<pf_t> &M,std::vector<pf_t> &BE,std::vector<pf_t> &WMBP,double &gamma,std::vector<cand_list_t> &CL,std::vector<cand_list_t> &CLPK, std::string &structure){
         this->index = index;
         this->pp = pp;
         this->plpk = plpk;
@@ -69,7 +69,8 @@ int comp_plist(const elem_prob_s &a,const elem_prob_s &b){
     return a.j < b.j;
 }
 
-void plist_from_probs(std::vector<elem_prob_s> &p,std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> samples, cand_pos_t n, int num_samples, double cutoff);
+void plist_from_probs(std::vector<elem_prob_s> &p, const std::vector<pf_t> &probs, const std::vector<cand_idx_t> &index, cand_pos_t n, cand_pos_t max_span,
+                      double cutoff);
 
 void prune_plist(std::vector<elem_prob_s> &p, std::vector<pf_t> &pu, std::vector<elem_prob_s> &pl, double gamma);
 
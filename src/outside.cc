@@ -0,0 +1,525 @@
+#include "part_func.hh"
+#include "part_func_can_pair.hh"
+#include "h_externs.hh"
+#include "vienna_state.hh"
+
+#include <algorithm>
+#include <math.h>
+
+/*
+ * Outside (McCaskill) pass over the density-2 grammar of W_final_pf.
+ *
+ * Every inside recurrence is a sum of products X(i,j) += c * Y1 * Y2 * ...; its outside counterpart adds
+ * Xhat(i,j) * c * (product of the other factors) to each Yhat. Visiting the cells in the reverse of the serial
+ * inside order (rows ascending, j descending, and the matrices of a cell in reverse) guarantees that Xhat is
+ * complete before it is handed down. X(i,j) * Xhat(i,j) / Z is then the expected number of times the node X(i,j)
+ * is used by a structure of the ensemble, which for V, VP and BE is the probability of the pair they close.
+ */
+
+void W_final_pf::add_outside(std::vector<pf_t> &hat, cand_pos_t i, cand_pos_t j, pf_t value) {
+    // mirrors the get_energy_* accessors, which return a constant for i >= j and outside the band of a local fold
+    if (i >= j || j - i > max_span) return;
+    hat[index[i] + j - i] += value;
+}
+
+void W_final_pf::add_outside_WI(cand_pos_t i, cand_pos_t j, pf_t value) {
+    // get_energy_WI returns the constant 1 for an empty region
+    if (i > j || j - i > max_span) return;
+    WI_hat[index[i] + j - i] += value;
+}
+
+void W_final_pf::add_outside_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, sparse_tree &tree, pf_t value) {
+    if (j - i >= TURN && i >= 1 && i <= ip && ip < jp && jp <= j && j <= n && tree.tree[i].pair >= 0 && tree.tree[j].pair >= 0
+        && tree.tree[ip].pair >= 0 && tree.tree[jp].pair >= 0 && tree.tree[i].pair == j && tree.tree[j].pair == i && tree.tree[ip].pair == jp
+        && tree.tree[jp].pair == ip) {
+        BE_hat[index[i] + ip - i] += value;
+    }
+}
+
+// The outside pass of the region start..end whose exterior loop run_partition_exterior(ext_tree, start, end) filled
+void W_final_pf::compute_outside(sparse_tree &tree, sparse_tree &ext_tree, cand_pos_t start, cand_pos_t end) {
+    cparty::vienna::make_pair_matrix_once(); // the pair matrix of pair_mat.h is private to each translation unit
+    W_hat.assign(n + 1, 0);
+    V_hat.assign(total_length, 0);
+    VM_hat.assign(total_length, 0);
+    WM_hat.assign(total_length, 0);
+    WMv_hat.assign(total_length, 0);
+    WMp_hat.assign(total_length, 0);
+    if (!pk_free) {
+        WI_hat.assign(total_length, 0);
+        WIP_hat.assign(total_length, 0);
+        VP_hat.assign(total_length, 0);
+        VPL_hat.assign(total_length, 0);
+        VPR_hat.assign(total_length, 0);
+        WMB_hat.assign(total_length, 0);
+        WMBP_hat.assign(total_length, 0);
+        WMBW_hat.assign(total_length, 0);
+        BE_hat.assign(total_length, 0);
+    } else {
+        // WMB is never filled without pseudoknots, but the exterior and multiloop cases still hand their share to it
+        WMB_hat.assign(total_length, 0);
+    }
+
+    outside_exterior(ext_tree, start, end);
+    for (cand_pos_t i = start; i <= end; ++i) {
+        for (cand_pos_t j = std::min<cand_pos_t>(end, i + max_span); j >= i; --j) {
+            outside_cell(i, j, tree);
+        }
+    }
+}
+
+void W_final_pf::compute_probabilities(sparse_tree &tree, cand_pos_t start, cand_pos_t end) {
+    probs.assign(total_length, 0);
+    const pf_t Z = W[end];
+    if (!(Z > 0)) return;
+
+    for (cand_pos_t i = start; i <= end; ++i) {
+        for (cand_pos_t j = i + 1; j <= std::min<cand_pos_t>(end, i + max_span); ++j) {
+            cand_idx_t ij = index[i] + j - i;
+            pf_t p = stems[ij].V * V_hat[ij];
+            if (!pk_free) p += VP[ij] * VP_hat[ij];
+            probs[ij] = p / Z;
+        }
+    }
+    if (!pk_free) {
+        // BE(i,bp(i),ip,bp(ip)) closes the band pair i.bp(i) once for every inner pair ip it can end on
+        for (cand_pos_t i = start; i <= end; ++i) {
+            cand_pos_t j = tree.tree[i].pair;
+            if (j <= i || j > end) continue;
+            pf_t p = 0;
+            for (cand_pos_t ip = i; ip <= j; ++ip) {
+                cand_idx_t iip = index[i] + ip - i;
+                p += BE[iip] * BE_hat[iip];
+            }
+            probs[index[i] + j - i] += p / Z;
+        }
+    }
+
+    // only the probabilities are kept
+    for (std::vector<pf_t> *hat : {&W_hat, &V_hat, &VM_hat, &WM_hat, &WMv_hat, &WMp_hat, &WI_hat, &WIP_hat, &VP_hat, &VPL_hat, &VPR_hat, &WMB_hat,
+                                   &WMBP_hat, &WMBW_hat, &BE_hat}) {
+        hat->clear();
+        hat->shrink_to_fit();
+    }
+}
+
+void W_final_pf::outside_exterior(sparse_tree &ext_tree, cand_pos_t start, cand_pos_t end) {
+    const cand_pos_t offset = start - 1;
+    W_hat[end] = 1;
+    for (cand_pos_t j = end; j >= start + TURN + 1; --j) {
+        const pf_t hat = W_hat[j];
+        if (hat == 0) continue;
+        if (ext_tree.tree[j - offset].pair < 0) W_hat[j - 1] += hat * scale[1];
+        if (ext_tree.weakly_closed(1, j - offset)) {
+            for (cand_pos_t k = std::max<cand_pos_t>(start, j - max_span); k <= j - TURN - 1; ++k) {
+                if (ext_tree.weakly_closed(1, k - 1 - offset)) {
+                    pf_t acc = (k > start) ? W[k - 1] : 1;
+                    pf_t ext = exp_Extloop(k, j);
+                    add_outside(V_hat, k, j, hat * acc * ext);
+                    if (k > start) W_hat[k - 1] += hat * get_energy(k, j) * ext;
+                    if (k == start || ext_tree.weakly_closed(k - offset, j - offset)) {
+                        add_outside(WMB_hat, k, j, hat * acc * pk_exp_.PS_penalty);
+                        if (k > start) W_hat[k - 1] += hat * get_energy_WMB(k, j) * pk_exp_.PS_penalty;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Reverse of fill_cell
+void W_final_pf::outside_cell(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    outside_WM(i, j, tree);
+    outside_WMv_WMp(i, j, tree.tree);
+
+    if (!pk_free) outside_pk_energies(i, j, tree);
+
+    const bool evaluate = tree.weakly_closed(i, j);
+    const pair_type ptype_closing = pair[S_[i]][S_[j]];
+    const bool restricted = tree.tree[i].pair == -1 || tree.tree[j].pair == -1;
+
+    const bool allowed_closing_pair = cparty::part_func_can_pair::can_form_allowed_pair(seq, i, j);
+    if (ptype_closing > 0 && allowed_closing_pair && evaluate && !restricted & !pk_only) outside_energy_restricted(i, j, tree);
+}
+
+void W_final_pf::outside_energy_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    cand_idx_t ij = index[i] + j - i;
+
+    const bool unpaired = (tree.tree[i].pair < -1 && tree.tree[j].pair < -1);
+    const bool paired = (tree.tree[i].pair == j && tree.tree[j].pair == i);
+    if (!(paired || unpaired)) return;
+
+    const pf_t hat = V_hat[ij];
+    if (hat != 0) {
+        // hairpins are leaves; interior loops hand down to V(k,l)
+        cand_pos_t max_k = std::min(j - TURN - 2, i + MAXLOOP + 1);
+        const cparty::ExpClosingPair closing = exp_loops_.closing(pair[S_[i]][S_[j]], S1_[i + 1], S1_[j - 1]);
+        for (cand_pos_t k = i + 1; k <= max_k; ++k) {
+            if (cparty::part_func_can_pair::can_use_internal_left_unpaired_span(tree.up, i, k)) {
+                cand_pos_t min_l = std::max(k + TURN + 1 + MAXLOOP + 2, k + j - i) - MAXLOOP - 2;
+                for (cand_pos_t l = j - 1; l >= min_l; --l) {
+                    const bool allowed_internal_pair = cparty::part_func_can_pair::can_form_allowed_pair(seq, k, l);
+                    if (allowed_internal_pair && cparty::part_func_can_pair::can_use_internal_right_unpaired_span(tree.up, l, j)) {
+                        pf_t e_int = exp_loops_.factor(closing, k - i - 1, j - l - 1, rtype[pair[S_[k]][S_[l]]], S1_[k - 1], S1_[l + 1]);
+                        cand_pos_t u1 = k - i - 1;
+                        cand_pos_t u2 = j - l - 1;
+                        add_outside(V_hat, k, l, hat * e_int * scale[u1 + u2 + 2]);
+                    }
+                }
+            }
+        }
+        VM_hat[ij] += hat;
+    }
+
+    outside_VM(i, j, tree.up);
+}
+
+void W_final_pf::outside_VM(cand_pos_t i, cand_pos_t j, std::vector<int> &up) {
+    cand_idx_t ij = index[i] + j - i;
+    if (VM_hat[ij] == 0) return;
+    const pf_t hat = VM_hat[ij] * scale[2] * exp_Mbloop(i, j) * exp_params_->expMLclosing;
+    for (cand_pos_t k = i + 1; k <= j - TURN - 1; ++k) {
+        pf_t wm = get_energy_WM(i + 1, k - 1);
+        add_outside(WM_hat, i + 1, k - 1, hat * (get_energy_WMv(k, j - 1) + get_energy_WMp(k, j - 1)));
+        add_outside(WMv_hat, k, j - 1, hat * wm);
+        if (cparty::part_func_can_pair::can_use_left_unpaired_span(up, i + 1, k)) wm += expMLbase[k - i - 1];
+        add_outside(WMp_hat, k, j - 1, hat * wm);
+    }
+}
+
+void W_final_pf::outside_WMv_WMp(cand_pos_t i, cand_pos_t j, std::vector<Node> &tree) {
+    if (j - i - 1 < TURN) return;
+    cand_idx_t ij = index[i] + j - i;
+
+    const pf_t hat_v = WMv_hat[ij];
+    const pf_t hat_p = WMp_hat[ij];
+    add_outside(V_hat, i, j, hat_v * exp_MLstem(i, j));
+    add_outside(WMB_hat, i, j, hat_p * pk_exp_.PSM_penalty * pk_exp_.b_penalty);
+    if (tree[j].pair < 0) {
+        add_outside(WMv_hat, i, j - 1, hat_v * expMLbase[1]);
+        add_outside(WMp_hat, i, j - 1, hat_p * expMLbase[1]);
+    }
+}
+
+void W_final_pf::outside_WM(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    if (j - i + 1 < 4) return;
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = WM_hat[ij];
+    if (hat == 0) return;
+
+    const pf_t pk_stem = pk_exp_.PSM_penalty * pk_exp_.b_penalty;
+    for (cand_pos_t k = i; k < j - TURN; ++k) {
+        pf_t stem = exp_MLstem(k, j);
+        pf_t left = get_energy_WM(i, k - 1);
+        if (cparty::part_func_can_pair::can_use_left_unpaired_span(tree.up, i, k)) left += static_cast<pf_t>(expMLbase[k - i]);
+        add_outside(V_hat, k, j, hat * left * stem);
+        add_outside(WMB_hat, k, j, hat * left * pk_stem);
+        add_outside(WM_hat, i, k - 1, hat * (get_energy(k, j) * stem + get_energy_WMB(k, j) * pk_stem));
+    }
+    if (tree.tree[j].pair < 0) WM_hat[index[i] + j - 1 - i] += hat * expMLbase[1];
+}
+
+// Reverse of compute_pk_energies
+void W_final_pf::outside_pk_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    outside_BE(i, tree.tree[i].pair, tree.tree[j].pair, j, tree);
+
+    const pair_type ptype_closing = pair[S_[i]][S_[j]];
+    bool weakly_closed_ij = tree.weakly_closed(i, j);
+
+    if (weakly_closed_ij) {
+        outside_WIP(i, j, tree);
+        outside_WI(i, j, tree);
+    }
+
+    if (!((j - i - 1) <= TURN || (tree.tree[i].pair >= -1 && tree.tree[i].pair > j) || (tree.tree[j].pair >= -1 && tree.tree[j].pair < i)
+          || (tree.tree[i].pair >= -1 && tree.tree[i].pair < i) || (tree.tree[j].pair >= -1 && j < tree.tree[j].pair))) {
+        outside_WMB(i, j, tree);
+        outside_WMBP(i, j, tree);
+        outside_WMBW(i, j, tree);
+    }
+
+    if (!(i == j || j - i < 4 || weakly_closed_ij)) {
+        const bool allowed_closing_pair = cparty::part_func_can_pair::can_form_allowed_pair(seq, i, j);
+        if (tree.tree[j].pair < j) outside_VPR(i, j, tree);
+        if (tree.tree[j].pair < -1) outside_VPL(i, j, tree);
+        if (ptype_closing > 0 && allowed_closing_pair && tree.tree[i].pair < -1 && tree.tree[j].pair < -1) outside_VP(i, j, tree);
+    }
+}
+
+void W_final_pf::outside_WI(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    if (i == j) return;
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = WI_hat[ij];
+    if (hat == 0) return;
+
+    for (cand_pos_t k = i; k <= j - TURN - 1; ++k) {
+        pf_t wi = get_energy_WI(i, k - 1);
+        add_outside(V_hat, k, j, hat * wi * pk_exp_.PPS_penalty);
+        add_outside(WMB_hat, k, j, hat * wi * pk_exp_.PSP_penalty * pk_exp_.PPS_penalty);
+        add_outside_WI(i, k - 1, hat * (get_energy(k, j) * pk_exp_.PPS_penalty + get_energy_WMB(k, j) * pk_exp_.PSP_penalty * pk_exp_.PPS_penalty));
+    }
+    if (tree.tree[j].pair < 0) add_outside_WI(i, j - 1, hat * expPUP_pen[1]);
+}
+
+void W_final_pf::outside_WIP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = WIP_hat[ij];
+    if (hat == 0) return;
+
+    add_outside(V_hat, i, j, hat * pk_exp_.bp_penalty);
+    add_outside(WMB_hat, i, j, hat * pk_exp_.bp_penalty * pk_exp_.PSM_penalty);
+    for (cand_pos_t k = i + 1; k < j - TURN - 1; ++k) {
+        pf_t left = get_energy_WIP(i, k - 1);
+        if (cparty::part_func_can_pair::can_use_left_unpaired_span(tree.up, i, k)) left += expcp_pen[k - i];
+        add_outside(V_hat, k, j, hat * left * pk_exp_.bp_penalty);
+        add_outside(WMB_hat, k, j, hat * left * pk_exp_.bp_penalty * pk_exp_.PSM_penalty);
+        add_outside(WIP_hat, i, k - 1, hat * (get_energy(k, j) * pk_exp_.bp_penalty + get_energy_WMB(k, j) * pk_exp_.bp_penalty * pk_exp_.PSM_penalty));
+    }
+    if (tree.tree[j].pair < 0) add_outside(WIP_hat, i, j - 1, hat * expcp_pen[1]);
+}
+
+void W_final_pf::outside_VPL(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = VPL_hat[ij];
+    if (hat == 0) return;
+
+    cand_pos_t min_Bp_j = std::min((cand_pos_tu)tree.b(i, j), (cand_pos_tu)tree.Bp(i, j));
+    for (cand_pos_t k = i + 1; k < min_Bp_j; ++k) {
+        bool can_pair = cparty::part_func_can_pair::can_use_left_unpaired_span(tree.up, i, k);
+        if (can_pair) add_outside(VP_hat, k, j, hat * expcp_pen[k - i]);
+    }
+}
+
+void W_final_pf::outside_VPR(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = VPR_hat[ij];
+    if (hat == 0) return;
+
+    cand_pos_t max_i_bp = std::max(tree.B(i, j), tree.bp(i, j));
+    for (cand_pos_t k = max_i_bp + 1; k < j; ++k) {
+        bool can_pair = cparty::part_func_can_pair::can_use_right_unpaired_tail(tree.up, k, j);
+        pf_t right = get_energy_WIP(k + 1, j);
+        if (can_pair) right += expcp_pen[j - k];
+        add_outside(VP_hat, i, k, hat * right);
+        add_outside(WIP_hat, k + 1, j, hat * get_energy_VP(i, k));
+    }
+}
+
+void W_final_pf::outside_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = VP_hat[ij];
+    if (hat == 0) return;
+
+    cand_pos_t Bp_ij = tree.Bp(i, j);
+    cand_pos_t B_ij = tree.B(i, j);
+    cand_pos_t b_ij = tree.b(i, j);
+    cand_pos_t bp_ij = tree.bp(i, j);
+
+    const pf_t hat2 = hat * scale[2];
+    if ((tree.tree[i].parent->index) > 0 && (tree.tree[j].parent->index) < (tree.tree[i].parent->index) && Bp_ij >= 0 && B_ij >= 0 && bp_ij < 0) {
+        add_outside_WI(i + 1, Bp_ij - 1, hat2 * get_energy_WI(B_ij + 1, j - 1));
+        add_outside_WI(B_ij + 1, j - 1, hat2 * get_energy_WI(i + 1, Bp_ij - 1));
+    }
+
+    if ((tree.tree[i].parent->index) < (tree.tree[j].parent->index) && (tree.tree[j].parent->index) > 0 && b_ij >= 0 && bp_ij >= 0 && Bp_ij < 0) {
+        add_outside_WI(i + 1, b_ij - 1, hat2 * get_energy_WI(bp_ij + 1, j - 1));
+        add_outside_WI(bp_ij + 1, j - 1, hat2 * get_energy_WI(i + 1, b_ij - 1));
+    }
+
+    if ((tree.tree[i].parent->index) > 0 && (tree.tree[j].parent->index) > 0 && Bp_ij >= 0 && B_ij >= 0 && b_ij >= 0 && bp_ij >= 0) {
+        pf_t wi_left = get_energy_WI(i + 1, Bp_ij - 1);
+        pf_t wi_middle = get_energy_WI(B_ij + 1, b_ij - 1);
+        pf_t wi_right = get_energy_WI(bp_ij + 1, j - 1);
+        add_outside_WI(i + 1, Bp_ij - 1, hat2 * wi_middle * wi_right);
+        add_outside_WI(B_ij + 1, b_ij - 1, hat2 * wi_left * wi_right);
+        add_outside_WI(bp_ij + 1, j - 1, hat2 * wi_left * wi_middle);
+    }
+
+    pair_type ptype_closingip1jm1 = pair[S_[i + 1]][S_[j - 1]];
+    if ((tree.tree[i + 1].pair) < -1 && (tree.tree[j - 1].pair) < -1 && ptype_closingip1jm1 > 0
+        && cparty::part_func_can_pair::can_form_allowed_pair(seq, i + 1, j - 1)) {
+        add_outside(VP_hat, i + 1, j - 1, hat2 * get_e_stP(i, j));
+    }
+
+    cand_pos_t min_borders = std::min((cand_pos_tu)Bp_ij, (cand_pos_tu)b_ij);
+    cand_pos_t edge_i = std::min(i + MAXLOOP + 1, j - TURN - 1);
+    min_borders = std::min(min_borders, edge_i);
+    const cparty::ExpClosingPair closing = pk_closing(i, j);
+    for (cand_pos_t k = i + 1; k < min_borders; ++k) {
+        if (tree.tree[k].pair < -1 && cparty::part_func_can_pair::can_use_internal_left_unpaired_span(tree.up, i, k)) {
+            cand_pos_t max_borders = std::max(bp_ij, B_ij) + 1;
+            cand_pos_t edge_j = k + j - i - MAXLOOP - 2;
+            max_borders = std::max(max_borders, edge_j);
+            for (cand_pos_t l = j - 1; l > max_borders; --l) {
+                pair_type ptype_closingkj = pair[S_[k]][S_[l]];
+                if (k == i + 1 && l == j - 1) continue;
+                if (tree.tree[l].pair < -1 && ptype_closingkj > 0 && cparty::part_func_can_pair::can_form_allowed_pair(seq, k, l)
+                    && cparty::part_func_can_pair::can_use_internal_right_unpaired_span(tree.up, l, j)) {
+                    cand_pos_t u1 = k - i - 1;
+                    cand_pos_t u2 = j - l - 1;
+                    add_outside(VP_hat, k, l, hat * get_e_intP(closing, i, k, l, j) * scale[u1 + u2 + 2]);
+                }
+            }
+        }
+    }
+
+    cand_pos_t min_Bp_j = std::min((cand_pos_tu)tree.b(i, j), (cand_pos_tu)tree.Bp(i, j));
+    cand_pos_t max_i_bp = std::max(tree.B(i, j), tree.bp(i, j));
+    const pf_t hat_split = hat2 * pk_exp_.ap_penalty * expbp2_;
+
+    for (cand_pos_t k = i + 1; k < min_Bp_j; ++k) {
+        pf_t wip = get_energy_WIP(i + 1, k - 1);
+        add_outside(WIP_hat, i + 1, k - 1, hat_split * (get_energy_VP(k, j - 1) + get_energy_VPR(k, j - 1)));
+        add_outside(VP_hat, k, j - 1, hat_split * wip);
+        add_outside(VPR_hat, k, j - 1, hat_split * wip);
+    }
+
+    for (cand_pos_t k = max_i_bp + 1; k < j; ++k) {
+        pf_t wip = get_energy_WIP(k + 1, j - 1);
+        add_outside(WIP_hat, k + 1, j - 1, hat_split * (get_energy_VP(i + 1, k) + get_energy_VPL(i + 1, k)));
+        add_outside(VP_hat, i + 1, k, hat_split * wip);
+        add_outside(VPL_hat, i + 1, k, hat_split * wip);
+    }
+}
+
+void W_final_pf::outside_WMBW(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = WMBW_hat[ij];
+    if (hat == 0) return;
+
+    if (tree.tree[j].pair < j) {
+        for (cand_pos_t l = i + 1; l < j; l++) {
+            if (tree.tree[l].pair < 0 && tree.tree[l].parent->index > -1 && tree.tree[j].parent->index > -1
+                && tree.tree[j].parent->index == tree.tree[l].parent->index) {
+                add_outside(WMBP_hat, i, l, hat * get_energy_WI(l + 1, j));
+                add_outside_WI(l + 1, j, hat * get_energy_WMBP(i, l));
+            }
+        }
+    }
+}
+
+void W_final_pf::outside_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = WMBP_hat[ij];
+    if (hat == 0) return;
+
+    const pf_t hat_pb2 = hat * expPB2_;
+    if (tree.tree[j].pair < 0) {
+        cand_pos_t b_ij = tree.b(i, j);
+        for (cand_pos_t l = i + 1; l < j; ++l) {
+            int ext_case = compute_exterior_cases(l, j, tree);
+            if ((b_ij > 0 && l < b_ij) || (b_ij < 0 && ext_case == 0)) {
+                cand_pos_t bp_il = tree.bp(i, l);
+                cand_pos_t Bp_lj = tree.Bp(l, j);
+                if (bp_il >= 0 && l > bp_il && Bp_lj > 0 && l < Bp_lj) {
+                    cand_pos_t B_lj = tree.B(l, j);
+                    if (i <= tree.tree[l].parent->index && tree.tree[l].parent->index < j && l + TURN <= j) {
+                        // the WMBP (m1) and WMBW (m2) cases share the band and the VP
+                        pf_t be = get_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, tree);
+                        pf_t vp = get_energy_VP(l, j);
+                        pf_t left = get_energy_WMBP(i, l - 1) + get_energy_WMBW(i, l - 1);
+                        add_outside_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, tree, hat_pb2 * left * vp);
+                        add_outside(WMBP_hat, i, l - 1, hat_pb2 * be * vp);
+                        add_outside(WMBW_hat, i, l - 1, hat_pb2 * be * vp);
+                        add_outside(VP_hat, l, j, hat_pb2 * be * left);
+                    }
+                }
+            }
+        }
+    }
+
+    add_outside(VP_hat, i, j, hat * pk_exp_.PB_penalty);
+
+    if (tree.tree[j].pair < 0 && tree.tree[i].pair >= 0) {
+        for (cand_pos_t l = i + 1; l < j; l++) {
+            cand_pos_t bp_il = tree.bp(i, l);
+            if (bp_il >= 0 && bp_il < n && l + TURN <= j) {
+                if (i <= tree.tree[l].parent->index && tree.tree[l].parent->index < j && l + TURN <= j) {
+                    pf_t be = get_BE(i, tree.tree[i].pair, bp_il, tree.tree[bp_il].pair, tree);
+                    pf_t wi = get_energy_WI(bp_il + 1, l - 1);
+                    pf_t vp = get_energy_VP(l, j);
+                    add_outside_BE(i, tree.tree[i].pair, bp_il, tree.tree[bp_il].pair, tree, hat_pb2 * wi * vp);
+                    add_outside_WI(bp_il + 1, l - 1, hat_pb2 * be * vp);
+                    add_outside(VP_hat, l, j, hat_pb2 * be * wi);
+                }
+            }
+        }
+    }
+}
+
+void W_final_pf::outside_WMB(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    if (i == j || !tree.weakly_closed(i, j)) return;
+    cand_idx_t ij = index[i] + j - i;
+    const pf_t hat = WMB_hat[ij];
+    if (hat == 0) return;
+
+    if (tree.tree[j].pair >= 0 && j > tree.tree[j].pair && tree.tree[j].pair > i) {
+        cand_pos_t bp_j = tree.tree[j].pair;
+        for (cand_pos_t l = (bp_j + 1); (l < j); ++l) {
+            cand_pos_t Bp_lj = tree.Bp(l, j);
+            if (Bp_lj >= 0 && Bp_lj < n) {
+                pf_t be = get_BE(bp_j, j, tree.tree[Bp_lj].pair, Bp_lj, tree);
+                pf_t wmbp = get_energy_WMBP(i, l);
+                pf_t wi = get_energy_WI(l + 1, Bp_lj - 1);
+                add_outside_BE(bp_j, j, tree.tree[Bp_lj].pair, Bp_lj, tree, hat * wmbp * wi * pk_exp_.PB_penalty);
+                add_outside(WMBP_hat, i, l, hat * be * wi * pk_exp_.PB_penalty);
+                add_outside_WI(l + 1, Bp_lj - 1, hat * be * wmbp * pk_exp_.PB_penalty);
+            }
+        }
+    }
+
+    WMBP_hat[ij] += hat;
+}
+
+void W_final_pf::outside_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, sparse_tree &tree) {
+    if (!(i >= 1 && i <= ip && ip < jp && jp <= j && j <= n && tree.tree[i].pair > 0 && tree.tree[j].pair > 0 && tree.tree[ip].pair > 0
+          && tree.tree[jp].pair > 0 && tree.tree[i].pair == j && tree.tree[j].pair == i && tree.tree[ip].pair == jp && tree.tree[jp].pair == ip)) {
+        return;
+    }
+    // the base case i.j == ip.jp is a leaf
+    if (i == ip && j == jp) return;
+
+    cand_idx_t iip = index[i] + ip - i;
+    const pf_t hat = BE_hat[iip];
+    if (hat == 0) return;
+
+    if (tree.tree[i + 1].pair == j - 1) add_outside_BE(i + 1, j - 1, ip, jp, tree, hat * get_e_stP(i, j) * scale[2]);
+
+    const pf_t hat_split = hat * pk_exp_.ap_penalty * expbp2_ * scale[2];
+    const cparty::ExpClosingPair closing = pk_closing(i, j);
+    for (cand_pos_t l = i + 1; l <= ip; l++) {
+        if (tree.tree[l].pair >= -1 && jp <= tree.tree[l].pair && tree.tree[l].pair < j) {
+
+            cand_pos_t lp = tree.tree[l].pair;
+
+            bool empty_region_il = (cparty::part_func_can_pair::can_use_internal_left_unpaired_span(tree.up, i, l));
+            bool empty_region_lpj = (cparty::part_func_can_pair::can_use_internal_right_unpaired_span(tree.up, lp, j));
+            bool weakly_closed_il = tree.weakly_closed(i + 1, l - 1);
+            bool weakly_closed_lpj = tree.weakly_closed(lp + 1, j - 1);
+
+            pf_t be = get_BE(l, lp, ip, jp, tree);
+            pf_t wip_left = get_energy_WIP(i + 1, l - 1);
+            pf_t wip_right = get_energy_WIP(lp + 1, j - 1);
+            pf_t be_share = 0;
+            if (empty_region_il && empty_region_lpj) {
+                cand_pos_t u1 = l - i - 1;
+                cand_pos_t u2 = j - lp - 1;
+                be_share += hat * get_e_intP(closing, i, l, lp, j) * scale[u1 + u2 + 2];
+            }
+            if (weakly_closed_il && weakly_closed_lpj) {
+                be_share += hat_split * wip_left * wip_right;
+                add_outside(WIP_hat, i + 1, l - 1, hat_split * be * wip_right);
+                add_outside(WIP_hat, lp + 1, j - 1, hat_split * be * wip_left);
+            }
+            if (weakly_closed_il && empty_region_lpj) {
+                be_share += hat_split * wip_left * expcp_pen[j - lp - 1];
+                add_outside(WIP_hat, i + 1, l - 1, hat_split * be * expcp_pen[j - lp - 1]);
+            }
+            if (empty_region_il && weakly_closed_lpj) {
+                be_share += hat_split * expcp_pen[l - i - 1] * wip_right;
+                add_outside(WIP_hat, lp + 1, j - 1, hat_split * be * expcp_pen[l - i - 1]);
+            }
+            add_outside_BE(l, lp, ip, jp, tree, be_share);
+        }
+    }
+}
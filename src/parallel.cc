@@ -0,0 +1,112 @@
+#include "parallel.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cparty {
+namespace parallel {
+
+namespace {
+
+// Reusable barrier for a fixed set of workers (std::barrier is C++20).
+class Barrier {
+  public:
+    explicit Barrier(int count) : count_(count), waiting_(0), generation_(0) {}
+
+    void arrive_and_wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const unsigned long generation = generation_;
+        if (++waiting_ == count_) {
+            waiting_ = 0;
+            ++generation_;
+            cv_.notify_all();
+            return;
+        }
+        cv_.wait(lock, [&] { return generation != generation_; });
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int count_;
+    int waiting_;
+    unsigned long generation_;
+};
+
+} // namespace
+
+int resolve_thread_count(int requested) {
+    if (requested >= 1) return requested;
+    const unsigned int hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? static_cast<int>(hardware) : 1;
+}
+
+void for_each_antidiagonal(cand_pos_t n, int threads, const std::function<void(cand_pos_t i, cand_pos_t j)> &cell, cand_pos_t max_span) {
+    if (n <= 0) return;
+    if (threads > n) threads = n;
+    const cand_pos_t diagonals = (max_span > 0 && max_span < n) ? max_span + 1 : n;
+    if (threads <= 1) {
+        for (cand_pos_t d = 0; d < diagonals; ++d) {
+            for (cand_pos_t i = 1; i + d <= n; ++i)
+                cell(i, i + d);
+        }
+        return;
+    }
+
+    // One claim counter per diagonal so no worker has to reset a shared counter between barriers.
+    std::vector<std::atomic<cand_pos_t>> next(diagonals);
+    for (cand_pos_t d = 0; d < diagonals; ++d)
+        next[d].store(1, std::memory_order_relaxed);
+
+    Barrier barrier(threads);
+    auto worker = [&]() {
+        for (cand_pos_t d = 0; d < diagonals; ++d) {
+            for (cand_pos_t i = next[d].fetch_add(1, std::memory_order_relaxed); i + d <= n; i = next[d].fetch_add(1, std::memory_order_relaxed))
+                cell(i, i + d);
+            barrier.arrive_and_wait();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (int t = 1; t < threads; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread &t : pool)
+        t.join();
+}
+
+int worker_count(std::size_t count, int threads) {
+    if (count == 0) return 0;
+    if (threads < 1) threads = 1;
+    return static_cast<std::size_t>(threads) < count ? threads : static_cast<int>(count);
+}
+
+void parallel_for(std::size_t count, int threads, const std::function<void(std::size_t k, int worker)> &body) {
+    const int workers = worker_count(count, threads);
+    if (workers <= 1) {
+        for (std::size_t k = 0; k < count; ++k)
+            body(k, 0);
+        return;
+    }
+
+    std::atomic<std::size_t> next(0);
+    auto worker = [&](int id) {
+        for (std::size_t k = next.fetch_add(1, std::memory_order_relaxed); k < count; k = next.fetch_add(1, std::memory_order_relaxed))
+            body(k, id);
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(workers - 1);
+    for (int t = 1; t < workers; ++t)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (std::thread &t : pool)
+        t.join();
+}
+
+} // namespace parallel
+} // namespace cparty
@@ -0,0 +1,30 @@
+#ifndef PARALLEL_HH_
+#define PARALLEL_HH_
+
+#include "base_types.hh"
+#include <cstddef>
+#include <functional>
+
+namespace cparty {
+namespace parallel {
+
+// Maps a user supplied thread count to the number of workers to start; values below 1 select the hardware concurrency.
+int resolve_thread_count(int requested);
+
+// Visits every cell (i,j) with 1 <= i <= j <= n one anti-diagonal d = j-i at a time, shortest span first.
+// Cells of one diagonal are shared among `threads` workers and a barrier separates consecutive diagonals,
+// so a cell only ever reads finished cells of a shorter span. threads <= 1 runs the same order on the caller.
+// A positive max_span stops after the diagonal d = max_span, for local folds.
+void for_each_antidiagonal(cand_pos_t n, int threads, const std::function<void(cand_pos_t i, cand_pos_t j)> &cell, cand_pos_t max_span = 0);
+
+// Number of workers parallel_for starts for `count` items, i.e. the number of per-worker buffers a caller needs.
+int worker_count(std::size_t count, int threads);
+
+// Runs body(k, worker) for every k in [0,count), handing items out dynamically to worker_count(count, threads) workers.
+// `worker` identifies the calling worker so the body can write to private buffers that are merged afterwards.
+void parallel_for(std::size_t count, int threads, const std::function<void(std::size_t k, int worker)> &body);
+
+} // namespace parallel
+} // namespace cparty
+
+#endif
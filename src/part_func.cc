@@ -2,15 +2,23 @@
 #include "part_func_can_pair.hh"
 #include "dot_plot.hh"
 #include "h_externs.hh"
-#include "pf_globals.hh"
+#include "matrix_index.hh"
+#include "parallel.hh"
+#include "simd_kernels.hh"
+#include "vienna_state.hh"
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <math.h>
 #include <stdio.h>
 #include <string>
 
 #define debug 0
+// Estimated ln Z above which the Boltzmann sums are scaled; a double overflows at about exp(709)
+#define UNSCALED_LOG_Z_LIMIT 300.
+// How often the matrices are refilled with a coarser scale after an overflow
+#define MAX_PF_RESCALES 4
 /*
  * If the global use_mfelike_energies flag is set, truncate doubles to int
  * values and cast back to double. This makes the energy parameters of the
@@ -28,9 +36,18 @@
  */
 #define RESCALE_BF(dG, dH, dT, kT) (exp(-TRUNC_MAYBE((double)RESCALE_dG((dG), (dH), (dT))) * 10. / kT))
 
-W_final_pf::W_final_pf(std::string &seq, std::string &MFE_structure, bool pk_free,bool pk_only,bool fatgraph, int dangle, double energy, int num_samples, bool PSplot)
-    : exp_params_(scale_pf_parameters()) {
-    this->seq = seq;
+// The loop factors are tabulated for the pairs the fold considers, and not at all for a scan, whose tables would grow with the sequence
+W_final_pf::W_final_pf(std::string &seq, std::string &MFE_structure, bool pk_free,bool pk_only,bool fatgraph, int dangle, double energy, int num_samples, bool PSplot,
+                       int threads, uint64_t seed, cand_pos_t max_span, cand_pos_t window_size)
+    : W_final_pf(std::make_shared<const cparty::SequenceContext>(seq, dangle, window_size > 0 ? -1 : max_span), MFE_structure, pk_free, pk_only,
+                 fatgraph, energy, num_samples, PSplot, threads, seed, max_span, window_size) {}
+
+W_final_pf::W_final_pf(std::shared_ptr<const cparty::SequenceContext> context, std::string &MFE_structure, bool pk_free, bool pk_only, bool fatgraph,
+                       double energy, int num_samples, bool PSplot, int threads, uint64_t seed, cand_pos_t max_span,
+                       cand_pos_t window_size)
+    : exp_params_(context->exp_params()), context_(context), pk_exp_(context->pk_boltzmann_factors()),
+      exp_loops_(context->exp_interior_loops()), pk_int_loops_(context->exp_params(), e_intP_penalty) {
+    this->seq = context->sequence();
     this->MFE_structure = MFE_structure;
     this->n = seq.length();
     this->pk_free = pk_free;
@@ -38,98 +55,132 @@ W_final_pf::W_final_pf(std::string &seq, std::string &MFE_structure, bool pk_fre
     this->fatgraph = fatgraph;
     this->PSplot = PSplot;
     this->num_samples = num_samples;
+    this->threads = cparty::parallel::resolve_thread_count(threads);
+    this->seed = seed;
+    this->max_span = cparty::span_limit(n, max_span);
+    this->window_size = window_size > 0 ? std::min(window_size, n) : 0;
+    // no window holds a pair longer than itself
+    if (this->window_size > 0) this->max_span = std::min(this->max_span, this->window_size - 1);
 
-    make_pair_matrix();
-    exp_params_->model_details.dangles = dangle;
-    S_ = encode_sequence(seq.c_str(), 0);
-    S1_ = encode_sequence(seq.c_str(), 1);
+    cparty::vienna::make_pair_matrix_once();
+    S_ = context->S();
+    S1_ = context->S1();
+
+    for (int type = 0; type <= NBPAIRS; ++type) {
+        for (int type_2 = 0; type_2 <= NBPAIRS; ++type_2)
+            pk_stack_[type][type_2] = pow(exp_params_->expstack[type][type_2], e_stP_penalty);
+    }
+    expbp2_ = pk_exp_.bp_penalty * pk_exp_.bp_penalty;
+    expPB2_ = pk_exp_.PB_penalty * pk_exp_.PB_penalty;
 
-    index.resize(n + 1);
     scale.resize(n + 1);
     expMLbase.resize(n + 1);
     expcp_pen.resize(n + 1);
+    expcp_pen_reversed.resize(n + 1);
     expPUP_pen.resize(n + 1);
-    cand_pos_t total_length = ((n + 1) * (n + 2)) / 2;
-    index[1] = 0;
-    for (cand_pos_t i = 2; i <= n; i++)
-        index[i] = index[i - 1] + (n + 1) - i + 1;
+    if (this->window_size > 0)
+        total_length = cparty::make_ring_index(n, this->max_span, this->window_size, index);
+    else
+        total_length = cparty::make_matrix_index(n, this->max_span, index);
+    // the columns are the rows of the mirrored sequence, so the same layout serves them
+    if (this->window_size > 0)
+        cparty::make_ring_index(n, this->max_span, this->window_size, column_index);
+    else
+        cparty::make_matrix_index(n, this->max_span, column_index);
+    // the inside matrices, the column copies, their outside counterparts and the probabilities
+    cparty::require_memory(n, total_length, 36 * sizeof(pf_t));
     // Allocate space
-    V.resize(total_length, 0);
+    stems.resize(total_length);
     VM.resize(total_length, 0);
     WM.resize(total_length, 0);
-    WMv.resize(total_length, 0);
-    WMp.resize(total_length, 0);
+    branches.resize(total_length);
+    for (std::vector<pf_t> *column : {&WM_stems_by_column, &WI_stems_by_column, &WIP_stems_by_column, &branches_by_column, &WMp_by_column,
+                                      &WIP_by_column, &WMBW_WI_by_column})
+        column->resize(total_length, 0);
 
     // PK
     WIP.resize(total_length, 0);
     VP.resize(total_length, 0);
     VPL.resize(total_length, 0);
     VPR.resize(total_length, 0);
-    WMB.resize(total_length, 0);
     WMBP.resize(total_length, 0);
     WMBW.resize(total_length, 0);
     BE.resize(total_length, 0);
 
-    rescale_pk_globals();
     exp_params_rescale(energy);
-    W.resize(n + 1, scale[1]);
+    // W[j] starts as the unpaired prefix 1..j, which is what the short prefixes keep
+    W.assign(scale.begin(), scale.end());
     WI.resize(total_length, scale[1]);
-
-    /**     MEA       */
-    // probs.resize(total_length,0);
 }
 
 W_final_pf::~W_final_pf() {}
 
+/**
+ * @brief Picks the per-nucleotide scale of the Boltzmann sums. Short or weakly structured sequences keep pf_scale = 1 so their
+ * sums are exactly the unscaled ones; once the ensemble could leave the double range, every nucleotide is scaled by the
+ * MFE per nucleotide as in ViennaRNA.
+ */
 void W_final_pf::exp_params_rescale(double mfe) {
     double e_per_nt, kT;
     kT = exp_params_->kT;
 
     e_per_nt = mfe * 1000. / this->n;
 
-    exp_params_->pf_scale = exp(-(exp_params_->model_details.sfact * e_per_nt) / kT);
+    // ln Z is at most -MFE/kT plus the entropy of the structure space, which is below ln 2 per nucleotide
+    const double log_Z_estimate = -(exp_params_->model_details.sfact * mfe * 1000.) / kT + this->n * M_LN2;
 
-    if (exp_params_->pf_scale < 1.) exp_params_->pf_scale = 1.;
+    double pf_scale = 1.;
+    if (log_Z_estimate > UNSCALED_LOG_Z_LIMIT) pf_scale = exp(-(exp_params_->model_details.sfact * e_per_nt) / kT);
 
-    exp_params_->pf_scale = 1.;
+    if (pf_scale < 1.) pf_scale = 1.;
+
+    set_pf_scale(pf_scale);
+}
+
+void W_final_pf::set_pf_scale(double pf_scale) {
+    // kept here rather than in exp_params_, which the folds of one sequence share
+    this->pf_scale = pf_scale;
 
     this->scale[0] = 1.;
-    this->scale[1] = (pf_t)(1. / exp_params_->pf_scale);
+    this->scale[1] = (pf_t)(1. / this->pf_scale);
     this->expMLbase[0] = 1;
-    this->expMLbase[1] = (pf_t)(exp_params_->expMLbase / exp_params_->pf_scale);
+    this->expMLbase[1] = (pf_t)(exp_params_->expMLbase / this->pf_scale);
 
     this->expcp_pen[0] = 1;
-    this->expcp_pen[1] = (pf_t)(expcp_penalty / exp_params_->pf_scale);
+    this->expcp_pen[1] = (pf_t)(pk_exp_.cp_penalty / this->pf_scale);
     this->expPUP_pen[0] = 1;
-    this->expPUP_pen[1] = (pf_t)(expPUP_penalty / exp_params_->pf_scale);
+    this->expPUP_pen[1] = (pf_t)(pk_exp_.PUP_penalty / this->pf_scale);
 
     for (cand_pos_t i = 2; i <= this->n; i++) {
         this->scale[i] = this->scale[i / 2] * this->scale[i - (i / 2)];
         this->expMLbase[i] = (pf_t)pow(exp_params_->expMLbase, (double)i) * this->scale[i];
-        this->expcp_pen[i] = (pf_t)pow(expcp_penalty, (double)i) * this->scale[i];
-        this->expPUP_pen[i] = (pf_t)pow(expPUP_penalty, (double)i) * this->scale[i];
+        this->expcp_pen[i] = (pf_t)pow(pk_exp_.cp_penalty, (double)i) * this->scale[i];
+        this->expPUP_pen[i] = (pf_t)pow(pk_exp_.PUP_penalty, (double)i) * this->scale[i];
     }
+    this->expcp_pen_reversed.assign(this->expcp_pen.rbegin(), this->expcp_pen.rend());
 }
 
-void W_final_pf::rescale_pk_globals() {
-    double kT = exp_params_->model_details.betaScale * (exp_params_->model_details.temperature + K0) * GASCONST; /* kT in cal/mol  */
-    double TT = (exp_params_->model_details.temperature + K0) / (Tmeasure);
-    int pf_smooth = exp_params_->model_details.pf_smooth;
-
-    expPS_penalty = RESCALE_BF(PS_penalty, PS_penalty * 3, TT, kT);
-    expPSM_penalty = RESCALE_BF(PSM_penalty, PSM_penalty * 3, TT, kT);
-    expPSP_penalty = RESCALE_BF(PSP_penalty, PSP_penalty * 3, TT, kT);
-    expPB_penalty = RESCALE_BF(PB_penalty, PB_penalty * 3, TT, kT);
-    expPUP_penalty = RESCALE_BF(PUP_penalty, PUP_penalty * 3, TT, kT);
-    expPPS_penalty = RESCALE_BF(PPS_penalty, PPS_penalty * 3, TT, kT);
-
-    expa_penalty = RESCALE_BF(a_penalty, ML_closingdH, TT, kT);
-    expb_penalty = RESCALE_BF(b_penalty, ML_interndH, TT, kT);
-    expc_penalty = RESCALE_BF(c_penalty, ML_BASEdH, TT, kT);
-
-    expap_penalty = RESCALE_BF(ap_penalty, ap_penalty * 3, TT, kT);
-    expbp_penalty = RESCALE_BF(bp_penalty, bp_penalty * 3, TT, kT);
-    expcp_penalty = RESCALE_BF(cp_penalty, cp_penalty * 3, TT, kT);
+cparty::PkBoltzmannFactors scale_pk_penalties(const vrna_exp_param_t *exp_params) {
+    double kT = exp_params->model_details.betaScale * (exp_params->model_details.temperature + K0) * GASCONST; /* kT in cal/mol  */
+    double TT = (exp_params->model_details.temperature + K0) / (Tmeasure);
+    int pf_smooth = exp_params->model_details.pf_smooth;
+
+    cparty::PkBoltzmannFactors factors;
+    factors.PS_penalty = RESCALE_BF(PS_penalty, PS_penalty * 3, TT, kT);
+    factors.PSM_penalty = RESCALE_BF(PSM_penalty, PSM_penalty * 3, TT, kT);
+    factors.PSP_penalty = RESCALE_BF(PSP_penalty, PSP_penalty * 3, TT, kT);
+    factors.PB_penalty = RESCALE_BF(PB_penalty, PB_penalty * 3, TT, kT);
+    factors.PUP_penalty = RESCALE_BF(PUP_penalty, PUP_penalty * 3, TT, kT);
+    factors.PPS_penalty = RESCALE_BF(PPS_penalty, PPS_penalty * 3, TT, kT);
+
+    factors.a_penalty = RESCALE_BF(a_penalty, ML_closingdH, TT, kT);
+    factors.b_penalty = RESCALE_BF(b_penalty, ML_interndH, TT, kT);
+    factors.c_penalty = RESCALE_BF(c_penalty, ML_BASEdH, TT, kT);
+
+    factors.ap_penalty = RESCALE_BF(ap_penalty, ap_penalty * 3, TT, kT);
+    factors.bp_penalty = RESCALE_BF(bp_penalty, bp_penalty * 3, TT, kT);
+    factors.cp_penalty = RESCALE_BF(cp_penalty, cp_penalty * 3, TT, kT);
+    return factors;
 }
 
 /**
@@ -151,38 +202,63 @@ int W_final_pf::compute_exterior_cases(cand_pos_t l, cand_pos_t j, sparse_tree &
 }
 
 inline pf_t W_final_pf::to_Energy(pf_t energy, cand_pos_t length) {
-    return ((-log(energy) - length * log(exp_params_->pf_scale)) * exp_params_->kT / 1000.0);
+    return ((-log(energy) - length * log(this->pf_scale)) * exp_params_->kT / 1000.0);
 }
 
-void W_final_pf::run_partition_dp(sparse_tree &tree) {
-    for (cand_pos_t i = n; i >= 1; --i) {
-        for (cand_pos_t j = i; j <= n; ++j) {
+/**
+ * @brief Fills every matrix entry of the cell (i,j). Each entry is summed by a single thread in a fixed order,
+ * so the wavefront fill gives bit-identical values for any number of threads.
+ */
+void W_final_pf::fill_cell(cand_pos_t i, cand_pos_t j, sparse_tree &tree, bool wavefront) {
+    const bool evaluate = tree.weakly_closed(i, j);
+    const pair_type ptype_closing = pair[S_[i]][S_[j]];
+    const bool restricted = tree.tree[i].pair == -1 || tree.tree[j].pair == -1;
 
-            const bool evaluate = tree.weakly_closed(i, j);
-            const pair_type ptype_closing = pair[S_[i]][S_[j]];
-            const bool restricted = tree.tree[i].pair == -1 || tree.tree[j].pair == -1;
+    const bool allowed_closing_pair = cparty::part_func_can_pair::can_form_allowed_pair(seq, i, j);
+    if (ptype_closing > 0 && allowed_closing_pair && evaluate && !restricted & !pk_only) compute_energy_restricted(i, j, tree);
 
-            const bool allowed_closing_pair = cparty::part_func_can_pair::can_form_allowed_pair(seq, i, j);
-            if (ptype_closing > 0 && allowed_closing_pair && evaluate && !restricted & !pk_only) compute_energy_restricted(i, j, tree);
+    if (!pk_free) {
+        if (wavefront) {
+            compute_pk_cell_energies(i, j, tree);
+            if (tree.tree[i].pair == j) compute_pk_band_energies(i, tree);
+        } else {
+            compute_pk_energies(i, j, tree);
+        }
+    }
 
-            if (!pk_free) compute_pk_energies(i, j, tree);
+    compute_WMv_WMp(i, j, tree.tree);
+    compute_energy_WM_restricted(i, j, tree);
+}
 
-            compute_WMv_WMp(i, j, tree.tree);
-            compute_energy_WM_restricted(i, j, tree);
+void W_final_pf::run_partition_dp(sparse_tree &tree) {
+    if (threads > 1) {
+        cparty::parallel::for_each_antidiagonal(n, threads, [&](cand_pos_t i, cand_pos_t j) { fill_cell(i, j, tree, true); }, max_span);
+        return;
+    }
+    for (cand_pos_t i = n; i >= 1; --i) {
+        for (cand_pos_t j = i; j <= std::min<cand_pos_t>(n, i + max_span); ++j) {
+            fill_cell(i, j, tree, false);
         }
     }
 }
 
-void W_final_pf::run_partition_exterior(sparse_tree &tree) {
-    for (cand_pos_t j = TURN + 1; j <= n; j++) {
+/**
+ * @brief The exterior loop W of the region start..end, end being n for a fold of the whole sequence. ext_tree holds the
+ * restrictions of the region with start at position 1, so it is tree itself for the whole sequence.
+ */
+void W_final_pf::run_partition_exterior(sparse_tree &ext_tree, cand_pos_t start, cand_pos_t end) {
+    const cand_pos_t offset = start - 1;
+    for (cand_pos_t j = start; j <= std::min(end, start + TURN); j++)
+        W[j] = scale[j - offset];
+    for (cand_pos_t j = start + TURN + 1; j <= end; j++) {
         pf_t contributions = 0;
-        if (tree.tree[j].pair < 0) contributions += W[j - 1] * scale[1];
-        if (tree.weakly_closed(1, j)) {
-            for (cand_pos_t k = 1; k <= j - TURN - 1; ++k) {
-                if (tree.weakly_closed(1, k - 1)) {
-                    pf_t acc = (k > 1) ? W[k - 1] : 1; // keep as 0 or 1?
+        if (ext_tree.tree[j - offset].pair < 0) contributions += W[j - 1] * scale[1];
+        if (ext_tree.weakly_closed(1, j - offset)) {
+            for (cand_pos_t k = std::max<cand_pos_t>(start, j - max_span); k <= j - TURN - 1; ++k) {
+                if (ext_tree.weakly_closed(1, k - 1 - offset)) {
+                    pf_t acc = (k > start) ? W[k - 1] : 1; // keep as 0 or 1?
                     contributions += acc * get_energy(k, j) * exp_Extloop(k, j);
-                    if (k == 1 || tree.weakly_closed(k, j)) contributions += acc * get_energy_WMB(k, j) * expPS_penalty;
+                    if (k == start || ext_tree.weakly_closed(k - offset, j - offset)) contributions += acc * get_energy_WMB(k, j) * pk_exp_.PS_penalty;
                 }
             }
         }
@@ -192,11 +268,23 @@ void W_final_pf::run_partition_exterior(sparse_tree &tree) {
 
 void W_final_pf::finalize_partition_outputs(sparse_tree &tree) {
     // Base pair probability
+    compute_outside(tree, tree, 1, n);
+    compute_probabilities(tree, 1, n);
+
     structure = std::string(n, '.');
-    for (cand_pos_t i = 0; i < num_samples; ++i) {
+    // Draw k always uses stream k of the seed, so the merged counts do not depend on how draws are spread over the workers
+    const size_t draws = num_samples > 0 ? num_samples : 0;
+    std::vector<SampleBuffer> buffers(cparty::parallel::worker_count(draws, threads));
+    cparty::parallel::parallel_for(draws, threads, [&](size_t k, int worker) {
+        SampleBuffer &buffer = buffers[worker];
+        buffer.rng = cparty::CounterRng(seed, k);
         std::string structure(n, '.');
-        Sample_W(1, n, structure, samples, tree);
-        structures[structure]++;
+        Sample_W(1, n, structure, buffer, tree);
+        buffer.structures[structure]++;
+    });
+    for (SampleBuffer &buffer : buffers) {
+        for (auto &it : buffer.structures)
+            structures[it.first] += it.second;
     }
     std::unordered_map<std::string, int> fatgraphs;
     if(fatgraph){
@@ -209,22 +297,40 @@ void W_final_pf::finalize_partition_outputs(sparse_tree &tree) {
         }
     }
 
-    pairing_tendency(samples, tree);
+    pairing_tendency(tree);
     this->frequency = (pf_t)structures[MFE_structure] / num_samples;     
 
     if (PSplot) {
-        create_dot_plot(seq, tree.tree, MFE_structure, samples, num_samples);
+        create_dot_plot(seq, tree.tree, MFE_structure, probs, index, max_span);
     }
 }
 
 pf_t W_final_pf::hfold_pf(sparse_tree &tree) {
-    run_partition_dp(tree);
-    run_partition_exterior(tree);
-    const pf_t energy = to_Energy(W[n], n);
+    const pf_t energy = hfold_pf_energy(tree);
     finalize_partition_outputs(tree);
 
     return energy;
 }
+
+pf_t W_final_pf::hfold_pf_energy(sparse_tree &tree) {
+    cparty::require_pairs_within_span(tree.tree, n, max_span);
+    run_partition_dp(tree);
+    run_partition_exterior(tree, 1, n);
+    // The MFE only estimates the ensemble, so a sum that still overflowed is refilled with a coarser scale, and one that
+    // underflowed, e.g. because guess_mfe was deeper than the MFE, with a finer one
+    auto out_of_range = [&] { return !std::isfinite(W[n]) || (W[n] == 0 && this->pf_scale > 1); };
+    for (int attempt = 0; out_of_range() && attempt < MAX_PF_RESCALES; ++attempt) {
+        set_pf_scale(std::isfinite(W[n]) ? std::max(1., this->pf_scale / 2) : this->pf_scale * 2);
+        W.assign(scale.begin(), scale.end());
+        run_partition_dp(tree);
+        run_partition_exterior(tree, 1, n);
+    }
+    if (!std::isfinite(W[n])) {
+        fprintf(stderr, "The partition function overflows double precision even after rescaling\n");
+        exit(EXIT_FAILURE);
+    }
+    return to_Energy(W[n], n);
+}
 pf_t W_final_pf::hfold_MEA(sparse_tree &tree){
     pf_t MEA = compute_MEA(tree,1);
     return MEA;
@@ -275,9 +381,7 @@ pf_t W_final_pf::exp_Mbloop(cand_pos_t i, cand_pos_t j) {
 
 pf_t W_final_pf::HairpinE(cand_pos_t i, cand_pos_t j) {
 
-    const int ptype_closing = pair[S_[i]][S_[j]];
-    if (ptype_closing == 0) return 0;
-    pf_t e_h = static_cast<pf_t>(exp_E_Hairpin(j - i - 1, ptype_closing, S1_[i + 1], S1_[j - 1], &seq.c_str()[i - 1], exp_params_));
+    pf_t e_h = context_->exp_hairpin(i, j);
     e_h *= scale[j - i + 1];
     return e_h;
 }
@@ -285,18 +389,17 @@ pf_t W_final_pf::HairpinE(cand_pos_t i, cand_pos_t j) {
 pf_t W_final_pf::compute_internal_restricted(cand_pos_t i, cand_pos_t j, std::vector<int> &up) {
     pf_t v_iloop = 0;
     cand_pos_t max_k = std::min(j - TURN - 2, i + MAXLOOP + 1);
-    const pair_type ptype_closing = pair[S_[i]][S_[j]];
+    const cparty::ExpClosingPair closing = exp_loops_.closing(pair[S_[i]][S_[j]], S1_[i + 1], S1_[j - 1]);
     for (cand_pos_t k = i + 1; k <= max_k; ++k) {
         if (cparty::part_func_can_pair::can_use_internal_left_unpaired_span(up, i, k)) {
             cand_pos_t min_l = std::max(k + TURN + 1 + MAXLOOP + 2, k + j - i) - MAXLOOP - 2;
             for (cand_pos_t l = j - 1; l >= min_l; --l) {
                 const bool allowed_internal_pair = cparty::part_func_can_pair::can_form_allowed_pair(seq, k, l);
                 if (allowed_internal_pair && cparty::part_func_can_pair::can_use_internal_right_unpaired_span(up, l, j)) {
-                    pf_t v_iloop_kl = get_energy(k, l)
-                                      * exp_E_IntLoop(k - i - 1, j - l - 1, ptype_closing, rtype[pair[S_[k]][S_[l]]], S1_[i + 1], S1_[j - 1],
-                                                      S1_[k - 1], S1_[l + 1], exp_params_);
                     cand_pos_t u1 = k - i - 1;
                     cand_pos_t u2 = j - l - 1;
+                    const pf_t e_int = exp_loops_.factor(closing, u1, u2, rtype[pair[S_[k]][S_[l]]], S1_[k - 1], S1_[l + 1]);
+                    pf_t v_iloop_kl = get_energy(k, l) * e_int;
                     v_iloop_kl *= scale[u1 + u2 + 2];
                     v_iloop += v_iloop_kl;
                 }
@@ -309,58 +412,66 @@ pf_t W_final_pf::compute_internal_restricted(cand_pos_t i, cand_pos_t j, std::ve
 
 void W_final_pf::compute_WMv_WMp(cand_pos_t i, cand_pos_t j, std::vector<Node> &tree) {
     if (j - i - 1 < TURN) return;
-    cand_pos_t ij = index[(i)] + (j) - (i);
+    cand_idx_t ij = index[(i)] + (j) - (i);
 
     pf_t WMv_contributions = 0;
     pf_t WMp_contributions = 0;
 
     WMv_contributions += (get_energy(i, j) * exp_MLstem(i, j));
-    WMp_contributions += (get_energy_WMB(i, j) * expPSM_penalty * expb_penalty);
+    WMp_contributions += (get_energy_WMB(i, j) * pk_exp_.PSM_penalty * pk_exp_.b_penalty);
     if (tree[j].pair < 0) {
         WMv_contributions += (get_energy_WMv(i, j - 1) * expMLbase[1]);
         WMp_contributions += (get_energy_WMp(i, j - 1) * expMLbase[1]);
     }
-    WMv[ij] = WMv_contributions;
-    WMp[ij] = WMp_contributions;
+    branches[ij].WMv = WMv_contributions;
+    branches[ij].WMp = WMp_contributions;
+    branches_by_column[column_cell(i, j)] = WMv_contributions + WMp_contributions;
+    WMp_by_column[column_cell(i, j)] = WMp_contributions;
+}
+
+// The terms of V(i,j) and WMB(i,j) the splits of WM, WI and WIP multiply with their row, stored with the cell in column j
+void W_final_pf::store_stem_columns(cand_pos_t i, cand_pos_t j) {
+    cand_idx_t ij = index[i] + j - i;
+    const cand_idx_t kj = column_cell(i, j);
+    const pf_t V = stems[ij].V;
+    const pf_t WMB = stems[ij].WMB;
+    WM_stems_by_column[kj] = (V != 0 ? V * exp_MLstem(i, j) : 0) + WMB * pk_exp_.PSM_penalty * pk_exp_.b_penalty;
+    WI_stems_by_column[kj] = V * pk_exp_.PPS_penalty + WMB * pk_exp_.PSP_penalty * pk_exp_.PPS_penalty;
+    WIP_stems_by_column[kj] = V * pk_exp_.bp_penalty + WMB * pk_exp_.bp_penalty * pk_exp_.PSM_penalty;
 }
 
 void W_final_pf::compute_energy_WM_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
     if (j - i + 1 < 4) return;
     pf_t contributions = 0;
-    cand_pos_t ij = index[(i)] + (j) - (i);
-    cand_pos_t ijminus1 = index[(i)] + (j)-1 - (i);
-
-    for (cand_pos_t k = i; k < j - TURN; ++k) {
-        pf_t qbt1 = get_energy(k, j) * exp_MLstem(k, j);
-        pf_t qbt2 = get_energy_WMB(k, j) * expPSM_penalty * expb_penalty;
-        bool can_pair = cparty::part_func_can_pair::can_use_left_unpaired_span(tree.up, i, k);
-        if (can_pair) contributions += (static_cast<pf_t>(expMLbase[k - i]) * qbt1);
-        if (can_pair) contributions += (static_cast<pf_t>(expMLbase[k - i]) * qbt2);
-        contributions += (get_energy_WM(i, k - 1) * qbt1);
-        contributions += (get_energy_WM(i, k - 1) * qbt2);
-    }
+    cand_idx_t ij = index[(i)] + (j) - (i);
+    cand_idx_t ijminus1 = index[(i)] + (j)-1 - (i);
+
+    // k = i..j-TURN-1: the unpaired i..k-1, as far as they may be, and WM(i,k-1) before the stem k.j
+    const pf_t *stems_kj = &WM_stems_by_column[column_cell(i, j)];
+    cand_pos_t last_unpaired = cparty::part_func_can_pair::last_left_unpaired_span(tree.up, i, i, j - TURN - 1);
+    contributions += cparty::simd::sum_product(&expMLbase[0], stems_kj, last_unpaired - i + 1);
+    if (j - TURN - 1 > i) contributions += cparty::simd::sum_product(&WM[index[i]], stems_kj + 1, j - TURN - 1 - i);
     if (tree.tree[j].pair < 0) contributions += WM[ijminus1] * expMLbase[1];
     WM[ij] = contributions;
 }
 
 pf_t W_final_pf::compute_energy_VM_restricted(cand_pos_t i, cand_pos_t j, std::vector<int> &up) {
     pf_t contributions = 0;
-    cand_pos_t ij = index[(i)] + (j) - (i);
-    for (cand_pos_t k = i + 1; k <= j - TURN - 1; ++k) {
-        contributions += (get_energy_WM(i + 1, k - 1) * get_energy_WMv(k, j - 1) * exp_Mbloop(i, j) * exp_params_->expMLclosing);
-        contributions += (get_energy_WM(i + 1, k - 1) * get_energy_WMp(k, j - 1) * exp_Mbloop(i, j) * exp_params_->expMLclosing);
-        if (cparty::part_func_can_pair::can_use_left_unpaired_span(up, i + 1, k))
-            contributions += (expMLbase[k - i - 1] * get_energy_WMp(k, j - 1) * exp_Mbloop(i, j) * exp_params_->expMLclosing);
-    }
-
-    contributions *= scale[2];
+    cand_idx_t ij = index[(i)] + (j) - (i);
+    // k = i+1..j-TURN-1: WM(i+1,k-1) before the branches k..j-1, or the unpaired i+1..k-1 before a WMp, as far as they may be
+    cand_pos_t last_unpaired = cparty::part_func_can_pair::last_left_unpaired_span(up, i + 1, i + 1, j - TURN - 1);
+    contributions += cparty::simd::sum_product(&expMLbase[0], &WMp_by_column[column_cell(i + 1, j - 1)], last_unpaired - i);
+    // WM(i+1,i) is empty, so the WM row starts with k = i+2
+    if (j - TURN - 2 > i) contributions += cparty::simd::sum_product(&WM[index[i + 1]], &branches_by_column[column_cell(i + 2, j - 1)], j - TURN - 2 - i);
+
+    contributions *= exp_Mbloop(i, j) * exp_params_->expMLclosing * scale[2];
     VM[ij] = contributions;
     return contributions;
 }
 
 void W_final_pf::compute_energy_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
 
     const bool unpaired = (tree.tree[i].pair < -1 && tree.tree[j].pair < -1);
     const bool paired = (tree.tree[i].pair == j && tree.tree[j].pair == i);
@@ -376,12 +487,29 @@ void W_final_pf::compute_energy_restricted(cand_pos_t i, cand_pos_t j, sparse_tr
 
         contributions += compute_energy_VM_restricted(i, j, tree.up);
     }
-    V[ij] = contributions;
+    stems[ij].V = contributions;
+    store_stem_columns(i, j);
 }
 
 void W_final_pf::compute_pk_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    compute_pk_cell_energies(i, j, tree);
+
+    cand_pos_t ip = tree.tree[i].pair; // i's pair ip should be right side so ip = )
+    cand_pos_t jp = tree.tree[j].pair; // j's pair jp should be left side so jp = (
+    compute_BE(i, ip, jp, j, tree);
+}
+
+// Wavefront counterpart of the BE update in compute_pk_energies, see pseudo_loop::compute_band_energies
+void W_final_pf::compute_pk_band_energies(cand_pos_t i, sparse_tree &tree) {
+    cand_pos_t ip = tree.tree[i].pair;
+    if (ip <= i) return;
+    for (cand_pos_t j = i + 1; j <= ip; ++j)
+        compute_BE(i, ip, tree.tree[j].pair, j, tree);
+}
 
-    cand_pos_t ij = index[i] + j - i;
+void W_final_pf::compute_pk_cell_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+
+    cand_idx_t ij = index[i] + j - i;
     const pair_type ptype_closing = pair[S_[i]][S_[j]];
     bool weakly_closed_ij = tree.weakly_closed(i, j);
 
@@ -410,22 +538,27 @@ void W_final_pf::compute_pk_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tr
         compute_WI(i, j, tree);
         compute_WIP(i, j, tree);
     }
-    cand_pos_t ip = tree.tree[i].pair; // i's pair ip should be right side so ip = )
-    cand_pos_t jp = tree.tree[j].pair; // j's pair jp should be left side so jp = (
-    compute_BE(i, ip, jp, j, tree);
+    WIP_by_column[column_cell(i, j)] = WIP[ij];
+    if (i > 1) {
+        const Node &l = tree.tree[i - 1];
+        const bool in_loop_of_j = l.pair < 0 && l.parent->index > -1 && tree.tree[j].parent->index > -1 && l.parent->index == tree.tree[j].parent->index;
+        WMBW_WI_by_column[column_cell(i, j)] = in_loop_of_j ? WI[ij] : 0;
+    }
 }
 
 void W_final_pf::compute_WI(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     pf_t contributions = 0;
     if (i == j) {
         WI[ij] = expPUP_pen[1];
         return;
     }
-    for (cand_pos_t k = i; k <= j - TURN - 1; ++k) {
-        contributions += (get_energy_WI(i, k - 1) * get_energy(k, j) * expPPS_penalty);
-        contributions += (get_energy_WI(i, k - 1) * get_energy_WMB(k, j) * expPSP_penalty * expPPS_penalty);
+    // k = i..j-TURN-1: WI(i,k-1) before the stem k.j, WI(i,i-1) being 1
+    if (j - TURN - 1 >= i) {
+        const pf_t *stems_kj = &WI_stems_by_column[column_cell(i, j)];
+        contributions += stems_kj[0];
+        contributions += cparty::simd::sum_product(&WI[index[i]], stems_kj + 1, j - TURN - 1 - i);
     }
     if (tree.tree[j].pair < 0) contributions += (get_energy_WI(i, j - 1) * expPUP_pen[1]);
 
@@ -434,17 +567,16 @@ void W_final_pf::compute_WI(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
 void W_final_pf::compute_WIP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     pf_t contributions = 0;
-    contributions += get_energy(i, j) * expbp_penalty;
-    contributions += get_energy_WMB(i, j) * expbp_penalty * expPSM_penalty;
-    for (cand_pos_t k = i + 1; k < j - TURN - 1; ++k) {
-        bool can_pair = cparty::part_func_can_pair::can_use_left_unpaired_span(tree.up, i, k);
-
-        contributions += (get_energy_WIP(i, k - 1) * get_energy(k, j) * expbp_penalty);
-        contributions += (get_energy_WIP(i, k - 1) * get_energy_WMB(k, j) * expbp_penalty * expPSM_penalty);
-        if (can_pair) contributions += (expcp_pen[k - i] * get_energy(k, j) * expbp_penalty);
-        if (can_pair) contributions += (expcp_pen[k - i] * get_energy_WMB(k, j) * expbp_penalty * expPSM_penalty);
+    contributions += get_energy(i, j) * pk_exp_.bp_penalty;
+    contributions += get_energy_WMB(i, j) * pk_exp_.bp_penalty * pk_exp_.PSM_penalty;
+    // k = i+1..j-TURN-2: WIP(i,k-1), WIP(i,i) being 0, or the unpaired i..k-1, as far as they may be, before the stem k.j
+    if (j - TURN - 2 > i) {
+        const pf_t *stems_kj = &WIP_stems_by_column[column_cell(i + 1, j)];
+        cand_pos_t last_unpaired = cparty::part_func_can_pair::last_left_unpaired_span(tree.up, i, i + 1, j - TURN - 2);
+        contributions += cparty::simd::sum_product(&WIP[index[i]], stems_kj, j - TURN - 2 - i);
+        contributions += cparty::simd::sum_product(&expcp_pen[1], stems_kj, last_unpaired - i);
     }
     if (tree.tree[j].pair < 0) contributions += (get_energy_WIP(i, j - 1) * expcp_pen[1]);
     WIP[ij] = contributions;
@@ -452,7 +584,7 @@ void W_final_pf::compute_WIP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
 void W_final_pf::compute_VPL(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     pf_t contributions = 0;
 
     cand_pos_t min_Bp_j = std::min((cand_pos_tu)tree.b(i, j), (cand_pos_tu)tree.Bp(i, j));
@@ -465,19 +597,22 @@ void W_final_pf::compute_VPL(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
 void W_final_pf::compute_VPR(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     pf_t contributions = 0;
     cand_pos_t max_i_bp = std::max(tree.B(i, j), tree.bp(i, j));
-    for (cand_pos_t k = max_i_bp + 1; k < j; ++k) {
-        bool can_pair = cparty::part_func_can_pair::can_use_right_unpaired_span(tree.up, k, j);
-        contributions += (get_energy_VP(i, k) * get_energy_WIP(k + 1, j));
-        if (can_pair) contributions += (get_energy_VP(i, k) * expcp_pen[k - i]);
+    // k = max_i_bp+1..j-1, VP(i,k) being 0 for k <= i: VP(i,k) before WIP(k+1,j), WIP(j,j) being 0, or before the unpaired k+1..j
+    cand_pos_t first = std::max(i + 1, max_i_bp + 1);
+    if (first < j) {
+        const pf_t *VP_ik = &VP[index[i] + first - i];
+        contributions += cparty::simd::sum_product(VP_ik, &WIP_by_column[column_cell(first + 1, j)], j - first);
+        cand_pos_t first_unpaired = cparty::part_func_can_pair::first_right_unpaired_tail(tree.up, first, j - 1, j);
+        contributions += cparty::simd::sum_product(VP_ik + (first_unpaired - first), &expcp_pen_reversed[n - j + first_unpaired], j - first_unpaired);
     }
     VPR[ij] = contributions;
 }
 
 void W_final_pf::compute_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
 
     pf_t contributions = 0;
 
@@ -516,6 +651,7 @@ void W_final_pf::compute_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
     cand_pos_t min_borders = std::min((cand_pos_tu)Bp_ij, (cand_pos_tu)b_ij);
     cand_pos_t edge_i = std::min(i + MAXLOOP + 1, j - TURN - 1);
     min_borders = std::min(min_borders, edge_i);
+    const cparty::ExpClosingPair closing = pk_closing(i, j);
     for (cand_pos_t k = i + 1; k < min_borders; ++k) {
         if (tree.tree[k].pair < -1 && cparty::part_func_can_pair::can_use_internal_left_unpaired_span(tree.up, i, k)) {
             cand_pos_t max_borders = std::max(bp_ij, B_ij) + 1;
@@ -526,7 +662,7 @@ void W_final_pf::compute_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
                 if (k == i + 1 && l == j - 1) continue; // I have to add or else it will add a stP version and an eintP version to the sum
                 if (tree.tree[l].pair < -1 && ptype_closingkj > 0 && cparty::part_func_can_pair::can_form_allowed_pair(seq, k, l)
                     && cparty::part_func_can_pair::can_use_internal_right_unpaired_span(tree.up, l, j)) {
-                    pf_t vp_iloop_kl = (get_e_intP(i, k, l, j) * get_energy_VP(k, l));
+                    pf_t vp_iloop_kl = (get_e_intP(closing, i, k, l, j) * get_energy_VP(k, l));
                     cand_pos_t u1 = k - i - 1;
                     cand_pos_t u2 = j - l - 1;
                     vp_iloop_kl *= scale[u1 + u2 + 2];
@@ -540,25 +676,25 @@ void W_final_pf::compute_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
     cand_pos_t max_i_bp = std::max(tree.B(i, j), tree.bp(i, j));
 
     for (cand_pos_t k = i + 1; k < min_Bp_j; ++k) {
-        pf_t m6 = (get_energy_WIP(i + 1, k - 1) * get_energy_VP(k, j - 1) * expap_penalty * pow(expbp_penalty, 2));
+        pf_t m6 = (get_energy_WIP(i + 1, k - 1) * get_energy_VP(k, j - 1) * pk_exp_.ap_penalty * expbp2_);
         m6 *= scale[2];
         contributions += m6;
     }
 
     for (cand_pos_t k = max_i_bp + 1; k < j; ++k) {
-        pf_t m7 = (get_energy_VP(i + 1, k) * get_energy_WIP(k + 1, j - 1) * expap_penalty * pow(expbp_penalty, 2));
+        pf_t m7 = (get_energy_VP(i + 1, k) * get_energy_WIP(k + 1, j - 1) * pk_exp_.ap_penalty * expbp2_);
         m7 *= scale[2];
         contributions += m7;
     }
 
     for (cand_pos_t k = i + 1; k < min_Bp_j; ++k) {
-        pf_t m8 = (get_energy_WIP(i + 1, k - 1) * get_energy_VPR(k, j - 1) * expap_penalty * pow(expbp_penalty, 2));
+        pf_t m8 = (get_energy_WIP(i + 1, k - 1) * get_energy_VPR(k, j - 1) * pk_exp_.ap_penalty * expbp2_);
         m8 *= scale[2];
         contributions += m8;
     }
 
     for (cand_pos_t k = max_i_bp + 1; k < j; ++k) {
-        pf_t m9 = (get_energy_VPL(i + 1, k) * get_energy_WIP(k + 1, j - 1) * expap_penalty * pow(expbp_penalty, 2));
+        pf_t m9 = (get_energy_VPL(i + 1, k) * get_energy_WIP(k + 1, j - 1) * pk_exp_.ap_penalty * expbp2_);
         m9 *= scale[2];
         contributions += m9;
     }
@@ -566,45 +702,33 @@ void W_final_pf::compute_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
     VP[ij] = contributions;
 }
 
-pf_t W_final_pf::compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l) {
-    const pair_type ptype_closing = pair[S_[i]][S_[j]];
-    return exp_E_IntLoop(k - i - 1, j - l - 1, ptype_closing, rtype[pair[S_[k]][S_[l]]], S1_[i + 1], S1_[j - 1], S1_[k - 1], S1_[l + 1], exp_params_);
-}
-
 pf_t W_final_pf::get_e_stP(cand_pos_t i, cand_pos_t j) {
     if (i + 1 == j - 1) { // TODO: do I need something like that or stack is taking care of this?
         return 0;
     }
-    pf_t e_st = compute_int(i, j, i + 1, j - 1);
-
-    return pow(e_st, e_stP_penalty);
+    return pk_stack_[pair[S_[i]][S_[j]]][rtype[pair[S_[i + 1]][S_[j - 1]]]];
 }
 
-pf_t W_final_pf::get_e_intP(cand_pos_t i, cand_pos_t ip, cand_pos_t jp, cand_pos_t j) {
-    if (ip == i + 1 && jp == j - 1) return 0;
-    pf_t e_int = compute_int(i, j, ip, jp);
+cparty::ExpClosingPair W_final_pf::pk_closing(cand_pos_t i, cand_pos_t j) { return pk_int_loops_.closing(pair[S_[i]][S_[j]], S1_[i + 1], S1_[j - 1]); }
 
-    return pow(e_int, e_intP_penalty);
+pf_t W_final_pf::get_e_intP(const cparty::ExpClosingPair &closing, cand_pos_t i, cand_pos_t ip, cand_pos_t jp, cand_pos_t j) {
+    if (ip == i + 1 && jp == j - 1) return 0;
+    return pk_int_loops_.factor(closing, ip - i - 1, j - jp - 1, rtype[pair[S_[ip]][S_[jp]]], S1_[ip - 1], S1_[jp + 1]);
 }
 
 void W_final_pf::compute_WMBW(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
 
     pf_t contributions = 0;
 
-    if (tree.tree[j].pair < j) {
-        for (cand_pos_t l = i + 1; l < j; l++) {
-            if (tree.tree[l].pair < 0 && tree.tree[l].parent->index > -1 && tree.tree[j].parent->index > -1
-                && tree.tree[j].parent->index == tree.tree[l].parent->index) {
-                contributions += get_energy_WMBP(i, l) * get_energy_WI(l + 1, j);
-            }
-        }
-    }
+    // l = i+1..j-1: WMBP(i,l) before WI(l+1,j), which the column copy holds only for an unpaired l in the loop of j
+    if (tree.tree[j].pair < j)
+        contributions += cparty::simd::sum_product(&WMBP[index[i] + 1], &WMBW_WI_by_column[column_cell(i + 2, j)], j - i - 1);
     WMBW[ij] = contributions;
 }
 
 void W_final_pf::compute_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     pf_t contributions = 0;
 
     if (tree.tree[j].pair < 0) {
@@ -619,7 +743,7 @@ void W_final_pf::compute_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
                     cand_pos_t B_lj = tree.B(l, j);
                     if (i <= tree.tree[l].parent->index && tree.tree[l].parent->index < j && l + TURN <= j) {
                         pf_t m1 = get_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, tree) * get_energy_WMBP(i, l - 1)
-                                  * get_energy_VP(l, j) * pow(expPB_penalty, 2);
+                                  * get_energy_VP(l, j) * expPB2_;
                         contributions += m1;
                     }
                 }
@@ -639,7 +763,7 @@ void W_final_pf::compute_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
                     cand_pos_t B_lj = tree.B(l, j);
                     if (i <= tree.tree[l].parent->index && tree.tree[l].parent->index < j && l + TURN <= j) {
                         pf_t m2 = get_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, tree) * get_energy_WMBW(i, l - 1)
-                                  * get_energy_VP(l, j) * pow(expPB_penalty, 2);
+                                  * get_energy_VP(l, j) * expPB2_;
                         contributions += m2;
                     }
                 }
@@ -647,7 +771,7 @@ void W_final_pf::compute_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
         }
     }
 
-    pf_t m3 = get_energy_VP(i, j) * expPB_penalty;
+    pf_t m3 = get_energy_VP(i, j) * pk_exp_.PB_penalty;
     contributions += m3; // Make sure not to use non-Partition values
 
     if (tree.tree[j].pair < 0 && tree.tree[i].pair >= 0) {
@@ -656,7 +780,7 @@ void W_final_pf::compute_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
             if (bp_il >= 0 && bp_il < n && l + TURN <= j) {
                 if (i <= tree.tree[l].parent->index && tree.tree[l].parent->index < j && l + TURN <= j) {
                     pf_t m4 = get_BE(i, tree.tree[i].pair, bp_il, tree.tree[bp_il].pair, tree) * get_energy_WI(bp_il + 1, l - 1) * get_energy_VP(l, j)
-                              * pow(expPB_penalty, 2);
+                              * expPB2_;
                     contributions += m4;
                 }
             }
@@ -667,11 +791,13 @@ void W_final_pf::compute_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 }
 
 void W_final_pf::compute_WMB(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     pf_t contributions = 0;
     // base case
-    if (i == j) {
-        WMB[ij] = 0;
+    // a WMB that is not weakly closed is only a piece of a band and must not stand in for a whole pseudoknot
+    if (i == j || !tree.weakly_closed(i, j)) {
+        stems[ij].WMB = 0;
+        store_stem_columns(i, j);
         return;
     }
 
@@ -682,14 +808,15 @@ void W_final_pf::compute_WMB(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
             cand_pos_t Bp_lj = tree.Bp(l, j);
             if (Bp_lj >= 0 && Bp_lj < n) {
                 contributions +=
-                    get_BE(bp_j, j, tree.tree[Bp_lj].pair, Bp_lj, tree) * get_energy_WMBP(i, l) * get_energy_WI(l + 1, Bp_lj - 1) * expPB_penalty;
+                    get_BE(bp_j, j, tree.tree[Bp_lj].pair, Bp_lj, tree) * get_energy_WMBP(i, l) * get_energy_WI(l + 1, Bp_lj - 1) * pk_exp_.PB_penalty;
             }
         }
     }
 
     contributions += get_energy_WMBP(i, j);
 
-    WMB[ij] = contributions;
+    stems[ij].WMB = contributions;
+    store_stem_columns(i, j);
 }
 
 void W_final_pf::compute_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, sparse_tree &tree) {
@@ -701,7 +828,7 @@ void W_final_pf::compute_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_
     }
     // (   (    (   )    )   ) //
     // i   l    ip  jp   lp  j //
-    cand_pos_t iip = index[i] + ip - i;
+    cand_idx_t iip = index[i] + ip - i;
     pf_t contributions = 0;
     // base case: i.j and ip.jp must be in G
     if (tree.tree[i].pair != j || tree.tree[ip].pair != jp) {
@@ -722,6 +849,7 @@ void W_final_pf::compute_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_
         contributions += be_estp;
     }
 
+    const cparty::ExpClosingPair closing = pk_closing(i, j);
     for (cand_pos_t l = i + 1; l <= ip; l++) {
         if (tree.tree[l].pair >= -1 && jp <= tree.tree[l].pair && tree.tree[l].pair < j) {
 
@@ -733,25 +861,25 @@ void W_final_pf::compute_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_
             bool weakly_closed_lpj = tree.weakly_closed(lp + 1, j - 1); // weakly closed between lp+1 and j-1
 
             if (empty_region_il && empty_region_lpj) { //&& !(ip == (i+1) && jp==(j-1)) && !(l == (i+1) && lp == (j-1))){
-                pf_t eintp = get_e_intP(i, l, lp, j) * get_BE(l, lp, ip, jp, tree);
+                pf_t eintp = get_e_intP(closing, i, l, lp, j) * get_BE(l, lp, ip, jp, tree);
                 cand_pos_t u1 = l - i - 1;
                 cand_pos_t u2 = j - lp - 1;
                 eintp *= scale[u1 + u2 + 2];
                 contributions += eintp; // Added to e_intP that l != i+1 and lp != j-1 at the same time
             }
             if (weakly_closed_il && weakly_closed_lpj) {
-                pf_t m3 = get_energy_WIP(i + 1, l - 1) * get_BE(l, lp, ip, jp, tree) * get_energy_WIP(lp + 1, j - 1) * expap_penalty
-                          * pow(expbp_penalty, 2);
+                pf_t m3 = get_energy_WIP(i + 1, l - 1) * get_BE(l, lp, ip, jp, tree) * get_energy_WIP(lp + 1, j - 1) * pk_exp_.ap_penalty
+                          * expbp2_;
                 m3 *= scale[2];
                 contributions += m3;
             }
             if (weakly_closed_il && empty_region_lpj) {
-                pf_t m4 = get_energy_WIP(i + 1, l - 1) * get_BE(l, lp, ip, jp, tree) * expcp_pen[j - lp - 1] * expap_penalty * pow(expbp_penalty, 2);
+                pf_t m4 = get_energy_WIP(i + 1, l - 1) * get_BE(l, lp, ip, jp, tree) * expcp_pen[j - lp - 1] * pk_exp_.ap_penalty * expbp2_;
                 m4 *= scale[2];
                 contributions += m4;
             }
             if (empty_region_il && weakly_closed_lpj) {
-                pf_t m5 = expcp_pen[l - i - 1] * get_BE(l, lp, ip, jp, tree) * get_energy_WIP(lp + 1, j - 1) * expap_penalty * pow(expbp_penalty, 2);
+                pf_t m5 = expcp_pen[l - i - 1] * get_BE(l, lp, ip, jp, tree) * get_energy_WIP(lp + 1, j - 1) * pk_exp_.ap_penalty * expbp2_;
                 m5 *= scale[2];
                 contributions += m5;
             }
@@ -782,8 +910,7 @@ std::vector<cand_pos_t> boustrophedon(cand_pos_t start, cand_pos_t end) {
     return seq;
 }
 
-void W_final_pf::Sample_W(cand_pos_t start, cand_pos_t end, std::string &structure,
-                          std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_W(cand_pos_t start, cand_pos_t end, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("W at %d and %d with W[j]=%f,%f\n", start, end, W[end], to_Energy(W[end], end));
     cand_pos_t j = end;
     cand_pos_t m = end;
@@ -793,17 +920,18 @@ void W_final_pf::Sample_W(cand_pos_t start, cand_pos_t end, std::string &structu
         for (; j > start; --j) {         // Moving through the unpaired bases in j
             W_temp = W[j - 1] * scale[1];
             if (tree.tree[j].pair < 0) { // Checking if j can be unpaired
-                pf_t r = vrna_urn() * W[j];
+                pf_t r = buffer.rng.uniform() * W[j];
                 if (r > W_temp) { // Checking if our random sample means j is paired or unpaired
                     break;        // j is paired
                 }
             } else {
+                W_temp = 0; // no unpaired share left to exclude from the paired cases
                 break; // j can't be unpaired so it must be paired
             }
         }
         if (j <= start + TURN) return; // No more base pairs can occur, but still successful
-        pf_t r = vrna_urn() * (W[j] - W_temp);
-        std::vector<cand_pos_t> is = boustrophedon(start, j - 1); // applies an alternating list so that the base pairing isn't biased to the right side
+        pf_t r = buffer.rng.uniform() * (W[j] - W_temp);
+        std::vector<cand_pos_t> is = boustrophedon(std::max(start, j - max_span), j - 1); // applies an alternating list so that the base pairing isn't biased to the right side
         cand_pos_t bous_n = is.size();
         pf_t qt = 0;
         cand_pos_t k = start;
@@ -820,7 +948,7 @@ void W_final_pf::Sample_W(cand_pos_t start, cand_pos_t end, std::string &structu
                     }
 
                     if (k == 1 || tree.weakly_closed(k, j)) {
-                        Wkl = acc * get_energy_WMB(k, j) * expPS_penalty;
+                        Wkl = acc * get_energy_WMB(k, j) * pk_exp_.PS_penalty;
                         qt += Wkl;
                         if (qt > r) {
                             pseudoknot = true;
@@ -834,17 +962,16 @@ void W_final_pf::Sample_W(cand_pos_t start, cand_pos_t end, std::string &structu
             printf("backtracking failed in ext loop at %d and %d with W[j] = %f, qt:%f < r:%f\n", start, end, W[j], qt, r);
             exit(0); /* error */
         }
-        Sample_W(start, k - 1, structure, samples, tree);
+        Sample_W(start, k - 1, structure, buffer, tree);
         if (!pseudoknot) {
-            Sample_V(k, j, structure, samples, tree);
+            Sample_V(k, j, structure, buffer, tree);
         } else {
-            Sample_WMB(k, j, structure, samples, tree);
+            Sample_WMB(k, j, structure, buffer, tree);
         }
     }
 }
 
-void W_final_pf::Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure,
-                          std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("V at %d and %d\n", i, j);
 
     cand_pos_t k = i;
@@ -855,12 +982,7 @@ void W_final_pf::Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure,
     pf_t qbr = get_energy(i, j);
     pf_t V_temp = 0;
 
-    std::pair<cand_pos_tu, cand_pos_tu> base_pair(i, j);
-    std::pair<cand_pos_tu, cand_pos_tu> base_pair_reversed(j, i);
-    ++samples[base_pair]; // Increments the base pair found in V
-    ++samples[base_pair_reversed];
-
-    pf_t r = vrna_urn() * qbr;
+    pf_t r = buffer.rng.uniform() * qbr;
     pf_t qbt1 = 0;
     bool canH = cparty::part_func_can_pair::can_use_hairpin_unpaired_span(tree.up, i, j);
 
@@ -869,7 +991,7 @@ void W_final_pf::Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure,
     qbt1 += V_temp;
     if (qbt1 >= r) return;
     cand_pos_t max_k = std::min(j - TURN - 2, i + MAXLOOP + 1); // i+1+tree.up[i+1]?
-    const pair_type ptype_closing = pair[S_[i]][S_[j]];
+    const cparty::ExpClosingPair closing = exp_loops_.closing(pair[S_[i]][S_[j]], S1_[i + 1], S1_[j - 1]);
     for (k = i + 1; k <= max_k; k++) {
         if (cparty::part_func_can_pair::can_use_internal_left_unpaired_span(tree.up, i, k)) {
             cand_pos_t min_l = std::max(k + TURN + 1 + MAXLOOP + 2, k + j - i) - MAXLOOP - 2;
@@ -878,9 +1000,7 @@ void W_final_pf::Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure,
                 if (allowed_internal_pair && cparty::part_func_can_pair::can_use_internal_right_unpaired_span(tree.up, l, j)) {
                     cand_pos_t u1 = k - i - 1;
                     cand_pos_t u2 = j - l - 1;
-                    V_temp = get_energy(k, l)
-                             * exp_E_IntLoop(u1, u2, ptype_closing, rtype[pair[S_[k]][S_[l]]], S1_[i + 1], S1_[j - 1], S1_[k - 1], S1_[l + 1],
-                                             exp_params_);
+                    V_temp = get_energy(k, l) * exp_loops_.factor(closing, u1, u2, rtype[pair[S_[k]][S_[l]]], S1_[k - 1], S1_[l + 1]);
                     V_temp *= scale[u1 + u2 + 2];
                     qbt1 += V_temp;
                     if (qbt1 >= r) break;
@@ -890,7 +1010,7 @@ void W_final_pf::Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (qbt1 >= r) {
-        Sample_V(k, l, structure, samples, tree); // Backtrack the internal loop
+        Sample_V(k, l, structure, buffer, tree); // Backtrack the internal loop
         return;
     }
 
@@ -902,11 +1022,10 @@ void W_final_pf::Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure,
     }
 
     // Must be a multiloop
-    Sample_VM(i, j, structure, samples, tree);
+    Sample_VM(i, j, structure, buffer, tree);
 }
 
-void W_final_pf::Sample_VM(cand_pos_t i, cand_pos_t j, std::string &structure,
-                           std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_VM(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("VM at %d and %d\n", i, j);
     cand_pos_t k;
     pf_t qt = 0;
@@ -916,7 +1035,7 @@ void W_final_pf::Sample_VM(cand_pos_t i, cand_pos_t j, std::string &structure,
     }
     pf_t V_temp = 0.;
     pf_t VM_inside = get_energy_VM(i, j) / scale[2]; // If I remove scale from VM's saved values, I may save time here.
-    pf_t r = vrna_urn() * VM_inside;
+    pf_t r = buffer.rng.uniform() * VM_inside;
     bool unpaired = false;
     bool pseudoknot = false;
     for (k = i + 1; k <= j - TURN - 1; ++k) {
@@ -949,16 +1068,15 @@ void W_final_pf::Sample_VM(cand_pos_t i, cand_pos_t j, std::string &structure,
     }
 
     if (!unpaired) {
-        Sample_WM(i + 1, k - 1, structure, samples, tree);
+        Sample_WM(i + 1, k - 1, structure, buffer, tree);
     }
     if (!pseudoknot) { // Case 1
-        Sample_WMV(k, j - 1, structure, samples, tree);
+        Sample_WMV(k, j - 1, structure, buffer, tree);
     } else { // Case 2 or 3
-        Sample_WMP(k, j - 1, structure, samples, tree);
+        Sample_WMP(k, j - 1, structure, buffer, tree);
     }
 }
-void W_final_pf::Sample_WM(cand_pos_t i, cand_pos_t j, std::string &structure,
-                           std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_WM(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("WM at %d and %d\n", i, j);
     cand_pos_t k;
     pf_t qt = 0;
@@ -977,7 +1095,7 @@ void W_final_pf::Sample_WM(cand_pos_t i, cand_pos_t j, std::string &structure,
 
     for (; j > i + TURN; --j) {
         if (tree.tree[j].pair < 0) {
-            pf_t r = vrna_urn() * (get_energy_WM(i, j));
+            pf_t r = buffer.rng.uniform() * (get_energy_WM(i, j));
 
             V_temp = get_energy_WM(i, j - 1) * expMLbase[1];
             qt = V_temp;
@@ -985,6 +1103,7 @@ void W_final_pf::Sample_WM(cand_pos_t i, cand_pos_t j, std::string &structure,
                 break;
             }
         } else {
+            V_temp = 0; // no unpaired share left to exclude from the paired cases
             break; // j can't be unpaired so it must be paired
         }
     }
@@ -996,10 +1115,10 @@ void W_final_pf::Sample_WM(cand_pos_t i, cand_pos_t j, std::string &structure,
 
     qt = 0.;
     pf_t qm_rem = get_energy_WM(i, j) - V_temp;
-    pf_t r = vrna_urn() * qm_rem;
+    pf_t r = buffer.rng.uniform() * qm_rem;
     for (k = i; k < j - TURN; ++k) {
         qbt1 = get_energy(k, j) * exp_MLstem(k, j);
-        qbt2 = get_energy_WMB(k, j) * expPSM_penalty * expb_penalty;
+        qbt2 = get_energy_WMB(k, j) * pk_exp_.PSM_penalty * pk_exp_.b_penalty;
         bool can_pair = cparty::part_func_can_pair::can_use_left_unpaired_span(tree.up, i, k);
         if (can_pair) {
 
@@ -1036,16 +1155,15 @@ void W_final_pf::Sample_WM(cand_pos_t i, cand_pos_t j, std::string &structure,
         exit(0);
     }
     if (!unpaired) {
-        Sample_WM(i, k - 1, structure, samples, tree);
+        Sample_WM(i, k - 1, structure, buffer, tree);
     }
     if (!pseudoknot) {
-        Sample_V(k, j, structure, samples, tree);
+        Sample_V(k, j, structure, buffer, tree);
     } else {
-        Sample_WMB(k, j, structure, samples, tree);
+        Sample_WMB(k, j, structure, buffer, tree);
     }
 }
-void W_final_pf::Sample_WMV(cand_pos_t i, cand_pos_t j, std::string &structure,
-                            std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_WMV(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("WMv at %d and %d\n", i, j);
     pf_t qt = 0;
 
@@ -1053,7 +1171,7 @@ void W_final_pf::Sample_WMV(cand_pos_t i, cand_pos_t j, std::string &structure,
 
     for (; j > i + TURN; --j) {
         if (tree.tree[j].pair < 0) { // Checking if j can be unpaired
-            pf_t r = vrna_urn() * get_energy_WMv(i, j);
+            pf_t r = buffer.rng.uniform() * get_energy_WMv(i, j);
 
             V_temp = get_energy_WMv(i, j - 1) * expMLbase[1];
             qt = V_temp;
@@ -1070,11 +1188,10 @@ void W_final_pf::Sample_WMV(cand_pos_t i, cand_pos_t j, std::string &structure,
         exit(0); /* error */
     }
 
-    Sample_V(i, j, structure, samples, tree);
+    Sample_V(i, j, structure, buffer, tree);
 }
 
-void W_final_pf::Sample_WMP(cand_pos_t i, cand_pos_t j, std::string &structure,
-                            std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_WMP(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("WMp at %d and %d\n", i, j);
     pf_t qt = 0;
 
@@ -1082,7 +1199,7 @@ void W_final_pf::Sample_WMP(cand_pos_t i, cand_pos_t j, std::string &structure,
 
     for (; j > i + TURN; --j) {
         if (tree.tree[j].pair < 0) { // Checking if j can be unpaired
-            pf_t r = vrna_urn() * get_energy_WMp(i, j);
+            pf_t r = buffer.rng.uniform() * get_energy_WMp(i, j);
 
             V_temp = get_energy_WMp(i, j - 1) * expMLbase[1];
             qt = V_temp;
@@ -1099,11 +1216,10 @@ void W_final_pf::Sample_WMP(cand_pos_t i, cand_pos_t j, std::string &structure,
         exit(0); /* error */
     }
 
-    Sample_WMB(i, j, structure, samples, tree);
+    Sample_WMB(i, j, structure, buffer, tree);
 }
 
-void W_final_pf::Sample_WMB(cand_pos_t i, cand_pos_t j, std::string &structure,
-                            std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_WMB(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("WMB at %d and %d\n", i, j);
     cand_pos_t l = j;
     pf_t qt = 0;
@@ -1112,7 +1228,7 @@ void W_final_pf::Sample_WMB(cand_pos_t i, cand_pos_t j, std::string &structure,
 
     pf_t V_temp = 0.;
 
-    pf_t r = vrna_urn() * get_energy_WMB(i, j);
+    pf_t r = buffer.rng.uniform() * get_energy_WMB(i, j);
 
     if (tree.tree[j].pair >= 0 && j > tree.tree[j].pair && tree.tree[j].pair > i) {
         bp_j = tree.tree[j].pair;
@@ -1120,7 +1236,7 @@ void W_final_pf::Sample_WMB(cand_pos_t i, cand_pos_t j, std::string &structure,
             // if(tree.tree[l].pair>0) continue;
             Bp_lj = tree.Bp(l, j);
             if (Bp_lj >= 0 && Bp_lj < n) {
-                V_temp = get_BE(bp_j, j, tree.tree[Bp_lj].pair, Bp_lj, tree) * get_energy_WMBP(i, l) * get_energy_WI(l + 1, Bp_lj - 1) * expPB_penalty;
+                V_temp = get_BE(bp_j, j, tree.tree[Bp_lj].pair, Bp_lj, tree) * get_energy_WMBP(i, l) * get_energy_WI(l + 1, Bp_lj - 1) * pk_exp_.PB_penalty;
                 qt += V_temp;
                 if (qt > r) {
                     break;
@@ -1129,9 +1245,9 @@ void W_final_pf::Sample_WMB(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (qt >= r) { // I could put this in the for loop then just do sample_WMBP if it doesn't sample in there
-        Sample_BE(bp_j, j, tree.tree[Bp_lj].pair, Bp_lj, structure, samples, tree);
-        Sample_WMBP(i, l, structure, samples, tree);
-        Sample_WI(l + 1, Bp_lj - 1, structure, samples, tree);
+        Sample_BE(bp_j, j, tree.tree[Bp_lj].pair, Bp_lj, structure, buffer, tree);
+        Sample_WMBP(i, l, structure, buffer, tree);
+        Sample_WI(l + 1, Bp_lj - 1, structure, buffer, tree);
 		return;
     }
     V_temp = get_energy_WMBP(i, j);
@@ -1140,11 +1256,10 @@ void W_final_pf::Sample_WMB(cand_pos_t i, cand_pos_t j, std::string &structure,
         printf("backtracking failed for WMB\n");
         exit(0); /* error */
     }
-    Sample_WMBP(i, j, structure, samples, tree);
+    Sample_WMBP(i, j, structure, buffer, tree);
 }
 
-void W_final_pf::Sample_WI(cand_pos_t i, cand_pos_t j, std::string &structure,
-                           std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_WI(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("WI at %d and %d\n", i, j);
     cand_pos_t k;
     pf_t qt = 0, qbt1 = 0, qbt2 = 0;
@@ -1154,7 +1269,7 @@ void W_final_pf::Sample_WI(cand_pos_t i, cand_pos_t j, std::string &structure,
     if (j > i) {
         for (; j > i + TURN; --j) {
             if (tree.tree[j].pair < 0) { // Checking if j can be unpaired
-                pf_t r = vrna_urn() * (get_energy_WI(i, j));
+                pf_t r = buffer.rng.uniform() * (get_energy_WI(i, j));
 
                 V_temp = get_energy_WI(i, j - 1) * expPUP_pen[1];
                 qt = V_temp;
@@ -1162,6 +1277,7 @@ void W_final_pf::Sample_WI(cand_pos_t i, cand_pos_t j, std::string &structure,
                     break;
                 }
             } else {
+                V_temp = 0; // no unpaired share left to exclude from the paired cases
                 break; // j can't be unpaired so it must be paired
             }
         }
@@ -1170,11 +1286,11 @@ void W_final_pf::Sample_WI(cand_pos_t i, cand_pos_t j, std::string &structure,
         qt = 0;
         pf_t qm_rem = get_energy_WI(i, j) - V_temp;
 
-        pf_t r = vrna_urn() * qm_rem;
+        pf_t r = buffer.rng.uniform() * qm_rem;
 
         for (k = i; k <= j - TURN - 1; k++) {
-            qbt1 = get_energy(k, j) * expPPS_penalty;
-            qbt2 = get_energy_WMB(k, j) * expPSP_penalty * expPPS_penalty;
+            qbt1 = get_energy(k, j) * pk_exp_.PPS_penalty;
+            qbt2 = get_energy_WMB(k, j) * pk_exp_.PSP_penalty * pk_exp_.PPS_penalty;
 
             V_temp = qbt1 * get_energy_WI(i, k - 1);
             qt += V_temp;
@@ -1188,17 +1304,16 @@ void W_final_pf::Sample_WI(cand_pos_t i, cand_pos_t j, std::string &structure,
             }
         }
 
-        Sample_WI(i, k - 1, structure, samples, tree);
+        Sample_WI(i, k - 1, structure, buffer, tree);
         if (!pseudoknot) {
-            Sample_V(k, j, structure, samples, tree);
+            Sample_V(k, j, structure, buffer, tree);
         } else {
-            Sample_WMB(k, j, structure, samples, tree);
+            Sample_WMB(k, j, structure, buffer, tree);
         }
     }
 }
 
-void W_final_pf::Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure,
-                            std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("WIP at %d and %d\n", i, j);
     cand_pos_t k;
     pf_t fbd = 0;
@@ -1210,7 +1325,7 @@ void W_final_pf::Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure,
     if (j <= i) return;
     for (; j > i + TURN; --j) {
         if (tree.tree[j].pair < 0) { // Checking if j can be unpaired
-            pf_t r = vrna_urn() * (get_energy_WIP(i, j) - fbd);
+            pf_t r = buffer.rng.uniform() * (get_energy_WIP(i, j) - fbd);
 
             V_temp = get_energy_WIP(i, j - 1) * expcp_pen[1];
             qt = V_temp;
@@ -1218,6 +1333,7 @@ void W_final_pf::Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure,
                 break;
             }
         } else {
+            V_temp = 0; // no unpaired share left to exclude from the paired cases
             break; // j can't be unpaired so it must be paired
         }
     }
@@ -1229,11 +1345,13 @@ void W_final_pf::Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure,
     qt = 0;
     pf_t qm_rem = get_energy_WIP(i, j) - V_temp;
 
-    pf_t r = vrna_urn() * (qm_rem - fbd);
+    pf_t r = buffer.rng.uniform() * (qm_rem - fbd);
 
-    for (k = i; k < j - TURN; ++k) {
-        qbt1 = get_energy(k, j) * expbp_penalty;
-        qbt2 = get_energy_WMB(k, j) * expbp_penalty * expPSM_penalty;
+    // same split points as compute_WIP: k = i closes i.j itself, the others stop at j-TURN-2
+    cand_pos_t max_k = std::max(i, j - TURN - 2);
+    for (k = i; k <= max_k; ++k) {
+        qbt1 = get_energy(k, j) * pk_exp_.bp_penalty;
+        qbt2 = get_energy_WMB(k, j) * pk_exp_.bp_penalty * pk_exp_.PSM_penalty;
 
         bool can_pair = cparty::part_func_can_pair::can_use_left_unpaired_span(tree.up, i, k);
         if (can_pair) {
@@ -1254,11 +1372,11 @@ void W_final_pf::Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
 
         if (k >= i) { // It had > but for me, it should be >=?
-            V_temp = qbt1 * get_energy_WM(i, k - 1);
+            V_temp = qbt1 * get_energy_WIP(i, k - 1);
             qt += V_temp;
             if (qt >= r) break;
 
-            V_temp = qbt2 * get_energy_WM(i, k - 1);
+            V_temp = qbt2 * get_energy_WIP(i, k - 1);
             qt += V_temp;
             if (qt >= r) {
                 pseudoknot = true;
@@ -1267,29 +1385,28 @@ void W_final_pf::Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
 
-    if (k + TURN >= j) {
+    if (k > max_k) {
         printf("backtracking failed for WIP right base pair with k=%d and j =%d, and qt=%f with r-%f\n", k, j, qt, r);
         exit(0);
     }
     if (!unpaired) {
-        Sample_WIP(i, k - 1, structure, samples, tree);
+        Sample_WIP(i, k - 1, structure, buffer, tree);
     }
     if (!pseudoknot) {
-        Sample_V(k, j, structure, samples, tree);
+        Sample_V(k, j, structure, buffer, tree);
     } else {
-        Sample_WMB(k, j, structure, samples, tree);
+        Sample_WMB(k, j, structure, buffer, tree);
     }
 }
 
-void W_final_pf::Sample_WMBW(cand_pos_t i, cand_pos_t j, std::string &structure,
-                             std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_WMBW(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("WMBW at %d and %d\n", i, j);
     cand_pos_t l = j;
     pf_t fbd = 0;
     pf_t qt = 0;
 
     pf_t V_temp = 0;
-    pf_t r = vrna_urn() * (get_energy_WMBW(i, j) - fbd);
+    pf_t r = buffer.rng.uniform() * (get_energy_WMBW(i, j) - fbd);
     if (tree.tree[j].pair < j) {
         for (l = i + 1; l < j; l++) {
             if (tree.tree[l].pair < 0 && tree.tree[l].parent->index > -1 && tree.tree[j].parent->index > -1
@@ -1306,13 +1423,12 @@ void W_final_pf::Sample_WMBW(cand_pos_t i, cand_pos_t j, std::string &structure,
         printf("Backtracking failed in WMBW for pair (%d,%d) with qt=%f < r=%f and l = %d\n", i, j, qt, r, l);
         exit(0);
     }
-    Sample_WMBP(i, l, structure, samples, tree);
-    Sample_WI(l + 1, j, structure, samples, tree);
+    Sample_WMBP(i, l, structure, buffer, tree);
+    Sample_WI(l + 1, j, structure, buffer, tree);
 	return;
 }
 
-void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
-                             std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("WMBP at %d and %d\n", i, j);
     cand_pos_t l = j;
     pf_t qt = 0;
@@ -1323,7 +1439,7 @@ void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
     bool case1 = false, case2 = false, case4 = false;
 
     pf_t V_temp = 0;
-    pf_t r = vrna_urn() * get_energy_WMBP(i, j);
+    pf_t r = buffer.rng.uniform() * get_energy_WMBP(i, j);
 
     if (tree.tree[j].pair < 0) {
         for (l = i + 1; l < j - TURN; ++l) {
@@ -1336,7 +1452,7 @@ void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
                     B_lj = tree.B(l, j);
                     if (i <= tree.tree[l].parent->index && tree.tree[l].parent->index < j && l + TURN <= j) {
                         V_temp = get_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, tree) * get_energy_WMBP(i, l - 1)
-                                 * get_energy_VP(l, j) * pow(expPB_penalty, 2);
+                                 * get_energy_VP(l, j) * expPB2_;
                         qt += V_temp;
                         if (qt >= r) {
                             case1 = true;
@@ -1348,9 +1464,9 @@ void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (case1) {
-        Sample_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, structure, samples, tree);
-        Sample_WMBP(i, l - 1, structure, samples, tree);
-        Sample_VP(l, j, structure, samples, tree);
+        Sample_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, structure, buffer, tree);
+        Sample_WMBP(i, l - 1, structure, buffer, tree);
+        Sample_VP(l, j, structure, buffer, tree);
         return;
     }
 
@@ -1365,7 +1481,7 @@ void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
                     B_lj = tree.B(l, j);
                     if (i <= tree.tree[l].parent->index && tree.tree[l].parent->index < j && l + TURN <= j) {
                         V_temp = get_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, tree) * get_energy_WMBW(i, l - 1)
-                                 * get_energy_VP(l, j) * pow(expPB_penalty, 2);
+                                 * get_energy_VP(l, j) * expPB2_;
                         qt += V_temp;
                         if (qt >= r) {
                             case2 = true;
@@ -1377,16 +1493,16 @@ void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (case2) {
-        Sample_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, structure, samples, tree);
-        Sample_WMBW(i, l - 1, structure, samples, tree);
-        Sample_VP(l, j, structure, samples, tree);
+        Sample_BE(tree.tree[B_lj].pair, B_lj, tree.tree[Bp_lj].pair, Bp_lj, structure, buffer, tree);
+        Sample_WMBW(i, l - 1, structure, buffer, tree);
+        Sample_VP(l, j, structure, buffer, tree);
         return;
     }
 
-    V_temp = get_energy_VP(i, j) * expPB_penalty;
+    V_temp = get_energy_VP(i, j) * pk_exp_.PB_penalty;
     qt += V_temp;
     if (qt >= r) {
-        Sample_VP(i, j, structure, samples, tree);
+        Sample_VP(i, j, structure, buffer, tree);
         return;
     }
 
@@ -1396,7 +1512,7 @@ void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
             if (bp_il >= 0 && bp_il < n && l + TURN <= j) {
                 if (i <= tree.tree[l].parent->index && tree.tree[l].parent->index < j && l + TURN <= j) {
                     V_temp = get_BE(i, tree.tree[i].pair, bp_il, tree.tree[bp_il].pair, tree) * get_energy_WI(bp_il + 1, l - 1) * get_energy_VP(l, j)
-                             * pow(expPB_penalty, 2);
+                             * expPB2_;
                     qt += V_temp;
                     if (qt >= r) {
                         case4 = true;
@@ -1407,9 +1523,9 @@ void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (case4) {
-        Sample_BE(i, tree.tree[i].pair, bp_il, tree.tree[bp_il].pair, structure, samples, tree);
-        Sample_WI(bp_il + 1, l - 1, structure, samples, tree);
-        Sample_VP(l, j, structure, samples, tree);
+        Sample_BE(i, tree.tree[i].pair, bp_il, tree.tree[bp_il].pair, structure, buffer, tree);
+        Sample_WI(bp_il + 1, l - 1, structure, buffer, tree);
+        Sample_VP(l, j, structure, buffer, tree);
 		return;
     } else {
         printf("backtracking failed for WMBP\n");
@@ -1417,8 +1533,7 @@ void W_final_pf::Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
     }
 }
 
-void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
-                           std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("VP at %d and %d\n", i, j);
     cand_pos_t k, l;
     pf_t qt = 0;
@@ -1426,12 +1541,7 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
     structure[j - 1] = ']';
 
     pf_t V_temp = 0;
-    pf_t r = vrna_urn() * get_energy_VP(i, j);
-
-    std::pair<cand_pos_tu, cand_pos_tu> base_pair(i, j);
-    std::pair<cand_pos_tu, cand_pos_tu> base_pair_reversed(j, i);
-    ++samples[base_pair]; // Increments the base pair found in VP
-    ++samples[base_pair_reversed];
+    pf_t r = buffer.rng.uniform() * get_energy_VP(i, j);
 
     cand_pos_t Bp_ij = tree.Bp(i, j);
     cand_pos_t B_ij = tree.B(i, j);
@@ -1443,8 +1553,8 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         V_temp *= scale[2];
         qt += V_temp;
         if (qt >= r) {
-            Sample_WI(i + 1, Bp_ij - 1, structure, samples, tree);
-            Sample_WI(B_ij + 1, j - 1, structure, samples, tree);
+            Sample_WI(i + 1, Bp_ij - 1, structure, buffer, tree);
+            Sample_WI(B_ij + 1, j - 1, structure, buffer, tree);
             return;
         }
     }
@@ -1453,8 +1563,8 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         V_temp *= scale[2];
         qt += V_temp;
         if (qt >= r) {
-            Sample_WI(i + 1, b_ij - 1, structure, samples, tree);
-            Sample_WI(bp_ij + 1, j - 1, structure, samples, tree);
+            Sample_WI(i + 1, b_ij - 1, structure, buffer, tree);
+            Sample_WI(bp_ij + 1, j - 1, structure, buffer, tree);
             return;
         }
     }
@@ -1463,9 +1573,9 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         V_temp *= scale[2];
         qt += V_temp;
         if (qt >= r) {
-            Sample_WI(i + 1, Bp_ij - 1, structure, samples, tree);
-            Sample_WI(B_ij + 1, b_ij - 1, structure, samples, tree);
-            Sample_WI(bp_ij + 1, j - 1, structure, samples, tree);
+            Sample_WI(i + 1, Bp_ij - 1, structure, buffer, tree);
+            Sample_WI(B_ij + 1, b_ij - 1, structure, buffer, tree);
+            Sample_WI(bp_ij + 1, j - 1, structure, buffer, tree);
             return;
         }
     }
@@ -1476,7 +1586,7 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         V_temp *= scale[2];
         qt += V_temp;
         if (qt >= r) {
-            Sample_VP(i + 1, j - 1, structure, samples, tree);
+            Sample_VP(i + 1, j - 1, structure, buffer, tree);
             return;
         }
     }
@@ -1484,6 +1594,7 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
     cand_pos_t min_borders = std::min((cand_pos_tu)Bp_ij, (cand_pos_tu)b_ij);
     cand_pos_t edge_i = std::min(i + MAXLOOP + 1, j - TURN - 1);
     min_borders = std::min(min_borders, edge_i);
+    const cparty::ExpClosingPair closing = pk_closing(i, j);
     for (k = i + 1; k < min_borders; ++k) {
         if (tree.tree[k].pair < -1 && cparty::part_func_can_pair::can_use_internal_left_unpaired_span(tree.up, i, k)) {
             cand_pos_t max_borders = std::max(bp_ij, B_ij) + 1;
@@ -1496,7 +1607,7 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
                     && cparty::part_func_can_pair::can_use_internal_right_unpaired_span(tree.up, l, j)) {
                     cand_pos_t u1 = k - i - 1;
                     cand_pos_t u2 = j - l - 1;
-                    V_temp = (get_e_intP(i, k, l, j) * get_energy_VP(k, l));
+                    V_temp = (get_e_intP(closing, i, k, l, j) * get_energy_VP(k, l));
                     V_temp *= scale[u1 + u2 + 2];
                     qt += V_temp;
                     if (qt >= r) {
@@ -1510,14 +1621,14 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (k < min_borders) {
-        Sample_VP(k, l, structure, samples, tree);
+        Sample_VP(k, l, structure, buffer, tree);
         return;
     }
 
     cand_pos_t min_Bp_j = std::min((cand_pos_tu)tree.b(i, j), (cand_pos_tu)tree.Bp(i, j));
     cand_pos_t max_i_bp = std::max(tree.B(i, j), tree.bp(i, j));
     for (k = i + 1; k < min_Bp_j; ++k) {
-        V_temp = (get_energy_WIP(i + 1, k - 1) * get_energy_VP(k, j - 1) * expap_penalty * pow(expbp_penalty, 2));
+        V_temp = (get_energy_WIP(i + 1, k - 1) * get_energy_VP(k, j - 1) * pk_exp_.ap_penalty * expbp2_);
         V_temp *= scale[2];
         qt += V_temp;
         if (qt > r) {
@@ -1525,13 +1636,13 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (k < min_Bp_j) {
-        Sample_WIP(i + 1, k - 1, structure, samples, tree);
-        Sample_VP(k, j - 1, structure, samples, tree);
+        Sample_WIP(i + 1, k - 1, structure, buffer, tree);
+        Sample_VP(k, j - 1, structure, buffer, tree);
 		return;
     }
 
     for (k = max_i_bp + 1; k < j; ++k) {
-        V_temp = (get_energy_VP(i + 1, k) * get_energy_WIP(k + 1, j - 1) * expap_penalty * pow(expbp_penalty, 2));
+        V_temp = (get_energy_VP(i + 1, k) * get_energy_WIP(k + 1, j - 1) * pk_exp_.ap_penalty * expbp2_);
         V_temp *= scale[2];
         qt += V_temp;
         if (qt > r) {
@@ -1539,13 +1650,13 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (k < j) {
-        Sample_VP(i + 1, k, structure, samples, tree);
-        Sample_WIP(k + 1, j - 1, structure, samples, tree);
+        Sample_VP(i + 1, k, structure, buffer, tree);
+        Sample_WIP(k + 1, j - 1, structure, buffer, tree);
         return;
     }
 
     for (k = i + 1; k < min_Bp_j; ++k) {
-        V_temp = (get_energy_WIP(i + 1, k - 1) * get_energy_VPR(k, j - 1) * expap_penalty * pow(expbp_penalty, 2));
+        V_temp = (get_energy_WIP(i + 1, k - 1) * get_energy_VPR(k, j - 1) * pk_exp_.ap_penalty * expbp2_);
         V_temp *= scale[2];
         qt += V_temp;
         if (qt > r) {
@@ -1553,13 +1664,13 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (k < min_Bp_j) {
-        Sample_WIP(i + 1, k - 1, structure, samples, tree);
-        Sample_VPR(k, j - 1, structure, samples, tree);
+        Sample_WIP(i + 1, k - 1, structure, buffer, tree);
+        Sample_VPR(k, j - 1, structure, buffer, tree);
         return;
     }
 
     for (k = max_i_bp + 1; k < j; ++k) {
-        V_temp = (get_energy_VPL(i + 1, k) * get_energy_WIP(k + 1, j - 1) * expap_penalty * pow(expbp_penalty, 2));
+        V_temp = (get_energy_VPL(i + 1, k) * get_energy_WIP(k + 1, j - 1) * pk_exp_.ap_penalty * expbp2_);
         V_temp *= scale[2];
         qt += V_temp;
         if (qt > r) {
@@ -1567,21 +1678,20 @@ void W_final_pf::Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (k < j) {
-        Sample_VPL(i + 1, k, structure, samples, tree);
-        Sample_WIP(k + 1, j - 1, structure, samples, tree);
+        Sample_VPL(i + 1, k, structure, buffer, tree);
+        Sample_WIP(k + 1, j - 1, structure, buffer, tree);
         return;
     }
 }
 
-void W_final_pf::Sample_VPL(cand_pos_t i, cand_pos_t j, std::string &structure,
-                            std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_VPL(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("VPL at %d and %d\n", i, j);
     cand_pos_t k;
     pf_t fbd = 0;
     pf_t qt = 0;
 
     pf_t V_temp = 0;
-    pf_t r = vrna_urn() * (get_energy_VPL(i, j) - fbd);
+    pf_t r = buffer.rng.uniform() * (get_energy_VPL(i, j) - fbd);
     cand_pos_t min_Bp_j = std::min((cand_pos_tu)tree.b(i, j), (cand_pos_tu)tree.Bp(i, j));
     for (k = i + 1; k < min_Bp_j; ++k) {
         bool can_pair = cparty::part_func_can_pair::can_use_left_unpaired_span(tree.up, i, k);
@@ -1594,15 +1704,14 @@ void W_final_pf::Sample_VPL(cand_pos_t i, cand_pos_t j, std::string &structure,
         }
     }
     if (k < min_Bp_j) {
-        Sample_VP(k, j, structure, samples, tree);
+        Sample_VP(k, j, structure, buffer, tree);
     } else {
         printf("Backtracking error in VPL\n");
         exit(0);
     }
 }
 
-void W_final_pf::Sample_VPR(cand_pos_t i, cand_pos_t j, std::string &structure,
-                            std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_VPR(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     if (debug) printf("VPR at %d and %d\n", i, j);
     cand_pos_t k;
     pf_t fbd = 0;
@@ -1610,18 +1719,18 @@ void W_final_pf::Sample_VPR(cand_pos_t i, cand_pos_t j, std::string &structure,
     bool unpaired = false;
 
     pf_t V_temp = 0;
-    pf_t r = vrna_urn() * (get_energy_VPR(i, j) - fbd);
+    pf_t r = buffer.rng.uniform() * (get_energy_VPR(i, j) - fbd);
 
     cand_pos_t max_i_bp = std::max(tree.B(i, j), tree.bp(i, j));
     for (k = max_i_bp + 1; k < j; ++k) {
-        bool can_pair = cparty::part_func_can_pair::can_use_right_unpaired_span(tree.up, k, j);
+        bool can_pair = cparty::part_func_can_pair::can_use_right_unpaired_tail(tree.up, k, j);
         V_temp = (get_energy_VP(i, k) * get_energy_WIP(k + 1, j));
         qt += V_temp;
         if (qt >= r) {
             break;
         }
         if (can_pair) {
-            V_temp = (get_energy_VP(i, k) * expcp_pen[k - i]);
+            V_temp = (get_energy_VP(i, k) * expcp_pen[j - k]);
             qt += V_temp;
             if (qt >= r) {
                 unpaired = true;
@@ -1635,13 +1744,12 @@ void W_final_pf::Sample_VPR(cand_pos_t i, cand_pos_t j, std::string &structure,
     }
 
     if (!unpaired) {
-        Sample_WIP(k + 1, j, structure, samples, tree);
+        Sample_WIP(k + 1, j, structure, buffer, tree);
     }
-    Sample_VP(i, k, structure, samples, tree);
+    Sample_VP(i, k, structure, buffer, tree);
 }
 
-void W_final_pf::Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, std::string &structure,
-                           std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, std::string &structure, SampleBuffer &buffer, sparse_tree &tree) {
     
 	if (debug) printf("BE at %d and %d, and %d and %d\n", i, j, ip, jp);
 
@@ -1663,23 +1771,18 @@ void W_final_pf::Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t
     bool unpaired_right = false;
     structure[i - 1] = '(';
     structure[j - 1] = ')';
-    std::pair<cand_pos_tu, cand_pos_tu> base_pair(i, j);
-    std::pair<cand_pos_tu, cand_pos_tu> base_pair_reversed(j, i);
-    ++samples[base_pair]; // Increments the base pair found in BE
-    ++samples[base_pair_reversed];
-
     pf_t V_temp = 0;
-    pf_t r = vrna_urn() * get_BE(i, j, ip, jp, tree);
+    pf_t r = buffer.rng.uniform() * get_BE(i, j, ip, jp, tree);
 
     if (i == ip && j == jp && i < j) {
         return;
     }
 
     if (tree.tree[i + 1].pair == j - 1) {
-        Sample_BE(i + 1, j - 1, ip, jp, structure, samples, tree);
+        Sample_BE(i + 1, j - 1, ip, jp, structure, buffer, tree);
         return;
     }
-    pf_t expbp2 = pow(expbp_penalty, 2);
+    const cparty::ExpClosingPair closing = pk_closing(i, j);
     for (l = i + 1; l <= ip; l++) {
         if (tree.tree[l].pair >= -1 && jp <= tree.tree[l].pair && tree.tree[l].pair < j) {
             lp = tree.tree[l].pair;
@@ -1691,7 +1794,7 @@ void W_final_pf::Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t
             if (empty_region_il && empty_region_lpj) {
                 cand_pos_t u1 = l - i - 1;
                 cand_pos_t u2 = j - lp - 1;
-                V_temp = get_e_intP(i, l, lp, j) * get_BE(l, lp, ip, jp, tree);
+                V_temp = get_e_intP(closing, i, l, lp, j) * get_BE(l, lp, ip, jp, tree);
                 V_temp *= scale[u1 + u2 + 2];
                 qt += V_temp; // Added to e_intP that l != i+1 and lp != j-1 at the same time
                 if (qt >= r) {
@@ -1701,7 +1804,7 @@ void W_final_pf::Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t
                 }
             }
             if (weakly_closed_il && weakly_closed_lpj) {
-                V_temp = get_energy_WIP(i + 1, l - 1) * get_BE(l, lp, ip, jp, tree) * get_energy_WIP(lp + 1, j - 1) * expap_penalty * expbp2;
+                V_temp = get_energy_WIP(i + 1, l - 1) * get_BE(l, lp, ip, jp, tree) * get_energy_WIP(lp + 1, j - 1) * pk_exp_.ap_penalty * expbp2_;
                 V_temp *= scale[2];
                 qt += V_temp;
                 if (qt >= r) {
@@ -1709,7 +1812,7 @@ void W_final_pf::Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t
                 }
             }
             if (weakly_closed_il && empty_region_lpj) {
-                V_temp = get_energy_WIP(i + 1, l - 1) * get_BE(l, lp, ip, jp, tree) * expcp_pen[j - lp - 1] * expap_penalty * expbp2;
+                V_temp = get_energy_WIP(i + 1, l - 1) * get_BE(l, lp, ip, jp, tree) * expcp_pen[j - lp - 1] * pk_exp_.ap_penalty * expbp2_;
                 V_temp *= scale[2];
                 qt += V_temp;
                 if (qt >= r) {
@@ -1718,7 +1821,7 @@ void W_final_pf::Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t
                 }
             }
             if (empty_region_il && weakly_closed_lpj) {
-                V_temp = expcp_pen[l - i - 1] * get_BE(l, lp, ip, jp, tree) * get_energy_WIP(lp + 1, j - 1) * expap_penalty * expbp2;
+                V_temp = expcp_pen[l - i - 1] * get_BE(l, lp, ip, jp, tree) * get_energy_WIP(lp + 1, j - 1) * pk_exp_.ap_penalty * expbp2_;
                 V_temp *= scale[2];
                 qt += V_temp;
                 if (qt >= r) {
@@ -1734,12 +1837,12 @@ void W_final_pf::Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t
     }
 
     if (!unpaired_left) {
-        Sample_WIP(i + 1, l - 1, structure, samples, tree);
+        Sample_WIP(i + 1, l - 1, structure, buffer, tree);
     }
     if (!unpaired_right) {
-        Sample_WIP(lp + 1, j - 1, structure, samples, tree);
+        Sample_WIP(lp + 1, j - 1, structure, buffer, tree);
     }
-    Sample_BE(l, lp, ip, jp, structure, samples, tree);
+    Sample_BE(l, lp, ip, jp, structure, buffer, tree);
 }
 
 char W_final_pf::bpp_symbol(pf_t *P) {
@@ -1767,21 +1870,19 @@ char W_final_pf::bpp_symbol(pf_t *P) {
     
     // return ':';
 }
-void W_final_pf::pairing_tendency(std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree) {
+void W_final_pf::pairing_tendency(sparse_tree &tree) {
 
     for (cand_pos_t j = 1; j <= n; j++) {
         pf_t P[5] = {1, 0, 0, 0, 0}; // unpaired, PK-free left, PK-free right, PK left, PK right
-        for (cand_pos_t i = 1; i < j; i++) {
+        for (cand_pos_t i = std::max<cand_pos_t>(1, j - max_span); i < j; i++) {
             bool weakly_closed_ij = tree.weakly_closed(i, j);
-            std::pair<cand_pos_tu, cand_pos_tu> base_pair(i, j);
-            pf_t probability_ij = (pf_t)samples[base_pair] / num_samples;
+            pf_t probability_ij = get_probability(i, j);
             if(weakly_closed_ij) P[2] += probability_ij; else P[4] += probability_ij;
             P[0] -= probability_ij;
         }
-        for (cand_pos_t i = j + 1; i <= n; i++) {
+        for (cand_pos_t i = j + 1; i <= std::min<cand_pos_t>(n, j + max_span); i++) {
             bool weakly_closed_ji = tree.weakly_closed(j, i);
-            std::pair<cand_pos_tu, cand_pos_tu> base_pair(j, i);
-            pf_t probability_ji = (pf_t)samples[base_pair] / num_samples;
+            pf_t probability_ji = get_probability(j, i);
             if(weakly_closed_ji) P[1] += probability_ji; else P[3] += probability_ji;
             P[0] -= probability_ji;
         }
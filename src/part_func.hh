@@ -1,8 +1,13 @@
 #ifndef PART_FUNC
 #define PART_FUNC
 #include "base_types.hh"
+#include "counter_rng.hh"
+#include "sequence_context.hh"
 #include "sparse_tree.hh"
+#include <algorithm>
 #include <cstring>
+#include <memory>
+#include <ostream>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -14,14 +19,20 @@ extern "C" {
 #include "ViennaRNA/params/io.h"
 }
 
-struct SzudzikHash {
-    cand_pos_t operator()(const std::pair<cand_pos_t, cand_pos_t> pair) const {
-        cand_pos_t a = pair.first;
-        cand_pos_t b = pair.second;
-        return (a >= b) ? (a * a + a + b) : (b * b + a);
-    }
+// State of one stochastic backtracking worker: the random stream of the current draw and the structures it adds to.
+// Each worker fills its own buffer; the buffers are summed once all draws are done.
+struct SampleBuffer {
+    cparty::CounterRng rng;
+    std::unordered_map<std::string, int> structures;
 };
 
+// A stand-in for the MFE of a sequence of n nucleotides where none was folded; it only picks the Boltzmann scale,
+// and hfold_pf_energy rescales when the guess is too low. ViennaRNA uses the same -0.185 kcal/mol per nucleotide.
+inline double guess_mfe(cand_pos_t n) { return -0.185 * n; }
+
+// Turns the pseudoknot penalties of h_globals.hh into their Boltzmann factors for the given model
+cparty::PkBoltzmannFactors scale_pk_penalties(const vrna_exp_param_t *exp_params);
+
 inline cand_pos_t boustrophedon_at(cand_pos_t start, cand_pos_t end, cand_pos_t pos);
 std::vector<cand_pos_t> boustrophedon(cand_pos_t start, cand_pos_t end);
 
@@ -36,86 +47,113 @@ class W_final_pf {
     pf_t ensemble_diversity;
     std::unordered_map<std::string, int> structures;
 
-    W_final_pf(std::string &seq, std::string &MFE_structure, bool pk_free, bool pk_only, bool fatgraph, int dangle, double energy, int num_samples, bool PSplot);
-    // constructor for the restricted mfe case
+    W_final_pf(std::string &seq, std::string &MFE_structure, bool pk_free, bool pk_only, bool fatgraph, int dangle, double energy, int num_samples, bool PSplot,
+               int threads = 1, uint64_t seed = 0, cand_pos_t max_span = 0, cand_pos_t window_size = 0);
+    // constructor for the restricted mfe case; threads > 1 fills the matrices as a parallel wavefront (0 = all cores)
+    // and spreads the stochastic backtracking over as many workers; seed selects the random streams of the samples.
+    // max_span > 0 sums only over structures whose base pairs span at most max_span, in banded n x (max_span+1) matrices.
+    // window_size > 0 sets up scan_windows instead: the matrices keep the rows of one window only
+
+    W_final_pf(std::shared_ptr<const cparty::SequenceContext> context, std::string &MFE_structure, bool pk_free, bool pk_only, bool fatgraph,
+               double energy, int num_samples, bool PSplot, int threads = 1, uint64_t seed = 0, cand_pos_t max_span = 0,
+               cand_pos_t window_size = 0);
+    // the same, reusing the encoded sequence, parameters and loop tables that context holds for all folds of its sequence
 
     ~W_final_pf();
     // The destructor
 
     pf_t hfold_pf(sparse_tree &tree);
 
+    // The ensemble energy of hfold_pf alone: the inside fill and the exterior W, without the outside pass, the samples,
+    // the pairing tendency and the dot plot
+    pf_t hfold_pf_energy(sparse_tree &tree);
+
     pf_t hfold_MEA(sparse_tree &tree);
 
     pf_t hfold_centroid(sparse_tree &tree);
 
+    // RNAplfold-style scan: the pair probabilities of every window of window_size nucleotides, averaged over the windows
+    // holding each pair. A window folds its nucleotides alone; a restricted pair leaving it leaves its inner end to the
+    // window's exterior loop. A cell lies in the same place of every window holding it, so each is filled once as the
+    // window slides, and once the last window holding position i is done its pairs i.j with probability >= cutoff are
+    // written to out as "i j p" lines and its row is reused.
+    void scan_windows(sparse_tree &tree, pf_t cutoff, std::ostream &out);
+
     vrna_exp_param_t *exp_params_;
 
     pf_t get_energy(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
-        return V[ij];
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
+        return stems[ij].V;
     }
     pf_t get_energy_VM(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return VM[ij];
     }
     pf_t get_energy_WM(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return WM[ij];
     }
     pf_t get_energy_WMv(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
-        return WMv[ij];
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
+        return branches[ij].WMv;
     }
     pf_t get_energy_WMp(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
-        return WMp[ij];
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
+        return branches[ij].WMp;
     }
 
     pf_t get_energy_WI(cand_pos_t i, cand_pos_t j) {
         if (i > j) return 1;
-        cand_pos_t ij = index[i] + j - i;
+        if (j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return WI[ij];
     }
     pf_t get_energy_WIP(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return WIP[ij];
     }
     pf_t get_energy_VP(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return VP[ij];
     }
     pf_t get_energy_VPL(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return VPL[ij];
     }
     pf_t get_energy_VPR(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return VPR[ij];
     }
     pf_t get_energy_WMB(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
-        return WMB[ij];
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
+        return stems[ij].WMB;
     }
     pf_t get_energy_WMBP(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return WMBP[ij];
     }
     pf_t get_energy_WMBW(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return 0;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return 0;
+        cand_idx_t ij = index[i] + j - i;
         return WMBW[ij];
     }
+    // probability of the base pair i.j (i < j) from the outside pass of hfold_pf
+    pf_t get_probability(cand_pos_t i, cand_pos_t j) {
+        if (i >= j || j - i > max_span || probs.empty()) return 0;
+        cand_idx_t ij = index[i] + j - i;
+        return probs[ij];
+    }
     pf_t get_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, sparse_tree &tree) {
         // Hosna, March 16, 2012,
         // i and j should be at least 3 bases apart
@@ -125,7 +163,7 @@ class W_final_pf {
             // if(i == ip && j == jp && i<j){
             //     return 1;
             // }
-            cand_pos_t iip = index[i] + ip - i;
+            cand_idx_t iip = index[i] + ip - i;
 
             return BE[iip];
         } else {
@@ -140,16 +178,42 @@ class W_final_pf {
     bool pk_only;
     bool fatgraph;
     bool PSplot;
+    int threads;
+    uint64_t seed;
     cand_pos_t n;
-    std::vector<cand_pos_t> index;
-
+    cand_pos_t max_span;     // the longest base pair span considered, n for a global fold
+    cand_idx_t total_length; // number of cells of each matrix
+    cand_pos_t window_size;  // the rows kept by a scan_windows fold, 0 when every row is
+    std::vector<cand_idx_t> index;
+    std::vector<cand_idx_t> column_index; // the index of the column copies, that of the matrices for the mirrored sequence
+
+    std::shared_ptr<const cparty::SequenceContext> context_;
+    cparty::PkBoltzmannFactors pk_exp_;
+    const cparty::ExpInteriorLoops &exp_loops_;
+    // The pseudoknotted loops of this fold: the interior loops weigh the factors of exp_loops_ raised to e_intP_penalty
+    // and the stacks expstack raised to e_stP_penalty, and the band penalties enter squared
+    cparty::ExpInteriorLoops pk_int_loops_;
+    pf_t pk_stack_[NBPAIRS + 1][NBPAIRS + 1];
+    pf_t expbp2_;
+    pf_t expPB2_;
+    double pf_scale;
     short *S_;
     short *S1_;
 
-    std::vector<pf_t> V;
+    // The matrices whose cells are read at the same (i,j) are stored interleaved, so a getter loads one cache line
+    // for both of them
+    struct StemCell {
+        pf_t V = 0;
+        pf_t WMB = 0; // the main loop for pseudoloops and bands
+    };
+    struct BranchCell {
+        pf_t WMv = 0;
+        pf_t WMp = 0;
+    };
+
+    std::vector<StemCell> stems;      // V and WMB, the two stems of every WM, WI and WIP split
     std::vector<pf_t> VM;
-    std::vector<pf_t> WMv;
-    std::vector<pf_t> WMp;
+    std::vector<BranchCell> branches; // WMv and WMp, the two branches of the VM split
     std::vector<pf_t> WM;
     std::vector<pf_t> W;
 
@@ -157,41 +221,82 @@ class W_final_pf {
     std::vector<pf_t> VP;   // the loop corresponding to the pseudoknotted region of WMB
     std::vector<pf_t> VPL;  // the loop corresponding to the pseudoknotted region of WMB
     std::vector<pf_t> VPR;  // the loop corresponding to the pseudoknotted region of WMB
-    std::vector<pf_t> WMB;  // the main loop for pseudoloops and bands
     std::vector<pf_t> WMBP; // the main loop to calculate WMB
     std::vector<pf_t> WMBW;
     std::vector<pf_t> WIP; // the loop corresponding to WI'
     std::vector<pf_t> BE;  // the loop corresponding to BE
 
+    // Column copies of the operands the splits of (i,j) read down column j, with k ascending in each column, so that a
+    // split is a sum_product of a row and a column. The stem columns hold the terms of V(k,j) and WMB(k,j) that the
+    // WM, WI and WIP splits multiply with their row, formed once per cell instead of once per split.
+    std::vector<pf_t> WM_stems_by_column;  // V exp_MLstem + WMB PSM b
+    std::vector<pf_t> WI_stems_by_column;  // V PPS + WMB PSP PPS
+    std::vector<pf_t> WIP_stems_by_column; // V bp + WMB bp PSM
+    std::vector<pf_t> branches_by_column;  // WMv + WMp, for VM
+    std::vector<pf_t> WMp_by_column;       // for VM
+    std::vector<pf_t> WIP_by_column;       // for VPR
+    std::vector<pf_t> WMBW_WI_by_column;   // WI(k,j) when k-1 is unpaired and in the loop of j, 0 otherwise, for WMBW
+
+    // the place of (k,j) in a column copy: column j of the band is the row n+1-j of the mirrored sequence
+    cand_idx_t column_cell(cand_pos_t k, cand_pos_t j) const { return column_index[n + 1 - j] + std::min(max_span, j - 1) - (j - k); }
+
     std::vector<pf_t> scale;
     std::vector<pf_t> expMLbase;
     std::vector<pf_t> expcp_pen;
+    std::vector<pf_t> expcp_pen_reversed; // expcp_pen[n-t] at t, for the tails of VPR read with k ascending
     std::vector<pf_t> expPUP_pen;
 
-    std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> samples;
+    /**           Outside         */
+    // outside ("hat") counterparts of the matrices above; only alive between compute_outside and compute_probabilities
+    std::vector<pf_t> W_hat;
+    std::vector<pf_t> V_hat;
+    std::vector<pf_t> VM_hat;
+    std::vector<pf_t> WM_hat;
+    std::vector<pf_t> WMv_hat;
+    std::vector<pf_t> WMp_hat;
+    std::vector<pf_t> WI_hat;
+    std::vector<pf_t> WIP_hat;
+    std::vector<pf_t> VP_hat;
+    std::vector<pf_t> VPL_hat;
+    std::vector<pf_t> VPR_hat;
+    std::vector<pf_t> WMB_hat;
+    std::vector<pf_t> WMBP_hat;
+    std::vector<pf_t> WMBW_hat;
+    std::vector<pf_t> BE_hat;
 
     /**           MEA            */
-    // std::vector<pf_t> probs;
+    std::vector<pf_t> probs; // base pair probabilities, addressed like the matrices
 
     double to_Energy(pf_t energy, cand_pos_t length);
-    void rescale_pk_globals();
 
     void exp_params_rescale(double mfe);
 
+    void set_pf_scale(double pf_scale);
+
     void run_partition_dp(sparse_tree &tree);
 
-    void run_partition_exterior(sparse_tree &tree);
+    void fill_cell(cand_pos_t i, cand_pos_t j, sparse_tree &tree, bool wavefront);
+
+    void run_partition_exterior(sparse_tree &ext_tree, cand_pos_t start, cand_pos_t end);
 
     void finalize_partition_outputs(sparse_tree &tree);
 
+    void clear_row(cand_pos_t i);
+
     void compute_energy_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
 
     void compute_WMv_WMp(cand_pos_t i, cand_pos_t j, std::vector<Node> &tree);
 
     void compute_energy_WM_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
 
+    void store_stem_columns(cand_pos_t i, cand_pos_t j);
+
     void compute_pk_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
 
+    void compute_pk_cell_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void compute_pk_band_energies(cand_pos_t i, sparse_tree &tree);
+
     void compute_WI(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
 
     void compute_WIP(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
@@ -222,63 +327,92 @@ class W_final_pf {
 
     pf_t compute_energy_VM_restricted(cand_pos_t i, cand_pos_t j, std::vector<int> &up);
 
-    pf_t compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l);
-
     pf_t get_e_stP(cand_pos_t i, cand_pos_t j);
 
-    pf_t get_e_intP(cand_pos_t i, cand_pos_t ip, cand_pos_t jp, cand_pos_t j);
+    // the terms of (i,j) as the closing pair of pseudoknotted interior loops, for get_e_intP
+    cparty::ExpClosingPair pk_closing(cand_pos_t i, cand_pos_t j);
+
+    pf_t get_e_intP(const cparty::ExpClosingPair &closing, cand_pos_t i, cand_pos_t ip, cand_pos_t jp, cand_pos_t j);
 
     int compute_exterior_cases(cand_pos_t l, cand_pos_t j, sparse_tree &tree);
 
+    /*                        Outside                                       */
+    void compute_outside(sparse_tree &tree, sparse_tree &ext_tree, cand_pos_t start, cand_pos_t end);
+
+    void compute_probabilities(sparse_tree &tree, cand_pos_t start, cand_pos_t end);
+
+    void add_outside(std::vector<pf_t> &hat, cand_pos_t i, cand_pos_t j, pf_t value);
+
+    void add_outside_WI(cand_pos_t i, cand_pos_t j, pf_t value);
+
+    void add_outside_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, sparse_tree &tree, pf_t value);
+
+    void outside_exterior(sparse_tree &ext_tree, cand_pos_t start, cand_pos_t end);
+
+    void outside_cell(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_energy_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_VM(cand_pos_t i, cand_pos_t j, std::vector<int> &up);
+
+    void outside_WMv_WMp(cand_pos_t i, cand_pos_t j, std::vector<Node> &tree);
+
+    void outside_WM(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_pk_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_WI(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_WIP(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_VPL(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_VPR(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_WMBW(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_WMB(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
+    void outside_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, sparse_tree &tree);
+
     /*                        BPP                                           */
     char bpp_symbol(pf_t *P);
 
-    void pairing_tendency(std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void pairing_tendency(sparse_tree &tree);
 
-    void Sample_W(cand_pos_t start, cand_pos_t end, std::string &structure,
-                  std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_W(cand_pos_t start, cand_pos_t end, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure,
-                  std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_V(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_VM(cand_pos_t i, cand_pos_t j, std::string &structure,
-                   std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_VM(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_WM(cand_pos_t i, cand_pos_t j, std::string &structure,
-                   std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_WM(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_WMV(cand_pos_t i, cand_pos_t j, std::string &structure,
-                    std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_WMV(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_WMP(cand_pos_t i, cand_pos_t j, std::string &structure,
-                    std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_WMP(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_WMB(cand_pos_t i, cand_pos_t j, std::string &structure,
-                    std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_WMB(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_WMBW(cand_pos_t i, cand_pos_t j, std::string &structure,
-                     std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_WMBW(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure,
-                     std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_WMBP(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_WI(cand_pos_t i, cand_pos_t j, std::string &structure,
-                   std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_WI(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure,
-                    std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_WIP(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure,
-                   std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_VP(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_VPL(cand_pos_t i, cand_pos_t j, std::string &structure,
-                    std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_VPL(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_VPR(cand_pos_t i, cand_pos_t j, std::string &structure,
-                    std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_VPR(cand_pos_t i, cand_pos_t j, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
-    void Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, std::string &structure,
-                   std::unordered_map<std::pair<cand_pos_t, cand_pos_t>, cand_pos_t, SzudzikHash> &samples, sparse_tree &tree);
+    void Sample_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, std::string &structure, SampleBuffer &buffer, sparse_tree &tree);
 
     /**                                                     MEA                                                             */
     pf_t compute_MEA(sparse_tree &tree, double gamma);
@@ -12,6 +12,11 @@ bool can_use_right_unpaired_span(const std::vector<int> &up, cand_pos_t k, cand_
     return cparty::can_pair_policy::is_tree_up_pairable(up[j - 1], j - k);
 }
 
+// k+1..j are unpaired, as behind the right end k of a VP in VPR
+bool can_use_right_unpaired_tail(const std::vector<int> &up, cand_pos_t k, cand_pos_t j) {
+    return cparty::can_pair_policy::is_tree_up_pairable(up[j], j - k);
+}
+
 bool can_use_hairpin_unpaired_span(const std::vector<int> &up, cand_pos_t i, cand_pos_t j) {
     return cparty::can_pair_policy::is_tree_up_pairable(up[j - 1], j - i - 1);
 }
@@ -24,6 +29,30 @@ bool can_use_internal_right_unpaired_span(const std::vector<int> &up, cand_pos_t
     return cparty::can_pair_policy::is_tree_up_pairable(up[j - 1], j - l - 1);
 }
 
+cand_pos_t last_left_unpaired_span(const std::vector<int> &up, cand_pos_t i, cand_pos_t first, cand_pos_t last) {
+    cand_pos_t low = first - 1, high = last; // the answer lies in low..high
+    while (low < high) {
+        const cand_pos_t mid = high - (high - low) / 2;
+        if (can_use_left_unpaired_span(up, i, mid))
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+cand_pos_t first_right_unpaired_tail(const std::vector<int> &up, cand_pos_t first, cand_pos_t last, cand_pos_t j) {
+    cand_pos_t low = first, high = last + 1; // the answer lies in low..high
+    while (low < high) {
+        const cand_pos_t mid = low + (high - low) / 2;
+        if (can_use_right_unpaired_tail(up, mid, j))
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return low;
+}
+
 bool can_form_allowed_pair(const std::string &seq, cand_pos_t left, cand_pos_t right) {
     if (left < 1 || right < 1) {
         return false;
@@ -10,11 +10,18 @@ namespace part_func_can_pair {
 
 bool can_use_left_unpaired_span(const std::vector<int> &up, cand_pos_t i, cand_pos_t k);
 bool can_use_right_unpaired_span(const std::vector<int> &up, cand_pos_t k, cand_pos_t j);
+bool can_use_right_unpaired_tail(const std::vector<int> &up, cand_pos_t k, cand_pos_t j);
 bool can_use_hairpin_unpaired_span(const std::vector<int> &up, cand_pos_t i, cand_pos_t j);
 bool can_use_internal_left_unpaired_span(const std::vector<int> &up, cand_pos_t i, cand_pos_t k);
 bool can_use_internal_right_unpaired_span(const std::vector<int> &up, cand_pos_t l, cand_pos_t j);
 bool can_form_allowed_pair(const std::string &seq, cand_pos_t left, cand_pos_t right);
 
+// The last k of first..last with can_use_left_unpaired_span(up, i, k), first-1 if there is none. Those k are a prefix of
+// first..last, as i..k-1 only grows with k, so the splits of a loop can take them as one run.
+cand_pos_t last_left_unpaired_span(const std::vector<int> &up, cand_pos_t i, cand_pos_t first, cand_pos_t last);
+// The first k of first..last with can_use_right_unpaired_tail(up, k, j), last+1 if there is none; those k are a suffix
+cand_pos_t first_right_unpaired_tail(const std::vector<int> &up, cand_pos_t first, cand_pos_t last, cand_pos_t j);
+
 } // namespace part_func_can_pair
 } // namespace cparty
 
@@ -1,21 +0,0 @@
-#ifndef PF_GLOBALS
-#define PF_GLOBALS
-
-double expPS_penalty;
-double expPSM_penalty;
-double expPSP_penalty;
-double expPB_penalty;
-double expPUP_penalty;
-double expPPS_penalty;
-
-double expa_penalty;
-double expb_penalty;
-double expc_penalty;
-
-double expap_penalty;
-double expbp_penalty;
-double expcp_penalty;
-
-double expstart_hybrid_penalty;
-
-#endif
\ No newline at end of file
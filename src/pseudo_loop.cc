@@ -1,6 +1,9 @@
 #include "pseudo_loop.hh"
+#include "matrix_index.hh"
 #include "pseudo_loop_can_pair.hh"
+#include "simd_kernels.hh"
 #include "h_externs.hh"
+#include "vienna_state.hh"
 #include <algorithm>
 #include <iostream>
 #include <math.h>
@@ -8,25 +11,24 @@
 #include <stdlib.h>
 #include <string>
 
-pseudo_loop::pseudo_loop(std::string seq, std::string res, s_energy_matrix *V, short *S, short *S1, vrna_param_t *params) {
+pseudo_loop::pseudo_loop(std::string seq, std::string res, s_energy_matrix *V, short *S, short *S1, vrna_param_t *params,
+                         const cparty::InteriorLoops &interior_loops, cand_pos_t max_span) {
     this->seq = seq;
+    this->max_span = cparty::span_limit(seq.length(), max_span);
     this->res = res;
     this->V = V;
     S_ = S;
     S1_ = S1;
     params_ = params;
-    make_pair_matrix();
+    interior_loops_ = &interior_loops;
+    cparty::vienna::make_pair_matrix_once();
     allocate_space();
 }
 
 void pseudo_loop::allocate_space() {
     n = seq.length();
 
-    index.resize(n + 1);
-    cand_pos_t total_length = ((n + 1) * (n + 2)) / 2;
-    index[1] = 0;
-    for (cand_pos_t i = 2; i <= n; i++)
-        index[i] = index[i - 1] + (n + 1) - i + 1;
+    cand_idx_t total_length = cparty::make_matrix_index(n, max_span, index);
 
     WI.resize(total_length, 0);
 
@@ -45,6 +47,21 @@ void pseudo_loop::allocate_space() {
     WIP.resize(total_length, INF);
 
     BE.resize(total_length, 0);
+
+    // column j of the band is the row n+1-j of the mirrored sequence, which has as many cells
+    cparty::make_matrix_index(n, max_span, column_index);
+    VP_by_column.resize(total_length, INF);
+    VPR_by_column.resize(total_length, INF);
+    WIP_by_column.resize(total_length, INF);
+    cp_branch_penalties.resize(n + 1);
+    for (cand_pos_t span = 0; span <= n; ++span)
+        cp_branch_penalties[span] = cparty::pseudo_loop_can_pair::cp_branch_penalty(span);
+
+    CLWI.resize(n + 1);
+    CLWIP.resize(n + 1);
+    CLWI_bound.resize(n + 1, INF);
+    CLWIP_bound.resize(n + 1, INF);
+    CLVP.resize(n + 1);
 }
 
 pseudo_loop::~pseudo_loop() {}
@@ -68,7 +85,28 @@ int pseudo_loop::compute_exterior_cases(cand_pos_t l, cand_pos_t j, sparse_tree
 }
 
 void pseudo_loop::compute_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    compute_cell_energies(i, j, tree);
+
+    cand_pos_t ip = tree.tree[i].pair; // i's pair ip should be right side so ip = )
+    cand_pos_t jp = tree.tree[j].pair; // j's pair jp should be left side so jp = (
+
+    compute_BE(i, ip, jp, j, tree);
+}
+
+/**
+ * BE(i,bp(i),ip,bp(ip)) reads WIP on both arms of the band, i.e. cells up to bp(i)-1 which the serial row order has already filled
+ * when it reaches (i,bp(ip)). A diagonal order has not, so the wavefront fill computes every band closed by i.bp(i) at the cell
+ * (i,bp(i)) instead; all readers of these entries span more than bp(i)-i.
+ */
+void pseudo_loop::compute_band_energies(cand_pos_t i, sparse_tree &tree) {
+    cand_pos_t ip = tree.tree[i].pair;
+    if (ip <= i) return;
+    for (cand_pos_t j = i + 1; j <= ip; ++j)
+        compute_BE(i, ip, tree.tree[j].pair, j, tree);
+}
+
+void pseudo_loop::compute_cell_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    cand_idx_t ij = index[i] + j - i;
     const pair_type ptype_closing = pair[S_[i]][S_[j]];
     const bool allowed_closing_pair = cparty::pseudo_loop_can_pair::can_form_allowed_pair(seq, i, j);
     bool weakly_closed_ij = tree.weakly_closed(i, j);
@@ -104,75 +142,86 @@ void pseudo_loop::compute_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree
         compute_WI(i, j, tree);
         compute_WIP(i, j, tree);
     }
+    const cand_idx_t kj = column_cell(i, j);
+    VP_by_column[kj] = get_VP(i, j);
+    VPR_by_column[kj] = get_VPR(i, j);
+    WIP_by_column[kj] = get_WIP(i, j);
+    update_candidates(i, j, tree);
+}
 
-    cand_pos_t ip = tree.tree[i].pair; // i's pair ip should be right side so ip = )
-    cand_pos_t jp = tree.tree[j].pair; // j's pair jp should be left side so jp = (
+namespace {
 
-    compute_BE(i, ip, jp, j, tree);
+// Appends (k,energy) unless a branch already in the list dominates it; a paired k cannot be skipped over, so it restarts the bound
+void add_candidate(std::vector<cand_entry> &list, energy_t &bound, cand_pos_t k, energy_t energy, energy_t unpaired, bool paired) {
+    const energy_t shifted = energy + unpaired * k;
+    if (!paired && shifted >= bound) return;
+    list.push_back({k, energy});
+    bound = shifted;
+}
+
+} // namespace
+
+void pseudo_loop::update_candidates(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
+    // WI and WIP only split at k < j-TURN-1
+    if (i < j - TURN - 1) {
+        const energy_t v_energy = V->get_energy(i, j);
+        const energy_t wmb_energy = get_WMB(i, j);
+        const bool paired = tree.tree[i].pair > 0;
+        add_candidate(CLWI[j], CLWI_bound[j], i, std::min(v_energy + PPS_penalty, wmb_energy + PSP_penalty + PPS_penalty), PUP_penalty, paired);
+        add_candidate(CLWIP[j], CLWIP_bound[j], i, std::min(v_energy + bp_penalty, wmb_energy + PSM_penalty + bp_penalty), cp_penalty, paired);
+    }
+    if (get_VP(i, j) < INF) CLVP[i].push_back(j);
 }
 // Added +1 to fres/tree indices as they are 1 ahead at the moment
 void pseudo_loop::compute_WI(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    energy_t m1 = INF, m2 = INF, m3 = INF, m4 = INF, m5 = INF;
-    cand_pos_t ij = index[i] + j - i;
+    energy_t m1 = INF, m2 = INF, m3 = INF;
+    cand_idx_t ij = index[i] + j - i;
     // branch 4, one base
     if (i == j) {
         WI[ij] = PUP_penalty;
         return;
     }
 
-    for (cand_pos_t k = i + 1; k < j - TURN - 1; ++k) {
-        energy_t wi_1 = get_WI(i, k - 1);
-        energy_t v_energy = wi_1 + V->get_energy(k, j);
-        energy_t wmb_energy = wi_1 + get_WMB(k, j);
-        m1 = std::min(m1, v_energy);
-        m2 = std::min(m2, wmb_energy);
-    }
-    m1 += PPS_penalty;
-    m2 += PSP_penalty + PPS_penalty;
-    if (tree.tree[j].pair < 0) m3 = get_WI(i, j - 1) + PUP_penalty;
-    m4 = V->get_energy(i, j) + PPS_penalty;
-    m5 = get_WMB(i, j) + PSP_penalty + PPS_penalty;
+    // branches 1 and 2, over the candidates (k,j) only; their energies carry the PPS and PSP penalties
+    for (const cand_entry &c : CLWI[j])
+        m1 = std::min(m1, get_WI(i, c.k - 1) + c.energy);
+    if (tree.tree[j].pair < 0) m2 = get_WI(i, j - 1) + PUP_penalty;
+    m3 = std::min(V->get_energy(i, j) + PPS_penalty, get_WMB(i, j) + PSP_penalty + PPS_penalty);
 
-    WI[ij] = std::min({m1, m2, m3, m4, m5});
+    WI[ij] = std::min({m1, m2, m3});
 }
 
 void pseudo_loop::compute_WIP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
 
-    energy_t m1 = INF, m2 = INF, m3 = INF, m4 = INF, m5 = INF, m6 = INF, m7 = INF;
+    energy_t m1 = INF, m2 = INF, m3 = INF, m4 = INF;
 
-    // branch 1:
-    for (cand_pos_t k = i + 1; k < j - TURN - 1; ++k) {
-        bool can_pair = cparty::pseudo_loop_can_pair::can_use_left_unpaired_span(tree.up, i, k);
-        energy_t wi_1 = get_WIP(i, k - 1);
-        energy_t v_energy = V->get_energy(k, j);
-        energy_t wmb_energy = get_WMB(k, j);
-        m1 = std::min(m1, wi_1 + v_energy);
-        m2 = std::min(m2, wi_1 + wmb_energy);
-        if (can_pair) m3 = std::min(m3, cparty::pseudo_loop_can_pair::cp_branch_penalty(k - i) + v_energy);
-        if (can_pair) m4 = std::min(m4, cparty::pseudo_loop_can_pair::cp_branch_penalty(k - i) + wmb_energy);
+    // branch 1, over the candidates (k,j) only; their energies carry the bp and PSM penalties
+    const cand_pos_t last_unpaired = cparty::pseudo_loop_can_pair::last_left_unpaired_span(tree.up, i, i, j);
+    for (const cand_entry &c : CLWIP[j]) {
+        cand_pos_t k = c.k;
+        m1 = std::min(m1, get_WIP(i, k - 1) + c.energy);
+        if (k <= last_unpaired) m2 = std::min(m2, cp_branch_penalties[k - i] + c.energy);
     }
-    m1 += bp_penalty;
-    m2 += PSM_penalty + bp_penalty;
-    m3 += bp_penalty;
-    m4 += PSM_penalty + bp_penalty;
     // branch 2:
-    if (tree.tree[j].pair < 0) m5 = get_WIP(i, j - 1) + cp_penalty;
-    m6 = V->get_energy(i, j) + bp_penalty;
-    m7 = get_WMB(i, j) + PSM_penalty + bp_penalty;
+    if (tree.tree[j].pair < 0) m3 = get_WIP(i, j - 1) + cp_penalty;
+    m4 = std::min(V->get_energy(i, j) + bp_penalty, get_WMB(i, j) + PSM_penalty + bp_penalty);
 
-    WIP[ij] = std::min({m1, m2, m3, m4, m5, m6, m7});
+    WIP[ij] = std::min({m1, m2, m3, m4});
 }
 
 void pseudo_loop::compute_VPL(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     energy_t m1 = INF;
 
     cand_pos_t min_Bp_j = std::min((cand_pos_tu)tree.b(i, j), (cand_pos_tu)tree.Bp(i, j));
-    for (cand_pos_t k = i + 1; k < min_Bp_j; ++k) {
+    // k = i+1..min_Bp_j-1 after the unpaired i..k-1, as far as they may be; VP(k,j) is INF from k = j on
+    const cand_pos_t last = cparty::pseudo_loop_can_pair::last_left_unpaired_span(tree.up, i, i + 1, std::min(min_Bp_j - 1, j - 1));
+    if (last > i) m1 = cparty::simd::min_sum(&cp_branch_penalties[1], &VP_by_column[column_cell(i + 1, j)], last - i);
+    for (cand_pos_t k = j; k < min_Bp_j; ++k) {
         bool can_pair = cparty::pseudo_loop_can_pair::can_use_left_unpaired_span(tree.up, i, k);
-        if (can_pair) m1 = std::min(m1, cparty::pseudo_loop_can_pair::cp_branch_penalty(k - i) + get_VP(k, j));
+        if (can_pair) m1 = std::min(m1, cp_branch_penalties[k - i] + INF);
     }
 
     VPL[ij] = m1;
@@ -180,17 +229,19 @@ void pseudo_loop::compute_VPL(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
 void pseudo_loop::compute_VPR(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     energy_t m1 = INF, m2 = INF;
 
     cand_pos_t max_i_bp = std::max(tree.B(i, j), tree.bp(i, j));
 
-    for (cand_pos_t k = max_i_bp + 1; k < j; ++k) {
+    // an infinite VP(i,k) cannot give a finite VPR(i,j), so only the k of CLVP[i] are tried; they are below j
+    const cand_pos_t first_unpaired = cparty::pseudo_loop_can_pair::first_right_unpaired_span(tree.up, i, j - 1, j);
+    for (cand_pos_t k : CLVP[i]) {
+        if (k <= max_i_bp) continue;
         energy_t VP_energy = get_VP(i, k);
-        bool can_pair = cparty::pseudo_loop_can_pair::can_use_right_unpaired_span(tree.up, k, j);
 
-        m1 = std::min(m1, VP_energy + get_WIP(k + 1, j));
-        if (can_pair) m2 = std::min(m2, VP_energy + cparty::pseudo_loop_can_pair::cp_branch_penalty(j - k));
+        m1 = std::min(m1, VP_energy + WIP_by_column[column_cell(k + 1, j)]);
+        if (k >= first_unpaired) m2 = std::min(m2, VP_energy + cp_branch_penalties[j - k]);
     }
 
     VPR[ij] = std::min(m1, m2);
@@ -259,31 +310,62 @@ energy_t pseudo_loop::compute_VP_split_branches(cand_pos_t i, cand_pos_t j, spar
     cand_pos_t min_Bp_j = std::min((cand_pos_tu)tree.b(i, j), (cand_pos_tu)tree.Bp(i, j));
     cand_pos_t max_i_bp = std::max(tree.B(i, j), tree.bp(i, j));
 
-    for (cand_pos_t k = i + 1; k < min_Bp_j; ++k) {
-        m6 = std::min(m6, get_WIP(i + 1, k - 1) + get_VP(k, j - 1));
-    }
+    m6 = compute_VP_split_left(i, j, min_Bp_j - 1, VP_by_column);
     m6 += ap_penalty + 2 * bp_penalty;
 
-    for (cand_pos_t k = max_i_bp + 1; k < j; ++k) {
-        m7 = std::min(m7, get_VP(i + 1, k) + get_WIP(k + 1, j - 1));
-    }
+    m7 = compute_VP_split_right(i, j, max_i_bp + 1, VP);
     m7 += ap_penalty + 2 * bp_penalty;
 
-    for (cand_pos_t k = i + 1; k < min_Bp_j; ++k) {
-        m8 = std::min(m8, get_WIP(i + 1, k - 1) + get_VPR(k, j - 1));
-    }
+    m8 = compute_VP_split_left(i, j, min_Bp_j - 1, VPR_by_column);
     m8 += ap_penalty + 2 * bp_penalty;
 
-    for (cand_pos_t k = max_i_bp + 1; k < j; ++k) {
-        m9 = std::min(m9, get_VPL(i + 1, k) + get_WIP(k + 1, j - 1));
-    }
+    m9 = compute_VP_split_right(i, j, max_i_bp + 1, VPL);
     m9 += ap_penalty + 2 * bp_penalty;
 
     return std::min({m6, m7, m8, m9});
 }
 
+// The lowest WIP(i+1,k-1) + X(k,j-1) over k = i+1..last, X being VP or VPR as held by by_column
+energy_t pseudo_loop::compute_VP_split_left(cand_pos_t i, cand_pos_t j, cand_pos_t last, const std::vector<energy_t> &by_column) {
+    energy_t m = INF;
+    // WIP(i+1,i) and WIP(i+1,i+1) are INF
+    for (cand_pos_t k = i + 1; k <= std::min(last, i + 2); ++k)
+        m = std::min(m, INF + by_column[column_cell(k, j - 1)]);
+    // the row of WIP from WIP(i+1,i+2) against the column j-1 from X(i+3,j-1)
+    const cand_pos_t last_in_column = std::min(last, j - 1);
+    if (last_in_column >= i + 3)
+        m = std::min(m, cparty::simd::min_sum(&WIP[index[i + 1] + 1], &by_column[column_cell(i + 3, j - 1)], last_in_column - i - 2));
+    // X(k,j-1) is INF from k = j on
+    for (cand_pos_t k = std::max(j, i + 3); k <= last; ++k)
+        m = std::min(m, get_WIP(i + 1, k - 1) + INF);
+    return m;
+}
+
+// The lowest X(i+1,k) + WIP(k+1,j-1) over k = first..j-1, X being VP or VPL
+energy_t pseudo_loop::compute_VP_split_right(cand_pos_t i, cand_pos_t j, cand_pos_t first, const std::vector<energy_t> &matrix) {
+    energy_t m = INF;
+    // X(i+1,k) is INF up to k = i+1, which leaves a term below INF only for a negative WIP(k+1,j-1) in the band
+    const cand_pos_t first_in_band = std::max(first, j - 2 - max_span);
+    const cand_pos_t last_infinite = std::min(i + 1, j - 2);
+    if (first_in_band <= last_infinite) {
+        const energy_t *WIP_kj = &WIP_by_column[column_cell(first_in_band + 1, j - 1)];
+        energy_t lowest = INF;
+        for (cand_pos_t t = 0; t <= last_infinite - first_in_band; ++t)
+            lowest = std::min(lowest, WIP_kj[t]);
+        m = std::min(m, INF + lowest);
+    }
+    // the row of X from X(i+1,i+2) against the column j-1 from WIP(i+3,j-1)
+    const cand_pos_t first_finite = std::max(first, i + 2);
+    if (first_finite <= j - 2)
+        m = std::min(m, cparty::simd::min_sum(&matrix[index[i + 1] + first_finite - i - 1], &WIP_by_column[column_cell(first_finite + 1, j - 1)],
+                                              j - 1 - first_finite));
+    // WIP(j,j-1) is INF
+    if (first_finite <= j - 1) m = std::min(m, matrix[index[i + 1] + j - i - 2] + INF);
+    return m;
+}
+
 void pseudo_loop::compute_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     cand_pos_t Bp_ij = tree.Bp(i, j);
     cand_pos_t B_ij = tree.B(i, j);
     cand_pos_t b_ij = tree.b(i, j);
@@ -297,7 +379,7 @@ void pseudo_loop::compute_VP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 }
 
 void pseudo_loop::compute_WMBW(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
 
     energy_t m1 = INF;
 
@@ -314,7 +396,7 @@ void pseudo_loop::compute_WMBW(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
 }
 
 void pseudo_loop::compute_WMBP(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
 
     energy_t m1 = INF, m2 = INF, m4 = INF;
 
@@ -373,7 +455,7 @@ energy_t pseudo_loop::compute_WMBP_split_branch(cand_pos_t i, cand_pos_t j, spar
 }
 
 void pseudo_loop::compute_WMB(cand_pos_t i, cand_pos_t j, sparse_tree &tree) {
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     // base case
     if (i == j) {
         WMB[ij] = INF;
@@ -416,7 +498,7 @@ void pseudo_loop::compute_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos
           && tree.tree[jp].pair == ip)) { // impossible cases
         return;
     }
-    cand_pos_t iip = index[i] + ip - i;
+    cand_idx_t iip = index[i] + ip - i;
     // base case: i.j and ip.jp must be in G
     if (tree.tree[i].pair != j || tree.tree[ip].pair != jp) {
         BE[iip] = INF;
@@ -495,46 +577,47 @@ void pseudo_loop::compute_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos
 
 energy_t pseudo_loop::get_WI(cand_pos_t i, cand_pos_t j) {
     if (i > j) return 0;
-    cand_pos_t ij = index[i] + j - i;
+    if (j - i > max_span) return INF;
+    cand_idx_t ij = index[i] + j - i;
     return WI[ij];
 }
 
 energy_t pseudo_loop::get_WIP(cand_pos_t i, cand_pos_t j) {
-    if (i >= j) return INF;
-    cand_pos_t ij = index[i] + j - i;
+    if (i >= j || j - i > max_span) return INF;
+    cand_idx_t ij = index[i] + j - i;
     return WIP[ij];
 }
 
 energy_t pseudo_loop::get_VP(cand_pos_t i, cand_pos_t j) {
-    if (i >= j) return INF;
-    cand_pos_t ij = index[i] + j - i;
+    if (i >= j || j - i > max_span) return INF;
+    cand_idx_t ij = index[i] + j - i;
     return VP[ij];
 }
 energy_t pseudo_loop::get_VPL(cand_pos_t i, cand_pos_t j) {
-    if (i >= j) return INF;
-    cand_pos_t ij = index[i] + j - i;
+    if (i >= j || j - i > max_span) return INF;
+    cand_idx_t ij = index[i] + j - i;
     return VPL[ij];
 }
 energy_t pseudo_loop::get_VPR(cand_pos_t i, cand_pos_t j) {
-    if (i >= j) return INF;
-    cand_pos_t ij = index[i] + j - i;
+    if (i >= j || j - i > max_span) return INF;
+    cand_idx_t ij = index[i] + j - i;
     return VPR[ij];
 }
 energy_t pseudo_loop::get_WMB(cand_pos_t i, cand_pos_t j) {
-    if (i >= j) return INF;
-    cand_pos_t ij = index[i] + j - i;
+    if (i >= j || j - i > max_span) return INF;
+    cand_idx_t ij = index[i] + j - i;
     return WMB[ij];
 }
 
 energy_t pseudo_loop::get_WMBW(cand_pos_t i, cand_pos_t j) {
-    if (i >= j) return INF;
-    cand_pos_t ij = index[i] + j - i;
+    if (i >= j || j - i > max_span) return INF;
+    cand_idx_t ij = index[i] + j - i;
     return WMBW[ij];
 }
 
 energy_t pseudo_loop::get_WMBP(cand_pos_t i, cand_pos_t j) {
-    if (i >= j) return INF;
-    cand_pos_t ij = index[i] + j - i;
+    if (i >= j || j - i > max_span) return INF;
+    cand_idx_t ij = index[i] + j - i;
     return WMBP[ij];
 }
 
@@ -547,7 +630,7 @@ energy_t pseudo_loop::get_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos
         if (i == ip && j == jp && i < j) {
             return 0;
         }
-        cand_pos_t iip = index[i] + ip - i;
+        cand_idx_t iip = index[i] + ip - i;
 
         return BE[iip];
     } else {
@@ -555,21 +638,20 @@ energy_t pseudo_loop::get_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos
     }
 }
 
-energy_t pseudo_loop::compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l, const paramT *params) {
+energy_t pseudo_loop::compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l) {
     if (!cparty::pseudo_loop_can_pair::can_form_allowed_pair(seq, i, j) || !cparty::pseudo_loop_can_pair::can_form_allowed_pair(seq, k, l)) {
         return INF;
     }
 
-    const pair_type ptype_closing = pair[S_[i]][S_[j]];
-    return E_IntLoop(k - i - 1, j - l - 1, ptype_closing, rtype[pair[S_[k]][S_[l]]], S1_[i + 1], S1_[j - 1], S1_[k - 1], S1_[l + 1],
-                     const_cast<paramT *>(params));
+    const cparty::ClosingPair closing = interior_loops_->closing(pair[S_[i]][S_[j]], S1_[i + 1], S1_[j - 1]);
+    return interior_loops_->energy(closing, k - i - 1, j - l - 1, rtype[pair[S_[k]][S_[l]]], S1_[k - 1], S1_[l + 1]);
 }
 
 energy_t pseudo_loop::get_e_stP(cand_pos_t i, cand_pos_t j) {
     if (i + 1 == j - 1) { // TODO: do I need something like that or stack is taking care of this?
         return INF;
     }
-    energy_t ss = compute_int(i, j, i + 1, j - 1, params_);
+    energy_t ss = compute_int(i, j, i + 1, j - 1);
     return lrint(e_stP_penalty * ss);
 }
 
@@ -578,7 +660,7 @@ energy_t pseudo_loop::get_e_intP(cand_pos_t i, cand_pos_t ip, cand_pos_t jp, can
     // this function is only being called in branch 5 of VP
     // and branch 2 of BE
     // in both cases regions [i,ip] and [jp,j] are closed regions
-    energy_t e_int = compute_int(i, j, ip, jp, params_);
+    energy_t e_int = compute_int(i, j, ip, jp);
     energy_t energy = lrint(e_intP_penalty * e_int);
     return energy;
 }
@@ -4,6 +4,7 @@
 #include "constants.hh"
 #include "h_struct.hh"
 #include "s_energy_matrix.hh"
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
 
@@ -13,12 +14,18 @@ class pseudo_loop {
 
   public:
     // constructor
-    pseudo_loop(std::string seq, std::string restricted, s_energy_matrix *V, short *S, short *S1, vrna_param_t *params);
+    // max_span > 0 limits the stored cells to spans j-i <= max_span, as the V matrix it reads does
+    pseudo_loop(std::string seq, std::string restricted, s_energy_matrix *V, short *S, short *S1, vrna_param_t *params,
+                const cparty::InteriorLoops &interior_loops, cand_pos_t max_span = 0);
 
     // destructor
     ~pseudo_loop();
 
     void compute_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+    // compute_energies without the BE update, for fills that do not follow the row order
+    void compute_cell_energies(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+    // fills BE for every band closed by i.bp(i)
+    void compute_band_energies(cand_pos_t i, sparse_tree &tree);
 
     // energy_t get_energy(cand_pos_t i, cand_pos_t j);
     // in order to be able to check the border values consistantly
@@ -45,6 +52,7 @@ class pseudo_loop {
 
   private:
     cand_pos_t n;
+    cand_pos_t max_span; // the longest span (i,j) stored, n unless the fold is local
     std::string res;
     std::string seq;
 
@@ -54,6 +62,7 @@ class pseudo_loop {
     std::string structure;
     minimum_fold *f;
     vrna_param_t *params_;
+    const cparty::InteriorLoops *interior_loops_;
 
     // Hosna
     std::vector<energy_t> WI;   // the loop inside a pseudoknot (in general it looks like a W but is inside a pseudoknot)
@@ -64,7 +73,27 @@ class pseudo_loop {
     std::vector<energy_t> WMBW;
     std::vector<energy_t> WIP;     // the loop corresponding to WI'
     std::vector<energy_t> BE;      // the loop corresponding to BE
-    std::vector<cand_pos_t> index; // the array to keep the index of two dimensional arrays like WI and weakly_closed
+    std::vector<cand_idx_t> index; // the array to keep the index of two dimensional arrays like WI and weakly_closed
+
+    // Column copies of the operands the splits of VP and VPR read down a column, with k ascending in each column, so
+    // that a split is a min_sum of a row and a column. They hold what the getters return, INF on the diagonal.
+    std::vector<energy_t> VP_by_column;
+    std::vector<energy_t> VPR_by_column;
+    std::vector<energy_t> WIP_by_column;
+    std::vector<cand_idx_t> column_index; // the index of the column copies, that of the matrices for the mirrored sequence
+    std::vector<energy_t> cp_branch_penalties; // cp_branch_penalty(span) at span
+
+    // the place of (k,j) in a column copy: column j of the band is the row n+1-j of the mirrored sequence
+    cand_idx_t column_cell(cand_pos_t k, cand_pos_t j) const { return column_index[n + 1 - j] + std::min(max_span, j - 1) - (j - k); }
+
+    // CLWI[j] and CLWIP[j] hold the branches (k,j) that can end WI(i,j) and WIP(i,j), by decreasing k, with their energy.
+    // A branch is left out when a branch (l,j), l > k, after the unpaired bases k..l-1 costs no more: every i that can
+    // end in (k,j) can end in (l,j) for as little. CLWI_bound and CLWIP_bound keep the lowest such cost per j, shifted by k.
+    std::vector<std::vector<cand_entry>> CLWI;
+    std::vector<std::vector<cand_entry>> CLWIP;
+    std::vector<energy_t> CLWI_bound;
+    std::vector<energy_t> CLWIP_bound;
+    std::vector<std::vector<cand_pos_t>> CLVP; // CLVP[i] holds the k with a finite VP(i,k), by increasing k
 
     short *S_;
     short *S1_;
@@ -81,6 +110,8 @@ class pseudo_loop {
     energy_t compute_VP_internal_branches(cand_pos_t i, cand_pos_t j, cand_pos_t Bp_ij, cand_pos_t B_ij, cand_pos_t b_ij,
                                           cand_pos_t bp_ij, sparse_tree &tree);
     energy_t compute_VP_split_branches(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+    energy_t compute_VP_split_left(cand_pos_t i, cand_pos_t j, cand_pos_t last, const std::vector<energy_t> &by_column);
+    energy_t compute_VP_split_right(cand_pos_t i, cand_pos_t j, cand_pos_t first, const std::vector<energy_t> &matrix);
     // Hosna: this function is supposed to fill the VP array
 
     // Computes the non-redundant recurrence from CParty (replaces VPP from original)
@@ -104,11 +135,14 @@ class pseudo_loop {
     void compute_BE(cand_pos_t i, cand_pos_t j, cand_pos_t ip, cand_pos_t jp, sparse_tree &tree);
     // Hosna: this function is supposed to fill the BE array
 
+    // adds the cell (i,j) to the candidate lists once its VP, WMB and V values are final
+    void update_candidates(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+
     // Hosna Feb 8th, 2007:
     // I have to calculate the e_stP in a separate function
     energy_t get_e_stP(cand_pos_t i, cand_pos_t j);
     energy_t get_e_intP(cand_pos_t i, cand_pos_t ip, cand_pos_t jp, cand_pos_t j);
-    energy_t compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l, const paramT *params);
+    energy_t compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l);
     int compute_exterior_cases(cand_pos_t l, cand_pos_t j, sparse_tree &tree);
 
     // Hosna: Feb 19th 2007
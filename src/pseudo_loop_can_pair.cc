@@ -33,5 +33,29 @@ bool can_form_allowed_pair(const std::string &seq, cand_pos_t left, cand_pos_t r
 
 energy_t cp_branch_penalty(cand_pos_t span) { return static_cast<energy_t>(span * cp_penalty); }
 
+cand_pos_t last_left_unpaired_span(const std::vector<int> &up, cand_pos_t i, cand_pos_t first, cand_pos_t last) {
+    cand_pos_t low = first - 1, high = last; // the answer lies in low..high
+    while (low < high) {
+        const cand_pos_t mid = high - (high - low) / 2;
+        if (can_use_left_unpaired_span(up, i, mid))
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+cand_pos_t first_right_unpaired_span(const std::vector<int> &up, cand_pos_t first, cand_pos_t last, cand_pos_t j) {
+    cand_pos_t low = first, high = last + 1; // the answer lies in low..high
+    while (low < high) {
+        const cand_pos_t mid = low + (high - low) / 2;
+        if (can_use_right_unpaired_span(up, mid, j))
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return low;
+}
+
 } // namespace pseudo_loop_can_pair
 } // namespace cparty
@@ -15,6 +15,11 @@ bool can_use_internal_right_unpaired_span(const std::vector<int> &up, cand_pos_t
 bool can_form_allowed_pair(const std::string &seq, cand_pos_t left, cand_pos_t right);
 energy_t cp_branch_penalty(cand_pos_t span);
 
+// The last k of first..last with can_use_left_unpaired_span(up, i, k), first-1 if there is none; those k are a prefix
+cand_pos_t last_left_unpaired_span(const std::vector<int> &up, cand_pos_t i, cand_pos_t first, cand_pos_t last);
+// The first k of first..last with can_use_right_unpaired_span(up, k, j), last+1 if there is none; those k are a suffix
+cand_pos_t first_right_unpaired_span(const std::vector<int> &up, cand_pos_t first, cand_pos_t last, cand_pos_t j);
+
 } // namespace pseudo_loop_can_pair
 } // namespace cparty
 
@@ -27,30 +27,32 @@
 #include <string.h>
 #include <string>
 
+#include "matrix_index.hh"
 #include "s_energy_matrix.hh"
+#include "vienna_state.hh"
 
-s_energy_matrix::s_energy_matrix(std::string seq, cand_pos_t length, short *S, short *S1, vrna_param_t *params)
+s_energy_matrix::s_energy_matrix(std::string seq, cand_pos_t length, short *S, short *S1, vrna_param_t *params,
+                                 const cparty::InteriorLoops &interior_loops, cand_pos_t max_span)
 // The constructor
 {
     params_ = params;
-    make_pair_matrix();
+    interior_loops_ = &interior_loops;
+    cparty::vienna::make_pair_matrix_once();
     S_ = S;
     S1_ = S1;
 
     n = length;
     seq_ = seq;
 
-    // an vector with indexes, such that we don't work with a 2D array, but with a 1D array of length (n*(n+1))/2
-    index.resize(n + 1);
-    cand_pos_t total_length = ((n + 1) * (n + 2)) / 2;
-    index[1] = 0;
-    for (cand_pos_t i = 2; i <= n; i++) {
-        index[i] = index[i - 1] + (n + 1) - i + 1;
-    }
+    // an vector with indexes, such that we don't work with a 2D array, but with a 1D array of length (n*(n+1))/2,
+    // or n*(max_span+1) for a local fold
+    this->max_span = cparty::span_limit(n, max_span);
+    cand_idx_t total_length = cparty::make_matrix_index(n, this->max_span, index);
 
     WM.resize(total_length, INF);
     WMv.resize(total_length, INF);
     WMp.resize(total_length, INF);
+    CLWM.resize(n + 1);
     // this array holds V(i,j), and what (i,j) encloses: hairpin loop, stack pair, internal loop or multi-loop
     nodes.resize(total_length);
 }
@@ -70,6 +72,7 @@ s_energy_matrix::~s_energy_matrix()
  * @param vij1 The V(i,j-1) energy
  * @param vi1j1 The V(i+1,j-1) energy
  */
+template <int Dangles>
 energy_t s_energy_matrix::E_MLStem(const energy_t &vij, const energy_t &vi1j, const energy_t &vij1, const energy_t &vi1j1, const short *S,
                                    paramT *params, cand_pos_t i, cand_pos_t j, const cand_pos_t &n, std::vector<Node> &tree) {
 
@@ -80,7 +83,7 @@ energy_t s_energy_matrix::E_MLStem(const energy_t &vij, const energy_t &vi1j, co
     if ((tree[i].pair < -1 && tree[j].pair < -1) || (tree[i].pair == j)) {
         en = vij; // i j
         if (en != INF) {
-            if (params->model_details.dangles == 2) {
+            if constexpr (Dangles == 2) {
                 base_type mm5 = i > 1 ? S[i - 1] : -1;
                 base_type mm3 = j < n ? S[j + 1] : -1;
                 en += E_MLstem(type, mm5, mm3, params);
@@ -90,7 +93,7 @@ energy_t s_energy_matrix::E_MLStem(const energy_t &vij, const energy_t &vi1j, co
             e = std::min(e, en);
         }
     }
-    if (params->model_details.dangles == 1) {
+    if constexpr (Dangles == 1) {
         const base_type mm5 = S[i], mm3 = S[j];
 
         if (((tree[i + 1].pair < -1 && tree[j].pair < -1) || (tree[i + 1].pair == j)) && tree[i].pair < 0) {
@@ -140,6 +143,7 @@ energy_t s_energy_matrix::E_MLStem(const energy_t &vij, const energy_t &vi1j, co
  * @param dmli1 Row of WM2 from one iteration ago
  * @param dmli2 Row of WM2 from two iterations ago
  */
+template <int Dangles>
 energy_t s_energy_matrix::E_MbLoop(const energy_t WM2ij, const energy_t WM2ip1j, const energy_t WM2ijm1, const energy_t WM2ip1jm1, const short *S,
                                    paramT *params, cand_pos_t i, cand_pos_t j, std::vector<Node> &tree) {
 
@@ -148,7 +152,7 @@ energy_t s_energy_matrix::E_MbLoop(const energy_t WM2ij, const energy_t WM2ip1j,
     bool pairable = (tree[i].pair < -1 && tree[j].pair < -1) || (tree[i].pair == j);
 
     /* double dangles */
-    switch (params->model_details.dangles) {
+    switch (Dangles) {
     case 2:
         if (pairable) {
             e = WM2ij;
@@ -238,12 +242,12 @@ energy_t s_energy_matrix::E_MbLoop(const energy_t WM2ij, const energy_t WM2ip1j,
 
     return e;
 }
-void s_energy_matrix::compute_WMv_WMp(cand_pos_t i, cand_pos_t j, energy_t WMB, std::vector<Node> &tree) {
+template <int Dangles> void s_energy_matrix::compute_WMv_WMp(cand_pos_t i, cand_pos_t j, energy_t WMB, std::vector<Node> &tree) {
     if (j - i + 1 < 4) return;
-    cand_pos_t ij = index[(i)] + (j) - (i);
-    cand_pos_t ijminus1 = index[(i)] + (j)-1 - (i);
+    cand_idx_t ij = index[(i)] + (j) - (i);
+    cand_idx_t ijminus1 = index[(i)] + (j)-1 - (i);
 
-    WMv[ij] = E_MLStem(get_energy(i, j), get_energy(i + 1, j), get_energy(i, j - 1), get_energy(i + 1, j - 1), S_, params_, i, j, n, tree);
+    WMv[ij] = E_MLStem<Dangles>(get_energy(i, j), get_energy(i + 1, j), get_energy(i, j - 1), get_energy(i + 1, j - 1), S_, params_, i, j, n, tree);
     WMp[ij] = WMB + PSM_penalty + b_penalty;
     if (tree[j].pair <= -1) {
         energy_t tmp = WMv[ijminus1] + params_->MLbase;
@@ -253,29 +257,40 @@ void s_energy_matrix::compute_WMv_WMp(cand_pos_t i, cand_pos_t j, energy_t WMB,
     }
 }
 
+template <int Dangles>
 void s_energy_matrix::compute_energy_WM_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree, std::vector<energy_t> &WMB)
 // compute de MFE of a partial multi-loop closed at (i,j), the restricted case
 {
     if (j - i + 1 < 4) return;
-    energy_t m1 = INF, m2 = INF, m3 = INF, m4 = INF, m5 = INF;
+    energy_t m1 = INF, m2 = INF, m3 = INF;
     // ++j;
-    cand_pos_t ij = index[i] + j - i;
-    cand_pos_t ijminus1 = index[i] + (j - 1) - i;
+    cand_idx_t ij = index[i] + j - i;
+    cand_idx_t ijminus1 = index[i] + (j - 1) - i;
 
-    for (cand_pos_t k = j - TURN - 1; k >= i; --k) {
-        cand_pos_t kj = index[k] + j - k;
-        energy_t wm_kj = E_MLStem(get_energy(k, j), get_energy(k + 1, j), get_energy(k, j - 1), get_energy(k + 1, j - 1), S_, params_, k, j, n, tree.tree);
-        energy_t wmb_kj = WMB[kj] + PSM_penalty + b_penalty;
+    // Only the candidates of column j can end WM(i,j) in a branch; the one starting at i itself is added below
+    for (const cand_entry &c : CLWM[j]) {
+        cand_pos_t k = c.k;
         bool can_pair = tree.up[k - 1] >= (k - i);
-        if (can_pair) m1 = std::min(m1, static_cast<energy_t>((k - i) * params_->MLbase) + wm_kj);
-        if (can_pair) m2 = std::min(m2, static_cast<energy_t>((k - i) * params_->MLbase) + wmb_kj);
-        m3 = std::min(m3, get_energy_WM(i, k - 1) + wm_kj);
-        m4 = std::min(m4, get_energy_WM(i, k - 1) + wmb_kj);
+        if (can_pair) m1 = std::min(m1, static_cast<energy_t>((k - i) * params_->MLbase) + c.energy);
+        m2 = std::min(m2, get_energy_WM(i, k - 1) + c.energy);
+    }
+    if (tree.tree[j].pair <= -1) m3 = std::min(m3, WM[ijminus1] + params_->MLbase);
+    energy_t split = std::min({m1, m2, m3});
+
+    if (i > j - TURN - 1) {
+        WM[ij] = split;
+        return;
     }
-    if (tree.tree[j].pair <= -1) m5 = std::min(m5, WM[ijminus1] + params_->MLbase);
-    WM[ij] = std::min({m1, m2, m3, m4, m5});
+    energy_t wm_ij = E_MLStem<Dangles>(get_energy(i, j), get_energy(i + 1, j), get_energy(i, j - 1), get_energy(i + 1, j - 1), S_, params_, i, j, n, tree.tree);
+    energy_t wmb_ij = WMB[ij] + PSM_penalty + b_penalty;
+    energy_t branch = std::min(wm_ij, wmb_ij);
+    // A branch no lower than the split cannot end any WM(i',j) either: WM(i',i-1) or the unpaired prefix followed by
+    // the split is itself a decomposition of WM(i',j) of no higher energy
+    if (branch < split) CLWM[j].push_back({i, branch});
+    WM[ij] = std::min(branch, split);
 }
 
+template <int Dangles>
 energy_t s_energy_matrix::compute_energy_VM_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree)
 // compute the MFE of a multi-loop closed at (i,j), the restricted case
 {
@@ -302,7 +317,7 @@ energy_t s_energy_matrix::compute_energy_VM_restricted(cand_pos_t i, cand_pos_t
         if (tree.up[k - 2] >= (k - (i + 2)))
             WM2ip1jm1 = std::min(WM2ip1jm1, static_cast<energy_t>((k - (i + 1) - 1) * params_->MLbase) + get_energy_WMp(k, j - 2));
 
-        min = std::min(min, E_MbLoop(WM2ij, WM2ip1j, WM2ijm1, WM2ip1jm1, S_, params_, i, j, tree.tree));
+        min = std::min(min, E_MbLoop<Dangles>(WM2ij, WM2ip1j, WM2ijm1, WM2ip1jm1, S_, params_, i, j, tree.tree));
     }
     return min;
 }
@@ -324,18 +339,17 @@ energy_t s_energy_matrix::HairpinE(const std::string &seq, const short *S, const
 /**
  * @brief restricted version
  */
-energy_t s_energy_matrix::compute_internal_restricted(cand_pos_t i, cand_pos_t j, const paramT *params, std::vector<int> &up) {
+energy_t s_energy_matrix::compute_internal_restricted(cand_pos_t i, cand_pos_t j, std::vector<int> &up) {
     energy_t v_iloop = INF;
     cand_pos_t max_k = std::min(j - TURN - 2, i + MAXLOOP + 1);
-    const int ptype_closing = pair[S_[i]][S_[j]];
+    const cparty::ClosingPair closing = interior_loops_->closing(pair[S_[i]][S_[j]], S1_[i + 1], S1_[j - 1]);
     for (cand_pos_t k = i + 1; k <= max_k; ++k) {
 
         cand_pos_t min_l = std::max(k + TURN + 1 + MAXLOOP + 2, k + j - i) - MAXLOOP - 2;
         if ((up[k - 1] >= (k - i - 1))) {
             for (cand_pos_t l = j - 1; l >= min_l; --l) {
                 if (up[j - 1] >= (j - l - 1)) {
-                    energy_t v_iloop_kl = E_IntLoop(k - i - 1, j - l - 1, ptype_closing, rtype[pair[S_[k]][S_[l]]], S1_[i + 1], S1_[j - 1],
-                                                    S1_[k - 1], S1_[l + 1], const_cast<paramT *>(params))
+                    energy_t v_iloop_kl = interior_loops_->energy(closing, k - i - 1, j - l - 1, rtype[pair[S_[k]][S_[l]]], S1_[k - 1], S1_[l + 1])
                                           + get_energy(k, l);
                     v_iloop = std::min(v_iloop, v_iloop_kl);
                 }
@@ -345,24 +359,14 @@ energy_t s_energy_matrix::compute_internal_restricted(cand_pos_t i, cand_pos_t j
     return v_iloop;
 }
 
-energy_t s_energy_matrix::compute_stack(cand_pos_t i, cand_pos_t j, const paramT *params) {
+energy_t s_energy_matrix::compute_stack(cand_pos_t i, cand_pos_t j) { return compute_int(i, j, i + 1, j - 1); }
 
-    const int ptype_closing = pair[S_[i]][S_[j]];
-    cand_pos_t k = i + 1;
-    cand_pos_t l = j - 1;
-    return E_IntLoop(k - i - 1, j - l - 1, ptype_closing, rtype[pair[S_[k]][S_[l]]], S1_[i + 1], S1_[j - 1], S1_[k - 1], S1_[l + 1],
-                     const_cast<paramT *>(params))
-           + get_energy(k, l);
-}
-
-energy_t s_energy_matrix::compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l, const paramT *params) {
-
-    const int ptype_closing = pair[S_[i]][S_[j]];
-    return E_IntLoop(k - i - 1, j - l - 1, ptype_closing, rtype[pair[S_[k]][S_[l]]], S1_[i + 1], S1_[j - 1], S1_[k - 1], S1_[l + 1],
-                     const_cast<paramT *>(params))
-           + get_energy(k, l);
+energy_t s_energy_matrix::compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l) {
+    const cparty::ClosingPair closing = interior_loops_->closing(pair[S_[i]][S_[j]], S1_[i + 1], S1_[j - 1]);
+    return interior_loops_->energy(closing, k - i - 1, j - l - 1, rtype[pair[S_[k]][S_[l]]], S1_[k - 1], S1_[l + 1]) + get_energy(k, l);
 }
 
+template <int Dangles>
 void s_energy_matrix::compute_energy_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree)
 // compute the V(i,j) value, if the structure must be restricted
 {
@@ -383,8 +387,8 @@ void s_energy_matrix::compute_energy_restricted(cand_pos_t i, cand_pos_t j, spar
         bool canH = !(tree.up[j - 1] < (j - i - 1));
         if (canH) min_en[0] = HairpinE(seq_, S_, S1_, params_, i, j);
 
-        min_en[1] = compute_internal_restricted(i, j, params_, tree.up);
-        min_en[2] = compute_energy_VM_restricted(i, j, tree);
+        min_en[1] = compute_internal_restricted(i, j, tree.up);
+        min_en[2] = compute_energy_VM_restricted<Dangles>(i, j, tree);
     }
 
     for (k = 0; k < 3; k++) {
@@ -409,7 +413,7 @@ void s_energy_matrix::compute_energy_restricted(cand_pos_t i, cand_pos_t j, spar
     }
 
     if (min < INF / 2) {
-        int ij = index[i] + j - i;
+        cand_idx_t ij = index[i] + j - i;
         nodes[ij].energy = min;
         nodes[ij].type = type;
     }
@@ -420,14 +424,24 @@ void s_energy_matrix::compute_hotspot_energy(cand_pos_t i, cand_pos_t j, bool is
     // printf("in compute_hotspot_energy i:%d j:%d\n",i,j);
     energy_t energy = 0;
     if (is_stack) {
-        energy = compute_stack(i, j, params_);
+        energy = compute_stack(i, j);
         // printf("stack: %d\n",energy);
     } else {
         energy = 0; // HairpinE(seq_,S_,S1_,params_,i,j);
         // printf("hairpin: %d\n",energy);
     }
 
-    cand_pos_t ij = index[i] + j - i;
+    cand_idx_t ij = index[i] + j - i;
     nodes[ij].energy = energy;
     return;
 }
+
+template void s_energy_matrix::compute_energy_restricted<0>(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+template void s_energy_matrix::compute_energy_restricted<1>(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+template void s_energy_matrix::compute_energy_restricted<2>(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+template void s_energy_matrix::compute_WMv_WMp<0>(cand_pos_t i, cand_pos_t j, energy_t WMB, std::vector<Node> &tree);
+template void s_energy_matrix::compute_WMv_WMp<1>(cand_pos_t i, cand_pos_t j, energy_t WMB, std::vector<Node> &tree);
+template void s_energy_matrix::compute_WMv_WMp<2>(cand_pos_t i, cand_pos_t j, energy_t WMB, std::vector<Node> &tree);
+template void s_energy_matrix::compute_energy_WM_restricted<0>(cand_pos_t i, cand_pos_t j, sparse_tree &tree, std::vector<energy_t> &WMB);
+template void s_energy_matrix::compute_energy_WM_restricted<1>(cand_pos_t i, cand_pos_t j, sparse_tree &tree, std::vector<energy_t> &WMB);
+template void s_energy_matrix::compute_energy_WM_restricted<2>(cand_pos_t i, cand_pos_t j, sparse_tree &tree, std::vector<energy_t> &WMB);
@@ -2,6 +2,7 @@
 #define ENERGY_MATRIX_H
 
 #include "base_types.hh"
+#include "interior_loops.hh"
 #include "sparse_tree.hh"
 #include <string>
 #include <vector>
@@ -12,17 +13,26 @@ extern "C" {
 #include "ViennaRNA/params/io.h"
 }
 
+// A split point k kept for the branches ending at j, with the energy of the branch (k,j)
+struct cand_entry {
+    cand_pos_t k;
+    energy_t energy;
+};
+
 class s_energy_matrix {
   public:
     friend class s_multi_loop;
 
-    s_energy_matrix(std::string seq, cand_pos_t length, short *S, short *S1, vrna_param_t *params);
-    // The constructor
+    s_energy_matrix(std::string seq, cand_pos_t length, short *S, short *S1, vrna_param_t *params, const cparty::InteriorLoops &interior_loops,
+                    cand_pos_t max_span = 0);
+    // The constructor; interior_loops holds the interior loops of params, and a positive max_span below length stores only
+    // the cells (i,j) with j-i <= max_span
 
     ~s_energy_matrix();
     // The destructor
 
     vrna_param_t *params_;
+    const cparty::InteriorLoops *interior_loops_;
 
     short *S_;
     short *S1_;
@@ -31,40 +41,41 @@ class s_energy_matrix {
     // void compute_energy (int i, int j);
     // compute the V(i,j) value
 
-    void compute_energy_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+    // The cell kernels are specialized on the dangle model of params (0, 1 or 2), which the fold picks once
+    template <int Dangles> void compute_energy_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
 
     free_energy_node *get_node(cand_pos_t i, cand_pos_t j) {
-        cand_pos_t ij = index[i] + j - i;
+        cand_idx_t ij = index[i] + j - i;
         return &nodes[ij];
     }
     // return the node at (i,j)
 
     // May 15, 2007. Added "if (i>=j) return INF;"  below. It was miscalculating the backtracked structure.
     energy_t get_energy(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return INF;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return INF;
+        cand_idx_t ij = index[i] + j - i;
         return nodes[ij].energy;
     }
 
     energy_t get_energy_WM(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return INF;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return INF;
+        cand_idx_t ij = index[i] + j - i;
         return WM[ij];
     }
     energy_t get_energy_WMv(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return INF;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return INF;
+        cand_idx_t ij = index[i] + j - i;
         return WMv[ij];
     }
     energy_t get_energy_WMp(cand_pos_t i, cand_pos_t j) {
-        if (i >= j) return INF;
-        cand_pos_t ij = index[i] + j - i;
+        if (i >= j || j - i > max_span) return INF;
+        cand_idx_t ij = index[i] + j - i;
         return WMp[ij];
     }
     // return the value at V(i,j)
 
     char get_type(cand_pos_t i, cand_pos_t j) {
-        cand_pos_t ij = index[i] + j - i;
+        cand_idx_t ij = index[i] + j - i;
         return nodes[ij].type;
     }
     // return the type at V(i,j)
@@ -72,17 +83,19 @@ class s_energy_matrix {
     void compute_hotspot_energy(cand_pos_t i, cand_pos_t j, bool is_stack);
 
     energy_t HairpinE(const std::string &seq, const short *S, const short *S1, const paramT *params, cand_pos_t i, cand_pos_t j);
-    energy_t compute_stack(cand_pos_t i, cand_pos_t j, const paramT *params);
-    energy_t compute_internal_restricted(cand_pos_t i, cand_pos_t j, const paramT *params, std::vector<int> &up);
-    energy_t compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l, const paramT *params);
+    energy_t compute_stack(cand_pos_t i, cand_pos_t j);
+    energy_t compute_internal_restricted(cand_pos_t i, cand_pos_t j, std::vector<int> &up);
+    energy_t compute_int(cand_pos_t i, cand_pos_t j, cand_pos_t k, cand_pos_t l);
 
-    void compute_energy_WM_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree, std::vector<energy_t> &WMB);
-    energy_t compute_energy_VM_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+    template <int Dangles> void compute_energy_WM_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree, std::vector<energy_t> &WMB);
+    template <int Dangles> energy_t compute_energy_VM_restricted(cand_pos_t i, cand_pos_t j, sparse_tree &tree);
+    template <int Dangles>
     energy_t E_MLStem(const energy_t &vij, const energy_t &vi1j, const energy_t &vij1, const energy_t &vi1j1, const short *S, paramT *params,
                       cand_pos_t i, cand_pos_t j, const cand_pos_t &n, std::vector<Node> &tree);
+    template <int Dangles>
     energy_t E_MbLoop(const energy_t WM2ij, const energy_t WM2ip1j, const energy_t WM2ijm1, const energy_t WM2ip1jm1, const short *S, paramT *params,
                       cand_pos_t i, cand_pos_t j, std::vector<Node> &tree);
-    void compute_WMv_WMp(cand_pos_t i, cand_pos_t j, energy_t WMB, std::vector<Node> &tree);
+    template <int Dangles> void compute_WMv_WMp(cand_pos_t i, cand_pos_t j, energy_t WMB, std::vector<Node> &tree);
 
     // better to have protected variable rather than private, it's necessary for Hfold
   protected:
@@ -91,10 +104,14 @@ class s_energy_matrix {
     std::vector<energy_t> WM;
     std::vector<energy_t> WMv;
     std::vector<energy_t> WMp;
+    // CLWM[j] holds the (k,j) whose multiloop branch energy is below every other decomposition of WM(k,j), by decreasing k.
+    // WM(i,j) only needs these: any other branch ending at j can be replaced by a split of no higher energy
+    std::vector<std::vector<cand_entry>> CLWM;
 
     std::string seq_;
     cand_pos_t n; // sequence length
-    std::vector<cand_pos_t> index;
+    cand_pos_t max_span; // the longest span (i,j) stored, n unless the fold is local
+    std::vector<cand_idx_t> index;
     // int *index;                // an array with indexes, such that we don't work with a 2D array, but with a 1D array of length (n*(n+1))/2
     std::vector<free_energy_node> nodes; // the free energy and type (i.e. base pair closing a hairpin loops, stacked pair etc), for each i and j
 };
@@ -0,0 +1,92 @@
+#include "sequence_context.hh"
+#include "matrix_index.hh"
+#include "part_func.hh"
+#include "vienna_state.hh"
+
+#include <stdlib.h>
+
+namespace cparty {
+
+SequenceContext::SequenceContext(const std::string &seq, int dangles, cand_pos_t table_span)
+    : SequenceContext(seq, dangles, nullptr, nullptr, table_span) {}
+
+SequenceContext::SequenceContext(const std::string &seq, int dangles, const vrna_param_t *params, const vrna_exp_param_t *exp_params,
+                                 cand_pos_t table_span)
+    : seq_(seq), n_(seq.length()), dangles_(dangles), exp_template_(exp_params) {
+    vienna::make_pair_matrix_once();
+    S_ = encode_sequence(seq.c_str(), 0);
+    S1_ = encode_sequence(seq.c_str(), 1);
+    params_ = params ? vrna_params_copy(const_cast<vrna_param_t *>(params)) : vienna::scaled_parameters();
+    params_->model_details.dangles = dangles;
+    interior_loops_.reset(new InteriorLoops(params_));
+
+    table_span_ = table_span < 0 ? 0 : span_limit(n_, table_span);
+}
+
+SequenceContext::~SequenceContext() {
+    free(params_);
+    free(exp_params_);
+    free(S_);
+    free(S1_);
+}
+
+vrna_exp_param_t *SequenceContext::exp_params() const {
+    std::call_once(pf_ready_, [this] { build_pf_tables(); });
+    return exp_params_;
+}
+
+const PkBoltzmannFactors &SequenceContext::pk_boltzmann_factors() const {
+    std::call_once(pf_ready_, [this] { build_pf_tables(); });
+    return pk_factors_;
+}
+
+const ExpInteriorLoops &SequenceContext::exp_interior_loops() const {
+    std::call_once(pf_ready_, [this] { build_pf_tables(); });
+    return *exp_interior_loops_;
+}
+
+pf_t SequenceContext::exp_hairpin(cand_pos_t i, cand_pos_t j) const {
+    std::call_once(pf_ready_, [this] { build_pf_tables(); });
+    if (j - i > table_span_) return compute_exp_hairpin(i, j);
+    return exp_hairpin_[index_[i] + j - i];
+}
+
+pf_t SequenceContext::exp_stack(cand_pos_t i, cand_pos_t j) const {
+    std::call_once(pf_ready_, [this] { build_pf_tables(); });
+    if (j - i > table_span_) return compute_exp_stack(i, j);
+    return exp_stack_[index_[i] + j - i];
+}
+
+pf_t SequenceContext::compute_exp_hairpin(cand_pos_t i, cand_pos_t j) const {
+    const int ptype_closing = pair[S_[i]][S_[j]];
+    if (j - i < TURN + 1 || ptype_closing == 0) return 0;
+    return static_cast<pf_t>(exp_E_Hairpin(j - i - 1, ptype_closing, S1_[i + 1], S1_[j - 1], &seq_.c_str()[i - 1], exp_params_));
+}
+
+pf_t SequenceContext::compute_exp_stack(cand_pos_t i, cand_pos_t j) const {
+    const int ptype_closing = pair[S_[i]][S_[j]];
+    if (j - i < TURN + 1 || ptype_closing == 0) return 0;
+    const int ptype_inner = pair[S_[i + 1]][S_[j - 1]];
+    if (j - i - 2 <= TURN || ptype_inner == 0) return 0;
+    return static_cast<pf_t>(exp_E_IntLoop(0, 0, ptype_closing, rtype[ptype_inner], S1_[i + 1], S1_[j - 1], S1_[i], S1_[j], exp_params_));
+}
+
+void SequenceContext::build_pf_tables() const {
+    exp_params_ = exp_template_ ? vrna_exp_params_copy(const_cast<vrna_exp_param_t *>(exp_template_)) : vienna::scaled_pf_parameters();
+    exp_params_->model_details.dangles = dangles_;
+    pk_factors_ = scale_pk_penalties(exp_params_);
+    exp_interior_loops_.reset(new ExpInteriorLoops(exp_params_));
+
+    const cand_idx_t total_length = make_matrix_index(n_, table_span_, index_);
+    exp_hairpin_.assign(total_length, 0);
+    exp_stack_.assign(total_length, 0);
+    for (cand_pos_t i = 1; i <= n_; ++i) {
+        for (cand_pos_t j = i + TURN + 1; j <= std::min(n_, i + table_span_); ++j) {
+            const cand_idx_t ij = index_[i] + j - i;
+            exp_hairpin_[ij] = compute_exp_hairpin(i, j);
+            exp_stack_[ij] = compute_exp_stack(i, j);
+        }
+    }
+}
+
+} // namespace cparty
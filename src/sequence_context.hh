@@ -0,0 +1,102 @@
+#ifndef SEQUENCE_CONTEXT_HH_
+#define SEQUENCE_CONTEXT_HH_
+
+#include "base_types.hh"
+#include "interior_loops.hh"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "ViennaRNA/params/basic.h"
+}
+
+namespace cparty {
+
+// Boltzmann factors of the pseudoknot penalties of h_globals.hh under the model of one partition function parameter set
+struct PkBoltzmannFactors {
+    double PS_penalty = 1;
+    double PSM_penalty = 1;
+    double PSP_penalty = 1;
+    double PB_penalty = 1;
+    double PUP_penalty = 1;
+    double PPS_penalty = 1;
+
+    double a_penalty = 1;
+    double b_penalty = 1;
+    double c_penalty = 1;
+
+    double ap_penalty = 1;
+    double bp_penalty = 1;
+    double cp_penalty = 1;
+};
+
+// Everything a restricted fold needs that depends on the sequence but not on the input structure: the encoded sequence,
+// the energy parameters and the Boltzmann factors of hairpins and stacks. It is built once per sequence and shared
+// read-only by the MFE and partition function folds of every hotspot, also when they run on several threads.
+class SequenceContext {
+  public:
+    // The hairpin and stack factors of the pairs spanning at most table_span (every pair for 0, none for a negative span)
+    // are tabulated; the others are evaluated on each call, so a local fold or a window scan need not hold n^2 factors
+    SequenceContext(const std::string &seq, int dangles, cand_pos_t table_span = 0);
+    // the same on copies of the given parameter sets instead of ViennaRNA's global one
+    SequenceContext(const std::string &seq, int dangles, const vrna_param_t *params, const vrna_exp_param_t *exp_params,
+                    cand_pos_t table_span = 0);
+    ~SequenceContext();
+
+    SequenceContext(const SequenceContext &) = delete;
+    SequenceContext &operator=(const SequenceContext &) = delete;
+
+    const std::string &sequence() const { return seq_; }
+    cand_pos_t length() const { return n_; }
+
+    short *S() const { return S_; }
+    short *S1() const { return S1_; }
+    vrna_param_t *params() const { return params_; }
+
+    // The partition function parameters and tables are only built for the first fold that asks for them, so contexts
+    // used for MFE folds alone never pay for them
+    vrna_exp_param_t *exp_params() const;
+    const PkBoltzmannFactors &pk_boltzmann_factors() const;
+
+    // the interior loop tables of params() and exp_params()
+    const InteriorLoops &interior_loops() const { return *interior_loops_; }
+    const ExpInteriorLoops &exp_interior_loops() const;
+
+    // unscaled Boltzmann factor of the hairpin closed by (i,j); 0 when i and j cannot pair
+    pf_t exp_hairpin(cand_pos_t i, cand_pos_t j) const;
+
+    // unscaled Boltzmann factor of the stack (i,j) on (i+1,j-1); 0 when either pair is impossible
+    pf_t exp_stack(cand_pos_t i, cand_pos_t j) const;
+
+  private:
+    std::string seq_;
+    cand_pos_t n_;
+    int dangles_;
+    cand_pos_t table_span_;
+
+    short *S_;
+    short *S1_;
+    vrna_param_t *params_;
+    const vrna_exp_param_t *exp_template_ = nullptr;
+    std::unique_ptr<InteriorLoops> interior_loops_;
+
+    mutable std::once_flag pf_ready_;
+    mutable vrna_exp_param_t *exp_params_ = nullptr;
+    mutable PkBoltzmannFactors pk_factors_;
+    mutable std::unique_ptr<ExpInteriorLoops> exp_interior_loops_;
+    mutable std::vector<cand_idx_t> index_;
+    mutable std::vector<pf_t> exp_hairpin_;
+    mutable std::vector<pf_t> exp_stack_;
+
+    void build_pf_tables() const;
+
+    pf_t compute_exp_hairpin(cand_pos_t i, cand_pos_t j) const;
+
+    pf_t compute_exp_stack(cand_pos_t i, cand_pos_t j) const;
+};
+
+} // namespace cparty
+
+#endif
@@ -0,0 +1,226 @@
+#include "simd_kernels.hh"
+
+#include <algorithm>
+#include <initializer_list>
+
+extern "C" {
+#include "ViennaRNA/params/constants.h"
+#include "ViennaRNA/utils/cpu.h"
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPARTY_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Every sum_product kernel keeps the 8 partial sums of the interface, as 8 scalars, 4 SSE2, 2 AVX2 or 1 AVX-512
+ * register, and multiplies before it adds: this file is built with -ffp-contract=off, as a fused multiply-add rounds
+ * once where the plain kernel rounds twice. The min_sum kernels are exact in any order.
+ */
+
+namespace cparty {
+namespace simd {
+
+namespace {
+
+constexpr int kLanes = 8;
+
+// Adds the products of the tail that does not fill all lanes and combines the partial sums, the same way for all kernels
+pf_t finish(pf_t partial[kLanes], const pf_t *a, const pf_t *b, cand_pos_t start, cand_pos_t len) {
+    for (cand_pos_t t = start; t < len; ++t)
+        partial[t % kLanes] += a[t] * b[t];
+    return ((partial[0] + partial[1]) + (partial[2] + partial[3])) + ((partial[4] + partial[5]) + (partial[6] + partial[7]));
+}
+
+pf_t sum_product_plain(const pf_t *a, const pf_t *b, cand_pos_t len) {
+    pf_t partial[kLanes] = {0, 0, 0, 0, 0, 0, 0, 0};
+    const cand_pos_t blocks = len - len % kLanes;
+    for (cand_pos_t t = 0; t < blocks; t += kLanes) {
+        for (int lane = 0; lane < kLanes; ++lane)
+            partial[lane] += a[t + lane] * b[t + lane];
+    }
+    return finish(partial, a, b, blocks, len);
+}
+
+#ifdef CPARTY_X86_KERNELS
+
+__attribute__((target("sse2"))) pf_t sum_product_sse2(const pf_t *a, const pf_t *b, cand_pos_t len) {
+    __m128d sum[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    const cand_pos_t blocks = len - len % kLanes;
+    for (cand_pos_t t = 0; t < blocks; t += kLanes) {
+        for (int r = 0; r < 4; ++r)
+            sum[r] = _mm_add_pd(sum[r], _mm_mul_pd(_mm_loadu_pd(a + t + 2 * r), _mm_loadu_pd(b + t + 2 * r)));
+    }
+    pf_t partial[kLanes];
+    for (int r = 0; r < 4; ++r)
+        _mm_storeu_pd(partial + 2 * r, sum[r]);
+    return finish(partial, a, b, blocks, len);
+}
+
+__attribute__((target("avx2"))) pf_t sum_product_avx2(const pf_t *a, const pf_t *b, cand_pos_t len) {
+    __m256d low = _mm256_setzero_pd(), high = _mm256_setzero_pd();
+    const cand_pos_t blocks = len - len % kLanes;
+    for (cand_pos_t t = 0; t < blocks; t += kLanes) {
+        low = _mm256_add_pd(low, _mm256_mul_pd(_mm256_loadu_pd(a + t), _mm256_loadu_pd(b + t)));
+        high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_loadu_pd(a + t + 4), _mm256_loadu_pd(b + t + 4)));
+    }
+    pf_t partial[kLanes];
+    _mm256_storeu_pd(partial, low);
+    _mm256_storeu_pd(partial + 4, high);
+    return finish(partial, a, b, blocks, len);
+}
+
+__attribute__((target("avx512f"))) pf_t sum_product_avx512(const pf_t *a, const pf_t *b, cand_pos_t len) {
+    __m512d sum = _mm512_setzero_pd();
+    const cand_pos_t blocks = len - len % kLanes;
+    for (cand_pos_t t = 0; t < blocks; t += kLanes)
+        sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_loadu_pd(a + t), _mm512_loadu_pd(b + t)));
+    pf_t partial[kLanes];
+    _mm512_storeu_pd(partial, sum);
+    return finish(partial, a, b, blocks, len);
+}
+
+#endif
+
+static_assert(sizeof(energy_t) == 4, "the min_sum kernels load energies as 32 bit lanes");
+
+energy_t min_sum_plain(const energy_t *a, const energy_t *b, cand_pos_t len) {
+    energy_t lowest = INF;
+    for (cand_pos_t t = 0; t < len; ++t)
+        lowest = std::min(lowest, (energy_t)(a[t] + b[t]));
+    return lowest;
+}
+
+#ifdef CPARTY_X86_KERNELS
+
+// SSE2 has no signed 32 bit minimum, so the lanes pick with a compare
+__attribute__((target("sse2"))) energy_t min_sum_sse2(const energy_t *a, const energy_t *b, cand_pos_t len) {
+    __m128i lowest = _mm_set1_epi32(INF);
+    const cand_pos_t blocks = len - len % 4;
+    for (cand_pos_t t = 0; t < blocks; t += 4) {
+        const __m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(a + t)), _mm_loadu_si128((const __m128i *)(b + t)));
+        const __m128i lower = _mm_cmplt_epi32(sum, lowest);
+        lowest = _mm_or_si128(_mm_and_si128(lower, sum), _mm_andnot_si128(lower, lowest));
+    }
+    energy_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, lowest);
+    energy_t result = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+    return std::min(result, min_sum_plain(a + blocks, b + blocks, len - blocks));
+}
+
+__attribute__((target("avx2"))) energy_t min_sum_avx2(const energy_t *a, const energy_t *b, cand_pos_t len) {
+    __m256i lowest = _mm256_set1_epi32(INF);
+    const cand_pos_t blocks = len - len % 8;
+    for (cand_pos_t t = 0; t < blocks; t += 8)
+        lowest = _mm256_min_epi32(lowest, _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(a + t)), _mm256_loadu_si256((const __m256i *)(b + t))));
+    energy_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, lowest);
+    energy_t result = *std::min_element(lanes, lanes + 8);
+    return std::min(result, min_sum_plain(a + blocks, b + blocks, len - blocks));
+}
+
+__attribute__((target("avx512f"))) energy_t min_sum_avx512(const energy_t *a, const energy_t *b, cand_pos_t len) {
+    __m512i lowest = _mm512_set1_epi32(INF);
+    const cand_pos_t blocks = len - len % 16;
+    for (cand_pos_t t = 0; t < blocks; t += 16)
+        lowest = _mm512_min_epi32(lowest, _mm512_add_epi32(_mm512_loadu_si512(a + t), _mm512_loadu_si512(b + t)));
+    return std::min((energy_t)_mm512_reduce_min_epi32(lowest), min_sum_plain(a + blocks, b + blocks, len - blocks));
+}
+
+#endif
+
+using SumProduct = pf_t (*)(const pf_t *, const pf_t *, cand_pos_t);
+
+SumProduct kernel_function(Kernel kernel) {
+    switch (kernel) {
+#ifdef CPARTY_X86_KERNELS
+    case Kernel::sse2:
+        return &sum_product_sse2;
+    case Kernel::avx2:
+        return &sum_product_avx2;
+    case Kernel::avx512:
+        return &sum_product_avx512;
+#endif
+    default:
+        return &sum_product_plain;
+    }
+}
+
+using MinSum = energy_t (*)(const energy_t *, const energy_t *, cand_pos_t);
+
+MinSum min_sum_function(Kernel kernel) {
+    switch (kernel) {
+#ifdef CPARTY_X86_KERNELS
+    case Kernel::sse2:
+        return &min_sum_sse2;
+    case Kernel::avx2:
+        return &min_sum_avx2;
+    case Kernel::avx512:
+        return &min_sum_avx512;
+#endif
+    default:
+        return &min_sum_plain;
+    }
+}
+
+} // namespace
+
+bool is_supported(Kernel kernel) {
+    if (kernel == Kernel::plain) return true;
+#ifdef CPARTY_X86_KERNELS
+    static const unsigned int capabilities = vrna_cpu_simd_capabilities();
+    switch (kernel) {
+    case Kernel::sse2:
+        return capabilities & VRNA_CPU_SIMD_SSE2;
+    case Kernel::avx2:
+        return capabilities & VRNA_CPU_SIMD_AVX2;
+    case Kernel::avx512:
+        return capabilities & VRNA_CPU_SIMD_AVX512F;
+    default:
+        return false;
+    }
+#else
+    return false;
+#endif
+}
+
+Kernel best_kernel() {
+    static const Kernel best = [] {
+        for (Kernel kernel : {Kernel::avx512, Kernel::avx2, Kernel::sse2}) {
+            if (is_supported(kernel)) return kernel;
+        }
+        return Kernel::plain;
+    }();
+    return best;
+}
+
+const char *kernel_name(Kernel kernel) {
+    switch (kernel) {
+    case Kernel::sse2:
+        return "SSE2";
+    case Kernel::avx2:
+        return "AVX2";
+    case Kernel::avx512:
+        return "AVX-512";
+    default:
+        return "plain";
+    }
+}
+
+pf_t sum_product(const pf_t *a, const pf_t *b, cand_pos_t len) {
+    static const SumProduct best = kernel_function(best_kernel());
+    return best(a, b, len);
+}
+
+pf_t sum_product(Kernel kernel, const pf_t *a, const pf_t *b, cand_pos_t len) { return kernel_function(kernel)(a, b, len); }
+
+energy_t min_sum(const energy_t *a, const energy_t *b, cand_pos_t len) {
+    static const MinSum best = min_sum_function(best_kernel());
+    return best(a, b, len);
+}
+
+energy_t min_sum(Kernel kernel, const energy_t *a, const energy_t *b, cand_pos_t len) { return min_sum_function(kernel)(a, b, len); }
+
+} // namespace simd
+} // namespace cparty
@@ -0,0 +1,38 @@
+#ifndef SIMD_KERNELS_HH_
+#define SIMD_KERNELS_HH_
+
+#include "base_types.hh"
+
+namespace cparty {
+namespace simd {
+
+enum class Kernel { plain, sse2, avx2, avx512 };
+
+// The widest kernel this machine runs, as reported by the CPU detection of ViennaRNA; picked once per process
+Kernel best_kernel();
+
+// Whether this build and machine can run kernel
+bool is_supported(Kernel kernel);
+
+const char *kernel_name(Kernel kernel);
+
+// The sum of a[t] * b[t] over t < len, with the best kernel. The products go to 8 partial sums, product t to sum t % 8,
+// which are added up in a fixed order at the end, so every kernel returns the same bits and a fold does not depend on
+// the instruction set of the machine it runs on.
+pf_t sum_product(const pf_t *a, const pf_t *b, cand_pos_t len);
+
+// The same with the given kernel, which must be supported
+pf_t sum_product(Kernel kernel, const pf_t *a, const pf_t *b, cand_pos_t len);
+
+// The lowest of INF and a[t] + b[t] over t < len, with the best kernel: the min-plus step of the MFE splits, which start
+// from INF. Integer sums do not round, so every kernel returns the energy of the scalar loop, in any order; the
+// energies stay far enough below INT_MAX that INF + INF does not wrap.
+energy_t min_sum(const energy_t *a, const energy_t *b, cand_pos_t len);
+
+// The same with the given kernel, which must be supported
+energy_t min_sum(Kernel kernel, const energy_t *a, const energy_t *b, cand_pos_t len);
+
+} // namespace simd
+} // namespace cparty
+
+#endif
@@ -1,9 +1,9 @@
 #include "sparse_tree.hh"
+#include <algorithm>
 #include <iomanip>
+#include <utility>
 #include <vector>
 
-#define maxSize 14 // 2^14 for sparse table
-
 sparse_tree::sparse_tree(std::string structure, int n) {
     this->n = n;
     this->structure = structure;
@@ -12,16 +12,15 @@ sparse_tree::sparse_tree(std::string structure, int n) {
     FAI.resize(2 * (n + 1), -1);
     level.resize((n + 1), -1);
     up.resize(n + 1);
-    logn.resize(2 * (n + 1));
+    logn.resize(2 * (n + 1), 0);
     create_tree(n, structure);
     preprocess();
     ptr = 0;
 
-    dfs(0, -1, 0);
+    dfs(0);
     // depthArr.resize(euler.size());
     makeArr();
     level.clear();
-    sparse_table.resize(euler.size(), std::vector<int>(maxSize, -1));
     buildSparseTable(euler.size());
 }
 
@@ -45,10 +44,12 @@ int sparse_tree::query(int l, int r) {
     int dx = logn[d];
     if (l == r) return l;
 
-    if (depthArr[sparse_table[l][dx]] > depthArr[sparse_table[r - p2[dx]][dx]])
-        return sparse_table[r - p2[dx]][dx];
+    const int left = sparse_table[(size_t)l * levels + dx];
+    const int right = sparse_table[(size_t)(r - (1 << dx)) * levels + dx];
+    if (depthArr[left] > depthArr[right])
+        return right;
     else
-        return sparse_table[l][dx];
+        return left;
 }
 
 /**
@@ -66,17 +67,12 @@ int sparse_tree::LCA(int i, int j) {
 }
 
 /**
- * Fill the array p2 with the powers of 2 so that we do not need to recalculate them
+ * Fill the array logn with the floor of log2 of every distance within the euler walk so that we do not need to recalculate them
  */
 void sparse_tree::preprocess() {
-    // memorizing powers of 2
-    p2[0] = 1;
-    for (int i = 1; i < maxSize; i++)
-        p2[i] = p2[i - 1] * 2;
-
     // memorizing all log(n) values
     int val = 1, ptr = 0;
-    for (int i = 1; i < 2 * n; i++) {
+    for (int i = 1; i < (int)logn.size(); i++) {
         logn[i] = ptr - 1;
         if (val == i) {
             val *= 2;
@@ -128,20 +124,33 @@ void sparse_tree::create_tree(int n, std::string structure) {
 /**
  * Euler Walk ( preorder traversal)
  * converting tree to linear depthArray
+ * The walk keeps its own stack, as the nesting of a long structure is deeper than the call stack allows
  * Time Complexity : O(n)
  * */
-void sparse_tree::dfs(int cur, int prev, int dep) {
-
-    if (FAI[cur] == -1) FAI[cur] = ptr;
-    level[cur] = dep;
-    euler.push_back(cur);
-    ptr++;
-    for (auto x : tree[cur].bases) {
-        if (x != prev) {
-            dfs(x, cur, dep + 1);
-            euler.push_back(cur);
-            ptr++;
+void sparse_tree::dfs(int root) {
+    // the node and the next of its bases to visit
+    std::vector<std::pair<int, size_t>> stack;
+    FAI[root] = ptr++;
+    level[root] = 0;
+    euler.push_back(root);
+    stack.push_back({root, 0});
+    while (!stack.empty()) {
+        std::pair<int, size_t> &top = stack.back();
+        const int cur = top.first;
+        if (top.second == tree[cur].bases.size()) {
+            stack.pop_back();
+            if (!stack.empty()) {
+                euler.push_back(stack.back().first);
+                ptr++;
+            }
+            continue;
         }
+        const int x = tree[cur].bases[top.second++];
+        if (FAI[x] == -1) FAI[x] = ptr;
+        level[x] = level[cur] + 1;
+        euler.push_back(x);
+        ptr++;
+        stack.push_back({x, 0});
     }
 }
 
@@ -149,18 +158,21 @@ void sparse_tree::dfs(int cur, int prev, int dep) {
  * Build the sparse table which allows for constant time queries through precomputed saved values
  */
 void sparse_tree::buildSparseTable(int n) {
+    // enough levels for the longest range of the walk
+    levels = logn[std::max(n - 1, 1)] + 1;
+    sparse_table.assign((size_t)n * levels, -1);
 
     // filling base case values
     for (int i = 1; i < n; i++)
-        sparse_table[i - 1][0] = (depthArr[i] > depthArr[i - 1]) ? i - 1 : i;
+        sparse_table[(size_t)(i - 1) * levels] = (depthArr[i] > depthArr[i - 1]) ? i - 1 : i;
 
     // dp to fill sparse table
-    for (int l = 1; l < maxSize; l++) {
-        for (int i = 0; i < n; i++) {
-            if (sparse_table[i][l - 1] != -1 && sparse_table[i + p2[l - 1]][l - 1] != -1)
-                sparse_table[i][l] = (depthArr[sparse_table[i][l - 1]] > depthArr[sparse_table[i + p2[l - 1]][l - 1]])
-                                         ? sparse_table[i + p2[l - 1]][l - 1]
-                                         : sparse_table[i][l - 1];
+    for (int l = 1; l < levels; l++) {
+        for (int i = 0; i + (1 << (l - 1)) < n; i++) {
+            const int left = sparse_table[(size_t)i * levels + l - 1];
+            const int right = sparse_table[(size_t)(i + (1 << (l - 1))) * levels + l - 1];
+            if (left != -1 && right != -1)
+                sparse_table[(size_t)i * levels + l] = (depthArr[left] > depthArr[right]) ? right : left;
             else
                 break;
         }
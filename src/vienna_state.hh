@@ -0,0 +1,42 @@
+#ifndef VIENNA_STATE_HH_
+#define VIENNA_STATE_HH_
+
+#include <mutex>
+
+extern "C" {
+#include "ViennaRNA/pair_mat.h"
+#include "ViennaRNA/params/basic.h"
+}
+
+namespace cparty {
+namespace vienna {
+
+// ViennaRNA keeps some state outside the fold objects: its parameter constructors bump a shared counter, and pair_mat.h
+// gives every translation unit its own static pair matrix. Fold objects built on several threads go through these helpers.
+
+inline std::mutex &state_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+inline vrna_param_t *scaled_parameters() {
+    std::lock_guard<std::mutex> lock(state_mutex());
+    return scale_parameters();
+}
+
+inline vrna_exp_param_t *scaled_pf_parameters() {
+    std::lock_guard<std::mutex> lock(state_mutex());
+    return scale_pf_parameters();
+}
+
+// Fills the pair matrix of the calling translation unit once, so no thread rewrites it while another one reads it.
+// The matrix only depends on the energy set, which CParty never changes.
+static inline void make_pair_matrix_once() {
+    static std::once_flag filled;
+    std::call_once(filled, make_pair_matrix);
+}
+
+} // namespace vienna
+} // namespace cparty
+
+#endif
@@ -0,0 +1,93 @@
+#include "part_func.hh"
+#include "matrix_index.hh"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+ * Sliding window scan over the grammar of W_final_pf, as RNAplfold does for pseudoknot-free folds.
+ *
+ * The inside cell (i,j) only depends on the nucleotides i..j and the restrictions, so it is the same in every window
+ * holding it: the scan fills the cells of column e once, when e enters, and the ring index of the matrices hands the
+ * row of the position that just left the last window to the new one. Only the exterior loop, the outside pass and the
+ * probabilities are computed per window.
+ */
+
+namespace {
+
+// The restrictions of start..end as a structure of their own; a pair with one end outside the window is dropped
+std::string window_structure(const std::string &structure, cand_pos_t start, cand_pos_t end) {
+    std::string window = structure.substr(start - 1, end - start + 1);
+    std::vector<cand_pos_t> open;
+    for (cand_pos_t k = 0; k < (cand_pos_t)window.size(); ++k) {
+        if (window[k] == '(') open.push_back(k);
+        if (window[k] == ')') {
+            if (open.empty())
+                window[k] = '.';
+            else
+                open.pop_back();
+        }
+    }
+    for (cand_pos_t k : open)
+        window[k] = '.';
+    return window;
+}
+
+} // namespace
+
+// Gives row i, and column i of the column copies, back the values the constructor starts every cell with
+void W_final_pf::clear_row(cand_pos_t i) {
+    const cand_idx_t first = index[i];
+    const cand_idx_t last = index[i] + std::min(max_span, n - i) + 1;
+    for (std::vector<pf_t> *matrix : {&VM, &WM, &WIP, &VP, &VPL, &VPR, &WMBP, &WMBW, &BE})
+        std::fill(matrix->begin() + first, matrix->begin() + last, 0);
+    std::fill(stems.begin() + first, stems.begin() + last, StemCell());
+    std::fill(branches.begin() + first, branches.begin() + last, BranchCell());
+    std::fill(WI.begin() + first, WI.begin() + last, scale[1]);
+    // column i of the column copies takes the slot of column i-rows in the same way
+    const cand_idx_t column_first = column_index[n + 1 - i];
+    const cand_idx_t column_last = column_first + std::min(max_span, i - 1) + 1;
+    for (std::vector<pf_t> *column : {&WM_stems_by_column, &WI_stems_by_column, &WIP_stems_by_column, &branches_by_column, &WMp_by_column,
+                                      &WIP_by_column, &WMBW_WI_by_column})
+        std::fill(column->begin() + column_first, column->begin() + column_last, 0);
+}
+
+void W_final_pf::scan_windows(sparse_tree &tree, pf_t cutoff, std::ostream &out) {
+    cparty::require_pairs_within_span(tree.tree, n, max_span);
+    const cand_pos_t window = window_size > 0 ? window_size : n;
+
+    // the summed probabilities of the pairs of the rows still inside a window, addressed like the matrices
+    std::vector<pf_t> sums(total_length, 0);
+    auto write_row = [&](cand_pos_t i) {
+        for (cand_pos_t j = i + 1; j <= std::min(n, i + max_span); ++j) {
+            // the windows holding i.j start from j-window+1 to i, as far as the sequence allows
+            const cand_pos_t windows = std::min(i, n - window + 1) - std::max<cand_pos_t>(1, j - window + 1) + 1;
+            const pf_t p = sums[index[i] + j - i] / windows;
+            if (p >= cutoff) out << i << " " << j << " " << p << "\n";
+        }
+    };
+
+    for (cand_pos_t end = 1; end <= n; ++end) {
+        clear_row(end);
+        std::fill(sums.begin() + index[end], sums.begin() + index[end] + std::min(max_span, n - end) + 1, 0);
+        for (cand_pos_t i = end; i >= std::max<cand_pos_t>(1, end - max_span); --i)
+            fill_cell(i, end, tree, true);
+        if (end < window) continue;
+
+        const cand_pos_t start = end - window + 1;
+        sparse_tree ext_tree(window_structure(tree.structure, start, end), window);
+        run_partition_exterior(ext_tree, start, end);
+        compute_outside(tree, ext_tree, start, end);
+        compute_probabilities(tree, start, end);
+        for (cand_pos_t i = start; i <= end; ++i) {
+            for (cand_pos_t j = i + 1; j <= std::min(end, i + max_span); ++j)
+                sums[index[i] + j - i] += probs[index[i] + j - i];
+        }
+        // no later window holds start
+        write_row(start);
+    }
+    for (cand_pos_t i = n - window + 2; i <= n; ++i)
+        write_row(i);
+    out.flush();
+}
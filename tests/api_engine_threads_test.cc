@@ -0,0 +1,74 @@
+#include "CPartyAPI.hh"
+
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Case {
+    std::string seq;
+    std::string db_base;
+    std::string db_full;
+};
+
+bool same_value(double a, double b) { return (std::isnan(a) && std::isnan(b)) || a == b; }
+
+} // namespace
+
+int main() {
+    const std::vector<Case> cases = {
+        {"GGCGGAAAAACCGGCAAAAACCGCCAAAAACGGGUAAUAAGCUGGAAAAAGCCCG", "(((((...............))))).....(((((...............)))))",
+         "(((((.....[[[[[.....))))).....(((((.....]]]]].....)))))"},
+        {"GGGGAAACCCCAUAUGGGAAACCCAAAGGGAAACCC", "((((...)))).........................", "((((...))))........................."},
+        {"ACGUACGUAGCUAGCUAGCAUCGAUCGAUGCAUGCAUCGAUCGAUGC", "", "..............................................."},
+    };
+
+    std::vector<double> cond_expected, energy_expected;
+    for (const Case &tc : cases) {
+        cond_expected.push_back(get_cond_log_prob(tc.seq, tc.db_base));
+        energy_expected.push_back(get_structure_energy(tc.seq, tc.db_full));
+    }
+    if (!std::isfinite(cond_expected[0]) || !std::isfinite(energy_expected[0])) {
+        std::cerr << "expected finite values for the first case" << std::endl;
+        return 1;
+    }
+
+    // Threads that share the default engine and threads with engines of their own all run at once
+    std::atomic<int> failed(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 6; ++t) {
+        workers.emplace_back([&, t] {
+            const cparty::Engine own;
+            const cparty::Engine &engine = t % 2 == 0 ? cparty::Engine::shared() : own;
+            for (int round = 0; round < 2; ++round) {
+                for (size_t k = 0; k < cases.size(); ++k) {
+                    const Case &tc = cases[(k + t) % cases.size()];
+                    const size_t c = (k + t) % cases.size();
+                    if (!same_value(engine.cond_log_prob(tc.seq, tc.db_base), cond_expected[c]) ||
+                        !same_value(engine.structure_energy(tc.seq, tc.db_full), energy_expected[c])) {
+                        ++failed;
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+    if (failed != 0) {
+        std::cerr << "api_engine_threads_test: " << failed << " concurrent calls differ from the serial ones" << std::endl;
+        return 1;
+    }
+
+    const cparty::Engine missing("params/no_such_file.par");
+    if (missing.ok() || !std::isnan(missing.structure_energy(cases[0].seq, cases[0].db_full))) {
+        std::cerr << "expected an engine without parameters to return NaN" << std::endl;
+        return 1;
+    }
+
+    std::cout << "api_engine_threads_test: checked=" << cases.size() << std::endl;
+    return 0;
+}
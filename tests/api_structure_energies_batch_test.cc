@@ -0,0 +1,71 @@
+#include "CPartyAPI.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool same_energy(double a, double b) {
+    if (std::isnan(a) || std::isnan(b)) return std::isnan(a) && std::isnan(b);
+    return std::fabs(a - b) <= 1e-9;
+}
+
+} // namespace
+
+int main() {
+    const std::string seq = "GGCGGAAAAACCGGCAAAAACCGCCAAAAACGGGTAAUAAGCTGGAAAAAGCCCG";
+    const std::vector<std::string> structures = {
+        "(((((.....[[[[[.....))))).....(((((.....]]]]].....)))))",
+        "(((((.....(((((.....))))).....))))).....(((((.....)))))",
+        ".......................................................",
+        "(((((...............))))).....(((((...............)))))",
+        "(((((.....[[[[[.....))))).....(((((.....]]]]].....))))",  // length mismatch
+        "(((((.....{{{{{.....))))).....(((((.....}}}}}.....)))))", // unsupported bracket family
+        "((((((....[[[[[.....))))).....(((((.....]]]]].....)))))", // unbalanced
+    };
+
+    size_t failed = 0;
+    for (int dangles : {0, 1, 2}) {
+        cparty::EnergyEvalOptions options;
+        options.dangles = dangles;
+        std::vector<double> expected;
+        for (const std::string &structure : structures)
+            expected.push_back(get_structure_energy(seq, structure, options));
+
+        for (int threads : {1, 4}) {
+            const std::vector<double> energies = get_structure_energies(seq, structures, options, threads);
+            if (energies.size() != structures.size()) {
+                std::cerr << "expected " << structures.size() << " energies, got " << energies.size() << std::endl;
+                return 1;
+            }
+            for (size_t k = 0; k < structures.size(); ++k) {
+                if (!same_energy(energies[k], expected[k])) {
+                    std::cerr << "dangles=" << dangles << " threads=" << threads << " structure " << k << ": batch=" << energies[k]
+                              << " single=" << expected[k] << std::endl;
+                    ++failed;
+                }
+            }
+        }
+    }
+
+    const std::vector<double> rejected = get_structure_energies("GGCGXAAAACCGCC", {"((((.....)))).", ".............."}, cparty::EnergyEvalOptions{});
+    if (rejected.size() != 2 || !std::all_of(rejected.begin(), rejected.end(), [](double e) { return std::isnan(e); })) {
+        std::cerr << "expected NaN for every structure of an invalid sequence" << std::endl;
+        ++failed;
+    }
+    if (!get_structure_energies(seq, {}, cparty::EnergyEvalOptions{}).empty()) {
+        std::cerr << "expected no energies for no structures" << std::endl;
+        ++failed;
+    }
+
+    if (failed != 0) {
+        std::cerr << "api_structure_energies_batch_test: failed=" << failed << std::endl;
+        return 1;
+    }
+
+    std::cout << "api_structure_energies_batch_test: checked=" << structures.size() << std::endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "W_final.hh"
+#include "fixed_structure_loops.hh"
+#include "sparse_tree.hh"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Drops every pair of the structure whose left end is not a multiple of keep_every, so the rest becomes the input structure
+std::string thin_structure(const std::string &structure, int keep_every) {
+    std::string thinned = structure;
+    std::vector<int> open;
+    for (int i = 0; i < static_cast<int>(thinned.size()); ++i) {
+        if (thinned[i] == '(') open.push_back(i);
+        if (thinned[i] == ')') {
+            const int k = open.back();
+            open.pop_back();
+            if ((k + 1) % keep_every != 0) thinned[i] = thinned[k] = '.';
+        }
+    }
+    return thinned;
+}
+
+} // namespace
+
+// The structures W_final::hfold returns must score to the energy it reports for them, loop by loop
+int main() {
+    std::mt19937 generator(11);
+    int scored = 0, pseudoknotted = 0;
+    for (int c = 0; c < 20; ++c) {
+        const int n = 60 + static_cast<int>(generator() % 90);
+        std::string seq;
+        for (int i = 0; i < n; ++i)
+            seq += "ACGU"[generator() % 4];
+
+        const std::string unrestricted(n, '.');
+        sparse_tree unrestricted_tree(unrestricted, n);
+        W_final pk_free_mfe(seq, unrestricted, true, false, 2);
+        pk_free_mfe.hfold(unrestricted_tree);
+
+        for (int keep_every : {1, 2, 3, 5}) {
+            const std::string restricted = thin_structure(pk_free_mfe.structure, keep_every);
+            sparse_tree tree(restricted, n);
+            W_final mfe(seq, restricted, false, false, 2);
+            const energy_t energy = static_cast<energy_t>(std::lrint(mfe.hfold(tree) * 100));
+
+            cparty::EnergyEvalOptions options;
+            options.dangles = 2;
+            cparty::internal::LoopDecomposition loops;
+            if (!cparty::internal::decompose_fixed_structure(seq, mfe.structure, options, loops)) continue;
+
+            energy_t sum = 0;
+            for (const cparty::internal::LoopEnergy &loop : loops.loops)
+                sum += loop.energy;
+            if (loops.total() != energy || sum != energy) {
+                std::cerr << "loop decomposition scores " << loops.total() << " (loops " << sum << ") instead of " << energy << " for " << seq
+                          << " " << mfe.structure << std::endl;
+                return 1;
+            }
+            ++scored;
+            if (mfe.structure.find('[') != std::string::npos) ++pseudoknotted;
+        }
+    }
+    if (scored == 0 || pseudoknotted == 0) {
+        std::cerr << "no structure was scored by the loop decomposition" << std::endl;
+        return 1;
+    }
+    return 0;
+}
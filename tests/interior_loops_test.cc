@@ -0,0 +1,66 @@
+#include "interior_loops.hh"
+#include "sequence_context.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+// Compares the tables with E_IntLoop and exp_E_IntLoop for every pair of types and every four bases around the loop
+bool matches_vienna(const vrna_param_t *P, const vrna_exp_param_t *exp_P, const cparty::InteriorLoops &loops,
+                    const cparty::ExpInteriorLoops &exp_loops) {
+    for (int type = 1; type <= 7; ++type) {
+        for (int type_2 = 0; type_2 <= 7; ++type_2) {
+            for (int si1 = 0; si1 <= 4; ++si1) {
+                for (int sj1 = 0; sj1 <= 4; ++sj1) {
+                    const cparty::ClosingPair c = loops.closing(type, si1, sj1);
+                    const cparty::ExpClosingPair exp_c = exp_loops.closing(type, si1, sj1);
+                    for (int sp1 = 0; sp1 <= 4; ++sp1) {
+                        for (int sq1 = 0; sq1 <= 4; ++sq1) {
+                            // beyond MAXLOOP on one side too, where E_IntLoop extrapolates
+                            for (int u1 = 0; u1 <= MAXLOOP + 2; ++u1) {
+                                for (int u2 = 0; u2 <= MAXLOOP + 2; ++u2) {
+                                    const energy_t energy = loops.energy(c, u1, u2, type_2, sp1, sq1);
+                                    const energy_t expected =
+                                        E_IntLoop(u1, u2, type, type_2, si1, sj1, sp1, sq1, const_cast<vrna_param_t *>(P));
+                                    if (energy != expected) {
+                                        std::cerr << "interior loop " << u1 << "x" << u2 << " of types " << type << "," << type_2 << ": " << energy
+                                                  << " instead of " << expected << std::endl;
+                                        return false;
+                                    }
+                                    // exp_E_IntLoop only reads its tables up to loops of MAXLOOP
+                                    if (u1 + u2 > MAXLOOP) continue;
+                                    const pf_t factor = exp_loops.factor(exp_c, u1, u2, type_2, sp1, sq1);
+                                    const pf_t exp_expected =
+                                        exp_E_IntLoop(u1, u2, type, type_2, si1, sj1, sp1, sq1, const_cast<vrna_exp_param_t *>(exp_P));
+                                    if (std::memcmp(&factor, &exp_expected, sizeof(pf_t)) != 0) {
+                                        std::cerr << "interior loop " << u1 << "x" << u2 << " of types " << type << "," << type_2
+                                                  << ": Boltzmann factor " << factor << " instead of " << exp_expected << std::endl;
+                                        return false;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    const cparty::SequenceContext context("GGGAAACCCAGCUUCGGCUG", 2);
+    if (!matches_vienna(context.params(), context.exp_params(), context.interior_loops(), context.exp_interior_loops())) return 1;
+
+    // GU pairs only close stacks under noGUclosure
+    vrna_exp_param_t *no_gu = vrna_exp_params_copy(context.exp_params());
+    no_gu->model_details.noGUclosure = 1;
+    const cparty::ExpInteriorLoops no_gu_loops(no_gu);
+    const bool no_gu_matches = matches_vienna(context.params(), no_gu, context.interior_loops(), no_gu_loops);
+    free(no_gu);
+    return no_gu_matches ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+#include "W_final.hh"
+#include "part_func.hh"
+#include "sparse_tree.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct LocalFold {
+    std::string structure;
+    double energy;
+    double pf_energy;
+    std::vector<double> probabilities; // pairs i<j in row order, 0 beyond the span
+    std::unordered_map<std::string, int> samples;
+};
+
+LocalFold run_fold(const std::string &seq, const std::string &restricted, bool pk_free, int dangles, int max_span, int threads = 1) {
+    const int n = static_cast<int>(seq.size());
+    sparse_tree tree(restricted, n);
+    W_final mfe(seq, restricted, pk_free, false, dangles, threads, max_span);
+    LocalFold fold;
+    fold.energy = mfe.hfold(tree);
+    fold.structure = mfe.structure;
+
+    std::string mutable_seq = seq;
+    std::string mutable_final = mfe.structure;
+    W_final_pf partition(mutable_seq, mutable_final, pk_free, false, false, dangles, fold.energy, 100, false, threads, 0, max_span);
+    fold.pf_energy = partition.hfold_pf(tree);
+    for (int i = 1; i <= n; ++i) {
+        for (int j = i + 1; j <= n; ++j)
+            fold.probabilities.push_back(partition.get_probability(i, j));
+    }
+    fold.samples = partition.structures;
+    return fold;
+}
+
+// The longest j-i a local fold must allow for a dot-bracket structure with () and [] pairs: the span of a pair, or of
+// the whole pseudoknot for pairs that cross
+int longest_span(const std::string &structure) {
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<int> round, square;
+    for (int j = 0; j < static_cast<int>(structure.size()); ++j) {
+        if (structure[j] == '(') round.push_back(j);
+        if (structure[j] == '[') square.push_back(j);
+        std::vector<int> *open = structure[j] == ')' ? &round : structure[j] == ']' ? &square : nullptr;
+        if (open == nullptr) continue;
+        pairs.push_back({open->back(), j});
+        open->pop_back();
+    }
+    // grow each pair into the region of every pair crossing it until nothing changes
+    std::vector<std::pair<int, int>> regions = pairs;
+    for (bool grown = true; grown;) {
+        grown = false;
+        for (auto &region : regions) {
+            for (const auto &other : regions) {
+                const bool crossing = (other.first < region.first && region.first < other.second && other.second < region.second)
+                                      || (region.first < other.first && other.first < region.second && region.second < other.second);
+                if (!crossing) continue;
+                region = {std::min(region.first, other.first), std::max(region.second, other.second)};
+                grown = true;
+            }
+        }
+    }
+    int longest = 0;
+    for (const auto &region : regions)
+        longest = std::max(longest, region.second - region.first);
+    return longest;
+}
+
+// Drops every pair of the structure whose left end is not a multiple of keep_every, so the rest becomes the input structure
+std::string thin_structure(const std::string &structure, int keep_every) {
+    std::string thinned = structure;
+    std::vector<int> open;
+    for (int i = 0; i < static_cast<int>(thinned.size()); ++i) {
+        if (thinned[i] == '(') open.push_back(i);
+        if (thinned[i] == ')') {
+            const int k = open.back();
+            open.pop_back();
+            if ((k + 1) % keep_every != 0) thinned[i] = thinned[k] = '.';
+        }
+    }
+    return thinned;
+}
+
+bool same_fold(const LocalFold &a, const LocalFold &b, const std::string &what, const std::string &seq) {
+    if (a.structure != b.structure || a.energy != b.energy) {
+        std::cerr << what << ": MFE differs for " << seq << ": " << a.structure << " (" << a.energy << ") vs " << b.structure << " (" << b.energy
+                  << ")" << std::endl;
+        return false;
+    }
+    if (std::fabs(a.pf_energy - b.pf_energy) > 1e-9 * std::fabs(a.pf_energy) + 1e-9) {
+        std::cerr << what << ": ensemble energy differs for " << seq << ": " << a.pf_energy << " vs " << b.pf_energy << std::endl;
+        return false;
+    }
+    for (size_t k = 0; k < a.probabilities.size(); ++k) {
+        if (std::fabs(a.probabilities[k] - b.probabilities[k]) > 1e-9) {
+            std::cerr << what << ": pair probability differs for " << seq << ": " << a.probabilities[k] << " vs " << b.probabilities[k]
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool check_case(const std::string &seq, const std::string &restricted, bool pk_free, int dangles) {
+    const int n = static_cast<int>(seq.size());
+    const LocalFold global = run_fold(seq, restricted, pk_free, dangles, 0);
+
+    // n-1 allows every pair but already stores the matrices banded
+    if (!same_fold(global, run_fold(seq, restricted, pk_free, dangles, n - 1), "span n-1", seq)) return false;
+
+    // the global MFE structure is still open to a fold limited to its own longest pair
+    const int needed = std::max(longest_span(global.structure), longest_span(restricted));
+    const LocalFold tight = run_fold(seq, restricted, pk_free, dangles, std::max(needed, TURN + 1));
+    if (tight.energy != global.energy) {
+        std::cerr << "span " << needed << " misses the MFE of " << seq << ": " << tight.energy << " vs " << global.energy << std::endl;
+        return false;
+    }
+
+    for (int max_span : {std::max(longest_span(restricted), 25), std::max(longest_span(restricted), 50)}) {
+        const LocalFold local = run_fold(seq, restricted, pk_free, dangles, max_span);
+        if (longest_span(local.structure) > max_span || local.energy < global.energy || local.pf_energy < global.pf_energy - 1e-9) {
+            std::cerr << "span " << max_span << " folds " << seq << " to " << local.structure << " (" << local.energy << ", ensemble "
+                      << local.pf_energy << ")" << std::endl;
+            return false;
+        }
+        for (const auto &sample : local.samples) {
+            if (longest_span(sample.first) > max_span) {
+                std::cerr << "span " << max_span << " samples " << sample.first << " for " << seq << std::endl;
+                return false;
+            }
+        }
+        if (!same_fold(local, run_fold(seq, restricted, pk_free, dangles, max_span, 3), "wavefront with span " + std::to_string(max_span), seq))
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 generator(16);
+    for (int c = 0; c < 4; ++c) {
+        std::string seq;
+        for (int i = 0; i < 90; ++i)
+            seq += "ACGU"[generator() % 4];
+        const int n = static_cast<int>(seq.size());
+        const std::string unrestricted(n, '.');
+
+        for (int dangles : {0, 1, 2}) {
+            if (!check_case(seq, unrestricted, true, dangles)) return 1;
+        }
+        if (!check_case(seq, unrestricted, false, 2)) return 1;
+
+        sparse_tree tree(unrestricted, n);
+        W_final pk_free_mfe(seq, unrestricted, true, false, 2);
+        pk_free_mfe.hfold(tree);
+        for (int keep_every : {2, 3}) {
+            if (!check_case(seq, thin_structure(pk_free_mfe.structure, keep_every), false, 2)) return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+if [[ $# -ne 2 ]]; then
+  echo "usage: $0 <cparty_binary> <multi_fasta>" >&2
+  exit 2
+fi
+
+binary="$1"
+input="$2"
+
+if [[ ! -x "$binary" ]]; then
+  echo "binary is not executable: $binary" >&2
+  exit 1
+fi
+
+tmp_dir="$(mktemp -d)"
+trap 'rm -rf "$tmp_dir"' EXIT
+
+# Folding every record in one process must give the same blocks as one process per record
+"$binary" --noPS -i "$input" >"$tmp_dir/batch.txt"
+
+awk -v dir="$tmp_dir" '/^>/ { n++ } n { print > (dir "/record_" sprintf("%03d", n) ".fa") }' "$input"
+: >"$tmp_dir/separate.txt"
+for record in "$tmp_dir"/record_*.fa; do
+  "$binary" --noPS -i "$record" >>"$tmp_dir/separate.txt"
+done
+
+if ! diff -u --text "$tmp_dir/separate.txt" "$tmp_dir/batch.txt"; then
+  echo "batch output differs from per-record runs" >&2
+  exit 1
+fi
+
+records="$(grep -c '^>' "$input")"
+blocks="$(grep -c '^>' "$tmp_dir/batch.txt")"
+if [[ "$records" -ne "$blocks" ]]; then
+  echo "expected $records record blocks, got $blocks" >&2
+  exit 1
+fi
+
+echo "multi-FASTA batch matches per-record runs ($records records)"
@@ -0,0 +1,109 @@
+#include "W_final.hh"
+#include "part_func.hh"
+#include "sparse_tree.hh"
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct ProbCase {
+    std::string seq;
+    std::string restricted;
+    bool pk_free;
+    int dangles;
+};
+
+// Pair frequencies of the sampled structures, the estimator the outside pass replaces
+std::vector<std::vector<double>> sampled_frequencies(const W_final_pf &partition, int n, int num_samples) {
+    std::vector<std::vector<double>> freq(n + 1, std::vector<double>(n + 1, 0));
+    for (const auto &it : partition.structures) {
+        std::vector<int> paren;
+        std::vector<int> sb;
+        for (int j = 0; j < n; ++j) {
+            const char c = it.first[j];
+            if (c == '(') paren.push_back(j + 1);
+            if (c == '[') sb.push_back(j + 1);
+            if (c == ')') {
+                freq[paren.back()][j + 1] += static_cast<double>(it.second) / num_samples;
+                paren.pop_back();
+            }
+            if (c == ']') {
+                freq[sb.back()][j + 1] += static_cast<double>(it.second) / num_samples;
+                sb.pop_back();
+            }
+        }
+    }
+    return freq;
+}
+
+bool check_case(const ProbCase &prob_case) {
+    const int n = static_cast<int>(prob_case.seq.size());
+    sparse_tree tree(prob_case.restricted, n);
+    W_final mfe(prob_case.seq, prob_case.restricted, prob_case.pk_free, false, prob_case.dangles);
+    const double energy = mfe.hfold(tree);
+
+    constexpr int kNumSamples = 20000;
+    std::string mutable_seq = prob_case.seq;
+    std::string mutable_final = mfe.structure;
+    W_final_pf partition(mutable_seq, mutable_final, prob_case.pk_free, false, false, prob_case.dangles, energy, kNumSamples, false);
+    partition.hfold_pf(tree);
+
+    const std::vector<std::vector<double>> freq = sampled_frequencies(partition, n, kNumSamples);
+    for (int i = 1; i <= n; ++i) {
+        double paired = 0;
+        for (int j = 1; j <= n; ++j) {
+            if (i == j) continue;
+            const double p = i < j ? partition.get_probability(i, j) : partition.get_probability(j, i);
+            if (!(p >= 0)) {
+                std::cerr << "invalid probability " << p << " for " << i << "," << j << " in " << prob_case.seq << std::endl;
+                return false;
+            }
+            paired += p;
+        }
+        if (paired > 1 + 1e-9) {
+            std::cerr << "base " << i << " is paired with probability " << paired << " in " << prob_case.seq << std::endl;
+            return false;
+        }
+        // pairs of the input structure are part of every structure of the ensemble
+        if (tree.tree[i].pair > i && std::fabs(partition.get_probability(i, tree.tree[i].pair) - 1) > 1e-6) {
+            std::cerr << "restricted pair " << i << "," << tree.tree[i].pair << " has probability " << partition.get_probability(i, tree.tree[i].pair)
+                      << " in " << prob_case.seq << std::endl;
+            return false;
+        }
+        for (int j = i + 1; j <= n; ++j) {
+            // four standard deviations of a frequency estimated from kNumSamples draws is at most 0.015
+            if (std::fabs(partition.get_probability(i, j) - freq[i][j]) > 0.03) {
+                std::cerr << "pair " << i << "," << j << " has probability " << partition.get_probability(i, j) << " but was sampled with frequency "
+                          << freq[i][j] << " in " << prob_case.seq << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    const std::string h_type = "GGGCAAAAGGCGAAAAGCCCAAAACGCC";
+    const std::string k_type = "GGCGGAAAAACCGGCAAAAACCGCCAAAAACGGGUAAUAAGCUGGAAAAAGCCCG";
+    const std::string long_seq = "UCGGUUAUCUUCGGAUACUGUAUAGUCCCACCUGGUGAUCCUAUGCUUGUGAGUACCCAGCAACGAUGACAUACAUCGCUAGUCGACGC";
+
+    const std::vector<ProbCase> cases = {
+        {h_type, "((((............))))........", false, 2},
+        {h_type, std::string(h_type.size(), '.'), false, 1},
+        {k_type, "(((((...............))))).....(((((...............)))))", false, 2},
+        {k_type, "(((((...............))))).....(((((...............)))))", false, 0},
+        {long_seq, "..(................................(...............)...)....(....................).......", false, 2},
+        {long_seq, "..(................................(...............)...)....(....................).......", true, 2},
+        {long_seq, std::string(long_seq.size(), '.'), false, 2},
+    };
+
+    for (const ProbCase &prob_case : cases) {
+        if (!check_case(prob_case)) return 1;
+    }
+    return 0;
+}
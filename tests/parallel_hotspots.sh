@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+if [[ $# -ne 1 ]]; then
+  echo "usage: $0 <cparty_binary>" >&2
+  exit 2
+fi
+
+binary="$1"
+
+if [[ ! -x "$binary" ]]; then
+  echo "binary is not executable: $binary" >&2
+  exit 1
+fi
+
+seq="GGGGAAACCCCAUAUAUGCGCGAAAGCGCAUAUAAAGGGCCCAAAGGGCCCUUUAGCUAGCUAAAGCUAGCU"
+
+# Hotspots folded on several workers must be reported exactly as the serial run reports them
+for flags in "-n 6" "-n 6 -p" "-n 4 -d0"; do
+  # shellcheck disable=SC2086
+  serial="$("$binary" --noPS $flags -t 1 "$seq")"
+  # shellcheck disable=SC2086
+  parallel="$("$binary" --noPS $flags -t 4 "$seq")"
+  if [[ "$serial" != "$parallel" ]]; then
+    echo "parallel hotspots differ from the serial run for flags: $flags" >&2
+    diff <(printf '%s\n' "$serial") <(printf '%s\n' "$parallel") >&2 || true
+    exit 1
+  fi
+done
+
+echo "parallel hotspot folds match the serial run"
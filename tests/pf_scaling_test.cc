@@ -0,0 +1,103 @@
+#include "W_final.hh"
+#include "part_func.hh"
+#include "sparse_tree.hh"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct ScaledFold {
+    double pf_energy;
+    std::vector<double> probabilities;
+};
+
+ScaledFold run_partition(const std::string &seq, const std::string &restricted, const std::string &mfe_structure, bool pk_free, double energy) {
+    const int n = static_cast<int>(seq.size());
+    sparse_tree tree(restricted, n);
+    std::string mutable_seq = seq;
+    std::string mutable_final = mfe_structure;
+    W_final_pf partition(mutable_seq, mutable_final, pk_free, false, false, 2, energy, 10, false);
+    ScaledFold fold{partition.hfold_pf(tree), {}};
+    for (int i = 1; i <= n; ++i) {
+        for (int j = i + 1; j <= n; ++j)
+            fold.probabilities.push_back(partition.get_probability(i, j));
+    }
+    return fold;
+}
+
+// Drops every pair of the structure whose left end is not a multiple of keep_every, so the rest becomes the input structure
+std::string thin_structure(const std::string &structure, int keep_every) {
+    std::string thinned = structure;
+    std::vector<int> open;
+    for (int i = 0; i < static_cast<int>(thinned.size()); ++i) {
+        if (thinned[i] == '(') open.push_back(i);
+        if (thinned[i] == ')') {
+            const int k = open.back();
+            open.pop_back();
+            if ((k + 1) % keep_every != 0) thinned[i] = thinned[k] = '.';
+        }
+    }
+    return thinned;
+}
+
+bool check_case(const std::string &seq, const std::string &restricted, bool pk_free) {
+    const int n = static_cast<int>(seq.size());
+    sparse_tree tree(restricted, n);
+    W_final mfe(seq, restricted, pk_free, false, 2);
+    const double energy = mfe.hfold(tree);
+
+    const ScaledFold unscaled = run_partition(seq, restricted, mfe.structure, pk_free, energy);
+    // An MFE this low makes hfold_pf scale every nucleotide by a factor of about 20
+    const ScaledFold scaled = run_partition(seq, restricted, mfe.structure, pk_free, -1.8 * n);
+
+    if (std::fabs(unscaled.pf_energy - scaled.pf_energy) > 1e-9 * std::fabs(unscaled.pf_energy) + 1e-9) {
+        std::cerr << "ensemble energy changes with the scale: " << unscaled.pf_energy << " vs " << scaled.pf_energy << " for " << seq << " "
+                  << restricted << std::endl;
+        return false;
+    }
+    // The ensemble energy alone, scaled from guess_mfe instead of the MFE as get_cond_log_prob computes it
+    std::string mutable_seq = seq;
+    std::string mutable_final = mfe.structure;
+    W_final_pf energy_only(mutable_seq, mutable_final, pk_free, false, false, 2, guess_mfe(n), 0, false);
+    const double pf_energy = energy_only.hfold_pf_energy(tree);
+    if (std::fabs(unscaled.pf_energy - pf_energy) > 1e-9 * std::fabs(unscaled.pf_energy) + 1e-9) {
+        std::cerr << "ensemble energy without the outputs differs: " << unscaled.pf_energy << " vs " << pf_energy << " for " << seq << " "
+                  << restricted << std::endl;
+        return false;
+    }
+    for (size_t k = 0; k < unscaled.probabilities.size(); ++k) {
+        if (std::fabs(unscaled.probabilities[k] - scaled.probabilities[k]) > 1e-9) {
+            std::cerr << "pair probability changes with the scale: " << unscaled.probabilities[k] << " vs " << scaled.probabilities[k] << " for "
+                      << seq << " " << restricted << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 generator(4);
+    for (int c = 0; c < 6; ++c) {
+        std::string seq;
+        for (int i = 0; i < 120; ++i)
+            seq += "ACGU"[generator() % 4];
+        const int n = static_cast<int>(seq.size());
+
+        const std::string unrestricted(n, '.');
+        if (!check_case(seq, unrestricted, true)) return 1;
+
+        sparse_tree tree(unrestricted, n);
+        W_final pk_free_mfe(seq, unrestricted, true, false, 2);
+        pk_free_mfe.hfold(tree);
+        for (int keep_every : {1, 2, 3}) {
+            if (!check_case(seq, thin_structure(pk_free_mfe.structure, keep_every), false)) return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "W_final.hh"
+#include "part_func.hh"
+#include "sequence_context.hh"
+#include "sparse_tree.hh"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct FoldSnapshot {
+    std::string structure;
+    double energy;
+    double pf_energy;
+    std::vector<double> probabilities;
+};
+
+// Folds with a private context when shared is null, as the plain constructors do
+FoldSnapshot run_fold(const std::string &seq, const std::string &restricted, bool pk_free, int dangles,
+                      const std::shared_ptr<const cparty::SequenceContext> &shared) {
+    const int n = static_cast<int>(seq.size());
+    sparse_tree tree(restricted, n);
+    std::unique_ptr<W_final> mfe(shared ? new W_final(shared, restricted, pk_free, false) : new W_final(seq, restricted, pk_free, false, dangles));
+    const double energy = mfe->hfold(tree);
+
+    std::string mutable_seq = seq;
+    std::string mutable_final = mfe->structure;
+    std::unique_ptr<W_final_pf> partition(shared ? new W_final_pf(shared, mutable_final, pk_free, false, false, energy, 10, false)
+                                                 : new W_final_pf(mutable_seq, mutable_final, pk_free, false, false, dangles, energy, 10, false));
+    FoldSnapshot snapshot{mfe->structure, energy, partition->hfold_pf(tree), {}};
+    for (int i = 1; i <= n; ++i) {
+        for (int j = i + 1; j <= n; ++j)
+            snapshot.probabilities.push_back(partition->get_probability(i, j));
+    }
+    return snapshot;
+}
+
+} // namespace
+
+int main() {
+    const std::string seq = "UCGGUUAUCUUCGGAUACUGUAUAGUCCCACCUGGUGAUCCUAUGCUUGUGAGUACCCAGCAACGAUGACAUACAUCGCUAGUCGACGC";
+    const int n = static_cast<int>(seq.size());
+    const std::vector<std::string> restrictions = {
+        std::string(n, '.'),
+        "..(................................(...............)...)....(....................).......",
+        "..........................................................((((((....................))))))",
+    };
+
+    for (int dangles : {0, 2}) {
+        // one context serves every restriction of the sequence, as the hotspots of the driver share it
+        auto context = std::make_shared<const cparty::SequenceContext>(seq, dangles);
+        for (const std::string &restricted : restrictions) {
+            for (bool pk_free : {false, true}) {
+                const FoldSnapshot own = run_fold(seq, restricted, pk_free, dangles, nullptr);
+                const FoldSnapshot shared = run_fold(seq, restricted, pk_free, dangles, context);
+                if (own.structure != shared.structure || own.energy != shared.energy || own.pf_energy != shared.pf_energy
+                    || own.probabilities != shared.probabilities) {
+                    std::cerr << "shared context changes the fold of " << restricted << " (pk_free " << pk_free << ", dangles " << dangles
+                              << "): " << own.energy << " / " << own.pf_energy << " vs " << shared.energy << " / " << shared.pf_energy
+                              << std::endl;
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
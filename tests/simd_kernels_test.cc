@@ -0,0 +1,88 @@
+#include "simd_kernels.hh"
+
+extern "C" {
+#include "ViennaRNA/params/constants.h"
+}
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using cparty::simd::Kernel;
+
+int main() {
+    std::mt19937 generator(21);
+    std::uniform_real_distribution<double> value(0, 1e3);
+    // the scaled Boltzmann factors span many orders of magnitude
+    std::uniform_int_distribution<int> exponent(-40, 40);
+
+    for (int len : {0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 63, 64, 100, 1000, 4097}) {
+        // one past the start too, as the splits begin anywhere in a row
+        std::vector<pf_t> a(len + 1), b(len + 1);
+        for (int t = 0; t <= len; ++t) {
+            a[t] = value(generator) * std::pow(10.0, exponent(generator));
+            b[t] = value(generator) * std::pow(10.0, exponent(generator));
+        }
+        for (int offset : {0, 1}) {
+            const int count = len + 1 - offset;
+            const pf_t plain = cparty::simd::sum_product(Kernel::plain, a.data() + offset, b.data() + offset, count);
+
+            pf_t naive = 0;
+            for (int t = 0; t < count; ++t)
+                naive += a[offset + t] * b[offset + t];
+            if (std::fabs(plain - naive) > 1e-12 * std::fabs(naive)) {
+                std::cerr << "length " << count << ": the plain kernel sums " << plain << " instead of " << naive << std::endl;
+                return 1;
+            }
+
+            for (Kernel kernel : {Kernel::sse2, Kernel::avx2, Kernel::avx512}) {
+                if (!cparty::simd::is_supported(kernel)) continue;
+                const pf_t sum = cparty::simd::sum_product(kernel, a.data() + offset, b.data() + offset, count);
+                if (std::memcmp(&sum, &plain, sizeof(pf_t)) != 0) {
+                    std::cerr << "length " << count << ": the " << cparty::simd::kernel_name(kernel) << " kernel sums " << sum
+                              << " instead of the " << plain << " of the plain kernel" << std::endl;
+                    return 1;
+                }
+            }
+            const pf_t best = cparty::simd::sum_product(a.data() + offset, b.data() + offset, count);
+            if (std::memcmp(&best, &plain, sizeof(pf_t)) != 0) {
+                std::cerr << "length " << count << ": the " << cparty::simd::kernel_name(cparty::simd::best_kernel()) << " kernel picked for "
+                          << "this machine does not sum as the plain kernel" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // energies of either sign, with INF and the values above it that INF arithmetic leaves in the matrices
+    std::uniform_int_distribution<energy_t> energy(-40000, 40000);
+    for (int len : {0, 1, 3, 4, 5, 8, 15, 16, 17, 33, 100, 1000, 4097}) {
+        std::vector<energy_t> a(len), b(len);
+        for (int t = 0; t < len; ++t) {
+            a[t] = generator() % 4 == 0 ? INF + energy(generator) : energy(generator);
+            b[t] = generator() % 4 == 0 ? INF : energy(generator);
+        }
+        for (bool unreachable : {false, true}) {
+            if (unreachable) std::fill(a.begin(), a.end(), INF);
+            energy_t naive = INF;
+            for (int t = 0; t < len; ++t)
+                naive = std::min(naive, a[t] + b[t]);
+            for (Kernel kernel : {Kernel::plain, Kernel::sse2, Kernel::avx2, Kernel::avx512}) {
+                if (!cparty::simd::is_supported(kernel)) continue;
+                const energy_t lowest = cparty::simd::min_sum(kernel, a.data(), b.data(), len);
+                if (lowest != naive) {
+                    std::cerr << "length " << len << ": the " << cparty::simd::kernel_name(kernel) << " kernel finds " << lowest << " instead of "
+                              << naive << std::endl;
+                    return 1;
+                }
+            }
+            if (cparty::simd::min_sum(a.data(), b.data(), len) != naive) {
+                std::cerr << "length " << len << ": the min_sum kernel picked for this machine finds another minimum" << std::endl;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
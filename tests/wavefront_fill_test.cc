@@ -0,0 +1,90 @@
+#include "W_final.hh"
+#include "part_func.hh"
+#include "sparse_tree.hh"
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct FillCase {
+    std::string seq;
+    std::string restricted;
+    bool pk_free;
+    bool pk_only;
+    int dangles;
+};
+
+struct FoldSnapshot {
+    std::string structure;
+    double energy;
+    double pf_energy;
+    std::unordered_map<std::string, int> samples;
+};
+
+FoldSnapshot run_fold(const FillCase &fill_case, int threads) {
+    sparse_tree tree(fill_case.restricted, static_cast<int>(fill_case.seq.size()));
+    W_final mfe(fill_case.seq, fill_case.restricted, fill_case.pk_free, fill_case.pk_only, fill_case.dangles, threads);
+    const double energy = mfe.hfold(tree);
+
+    constexpr bool kFatgraph = false;
+    constexpr int kNumSamples = 200;
+    constexpr bool kPsPlot = false;
+    std::string mutable_seq = fill_case.seq;
+    std::string mutable_final = mfe.structure;
+    W_final_pf partition(mutable_seq, mutable_final, fill_case.pk_free, fill_case.pk_only, kFatgraph, fill_case.dangles, energy, kNumSamples,
+                         kPsPlot, threads);
+    const double pf_energy = partition.hfold_pf(tree);
+    return FoldSnapshot{mfe.structure, energy, pf_energy, partition.structures};
+}
+
+} // namespace
+
+int main() {
+    const std::string h_type = "GGGCAAAAGGCGAAAAGCCCAAAACGCC";
+    const std::string k_type = "GGCGGAAAAACCGGCAAAAACCGCCAAAAACGGGUAAUAAGCUGGAAAAAGCCCG";
+    const std::string long_seq = "UCGGUUAUCUUCGGAUACUGUAUAGUCCCACCUGGUGAUCCUAUGCUUGUGAGUACCCAGCAACGAUGACAUACAUCGCUAGUCGACGC";
+
+    const std::vector<FillCase> cases = {
+        {h_type, "((((............))))........", false, false, 2},
+        {h_type, "........((((............))))", false, true, 2},
+        {h_type, std::string(h_type.size(), '.'), false, false, 1},
+        {k_type, "(((((...............))))).....(((((...............)))))", false, false, 2},
+        {k_type, "(((((...............))))).....(((((...............)))))", false, false, 0},
+        {long_seq, "..(................................(...............)...)....(....................).......", false, false, 2},
+        {long_seq, "..(................................(...............)...)....(....................).......", true, false, 2},
+        {long_seq, std::string(long_seq.size(), '.'), false, false, 2},
+    };
+
+    for (const FillCase &fill_case : cases) {
+        const FoldSnapshot serial = run_fold(fill_case, 1);
+        for (int threads : {2, 4}) {
+            const FoldSnapshot wavefront = run_fold(fill_case, threads);
+            if (serial.structure != wavefront.structure) {
+                std::cerr << "structure differs with " << threads << " threads for " << fill_case.seq << ": serial=" << serial.structure
+                          << " wavefront=" << wavefront.structure << std::endl;
+                return 1;
+            }
+            if (serial.energy != wavefront.energy) {
+                std::cerr << "energy differs with " << threads << " threads for " << fill_case.seq << ": serial=" << serial.energy
+                          << " wavefront=" << wavefront.energy << std::endl;
+                return 1;
+            }
+            // the summation order of every cell is fixed, so the ensemble energy must match bit for bit
+            if (serial.pf_energy != wavefront.pf_energy) {
+                std::cerr << "ensemble energy differs with " << threads << " threads for " << fill_case.seq << ": serial=" << serial.pf_energy
+                          << " wavefront=" << wavefront.pf_energy << std::endl;
+                return 1;
+            }
+            // every draw has its own random stream, so the sampled structures must not depend on the thread count either
+            if (serial.samples != wavefront.samples) {
+                std::cerr << "sampled structures differ with " << threads << " threads for " << fill_case.seq << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
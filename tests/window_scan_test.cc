@@ -0,0 +1,125 @@
+#include "W_final.hh"
+#include "part_func.hh"
+#include "sparse_tree.hh"
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using PairProbabilities = std::map<std::pair<int, int>, double>;
+
+PairProbabilities run_scan(const std::string &seq, const std::string &restricted, bool pk_free, int dangles, int window, int max_span) {
+    const int n = static_cast<int>(seq.size());
+    sparse_tree tree(restricted, n);
+    std::string mutable_seq = seq;
+    std::string no_structure;
+    W_final_pf scan(mutable_seq, no_structure, pk_free, false, false, dangles, guess_mfe(n), 0, false, 1, 0, max_span, window);
+    std::ostringstream out;
+    out.precision(17);
+    scan.scan_windows(tree, 0, out);
+
+    PairProbabilities probabilities;
+    std::istringstream lines(out.str());
+    int i, j;
+    double p;
+    while (lines >> i >> j >> p)
+        probabilities[{i, j}] = p;
+    return probabilities;
+}
+
+// The pair probabilities of a fold of seq alone, shifted by offset
+void add_fold(PairProbabilities &probabilities, const std::string &seq, const std::string &restricted, bool pk_free, int dangles, int max_span,
+              int offset, double weight) {
+    const int n = static_cast<int>(seq.size());
+    sparse_tree tree(restricted, n);
+    W_final mfe(seq, restricted, pk_free, false, dangles, 1, max_span);
+    const double energy = mfe.hfold(tree);
+    std::string mutable_seq = seq;
+    std::string mutable_final = mfe.structure;
+    W_final_pf partition(mutable_seq, mutable_final, pk_free, false, false, dangles, energy, 0, false, 1, 0, max_span);
+    partition.hfold_pf(tree);
+    for (int i = 1; i <= n; ++i) {
+        for (int j = i + 1; j <= std::min(n, i + max_span); ++j)
+            probabilities[{i + offset, j + offset}] += weight * partition.get_probability(i, j);
+    }
+}
+
+bool same_probabilities(const PairProbabilities &scanned, const PairProbabilities &expected, const std::string &what) {
+    if (scanned.size() != expected.size()) {
+        std::cerr << what << ": the scan wrote " << scanned.size() << " pairs instead of " << expected.size() << std::endl;
+        return false;
+    }
+    for (const auto &it : expected) {
+        auto found = scanned.find(it.first);
+        if (found == scanned.end() || std::fabs(found->second - it.second) > 1e-9) {
+            std::cerr << what << ": pair " << it.first.first << "." << it.first.second << " has " << (found == scanned.end() ? -1 : found->second)
+                      << " instead of " << it.second << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Drops every pair of the structure whose left end is not a multiple of keep_every, so the rest becomes the input structure
+std::string thin_structure(const std::string &structure, int keep_every) {
+    std::string thinned = structure;
+    std::vector<int> open;
+    for (int i = 0; i < static_cast<int>(thinned.size()); ++i) {
+        if (thinned[i] == '(') open.push_back(i);
+        if (thinned[i] == ')') {
+            const int k = open.back();
+            open.pop_back();
+            if ((k + 1) % keep_every != 0) thinned[i] = thinned[k] = '.';
+        }
+    }
+    return thinned;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 generator(17);
+    for (int c = 0; c < 3; ++c) {
+        std::string seq;
+        for (int i = 0; i < 70; ++i)
+            seq += "ACGU"[generator() % 4];
+        const int n = static_cast<int>(seq.size());
+        const std::string unrestricted(n, '.');
+
+        // a single window is the fold of the whole sequence, pseudoknots across the input structure included
+        constexpr int kSpan = 30;
+        sparse_tree tree(unrestricted, n);
+        W_final pk_free_mfe(seq, unrestricted, true, false, 2, 1, kSpan);
+        pk_free_mfe.hfold(tree);
+        const std::vector<std::pair<std::string, bool>> inputs = {
+            {unrestricted, true}, {unrestricted, false}, {thin_structure(pk_free_mfe.structure, 2), false}, {thin_structure(pk_free_mfe.structure, 3), false}};
+        for (const auto &input : inputs) {
+            for (int max_span : {n - 1, kSpan}) {
+                PairProbabilities expected;
+                add_fold(expected, seq, input.first, input.second, 2, max_span, 0, 1);
+                if (!same_probabilities(run_scan(seq, input.first, input.second, 2, n, max_span), expected, "one window " + input.first)) return 1;
+            }
+        }
+
+        // without dangles a window scores its pairs as the fold of its nucleotides alone does
+        for (int window : {25, 40}) {
+            const int max_span = window - 5;
+            PairProbabilities expected;
+            for (int start = 1; start + window - 1 <= n; ++start)
+                add_fold(expected, seq.substr(start - 1, window), std::string(window, '.'), true, 0, max_span, start - 1, 1);
+            for (auto &it : expected) {
+                const int i = it.first.first, j = it.first.second;
+                it.second /= std::min(i, n - window + 1) - std::max(1, j - window + 1) + 1;
+            }
+            if (!same_probabilities(run_scan(seq, unrestricted, true, 0, window, max_span), expected, "window " + std::to_string(window))) return 1;
+        }
+    }
+    return 0;
+}